@@ -0,0 +1,142 @@
+/*
+   Snapshot Benchmark
+
+   Startup time for a large reservation history: the text snapshot as
+   reservations.txt is imported, against the binary snapshot mapped and
+   indexed in place. Both load through ofdx_reservation.h, as the server
+   does, and end with the same indexes. Fails if the binary snapshot takes
+   longer than the budget to load.
+
+   Usage: bench_snapshot [reservations] [objects] [budget in ms]
+*/
+
+#include "ofdx_reservation.h"
+
+#include <chrono>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+
+#include <stdlib.h>
+
+// What loading the binary snapshot may take for each million reservations,
+// unless a budget is given. The text snapshot takes seconds.
+#define BUDGET_MS_PER_MILLION 250.0
+
+typedef std::map<std::string, std::shared_ptr<OfdxReservations>> Objects;
+
+static double msSince(std::chrono::steady_clock::time_point const& t0){
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+}
+
+static Objects makeObjects(size_t const count){
+	Objects objects;
+
+	for(size_t i = 0; i < count; ++ i)
+		objects["cluster" + std::to_string(i)] = std::make_shared<OfdxReservations>();
+
+	return objects;
+}
+
+int main(int argc, char **argv){
+	size_t const reservationCount = (argc > 1) ? std::stoul(argv[1]) : 1000000;
+	size_t const objectCount = (argc > 2) ? std::stoul(argv[2]) : 1000;
+	double const budget = (argc > 3) ? std::stod(argv[3]) : BUDGET_MS_PER_MILLION * reservationCount / 1000000;
+
+	char dir[] = "/tmp/bench_snapshot.XXXXXX";
+
+	if(!mkdtemp(dir)){
+		std::cerr << "Error: cannot create a temporary directory" << std::endl;
+		return 1;
+	}
+
+	std::string const textPath(std::string(dir) + "/reservations.txt");
+	std::string const binPath(std::string(dir) + "/reservations.bin");
+
+	// Back to back hour-long reservations, with a session and a name each.
+	{
+		std::mt19937_64 rng(42);
+		std::string text;
+		OfdxSnapshotWriter writer;
+
+		size_t const perObject = reservationCount / objectCount;
+
+		for(size_t i = 0; i < objectCount; ++ i){
+			std::string const id("cluster" + std::to_string(i));
+			time_t t = 1704479574;
+
+			writer.addObject(id);
+
+			for(size_t j = 0; j < perObject + ((i < reservationCount % objectCount) ? 1 : 0); ++ j){
+				std::string const sid(std::to_string(rng()) + std::to_string(rng()) + std::to_string(rng()));
+				std::string const info("user" + std::to_string(rng() % 100));
+
+				text += id + " " + std::to_string(t) + " " + std::to_string(t + 3599) + " " + sid + " " + info + "\n";
+				writer.addRecord(t, t + 3599, sid, info);
+
+				t += 3600;
+			}
+		}
+
+		if(!ofdxWriteFileAtomically(textPath, text) || !ofdxWriteFileAtomically(binPath, writer.finish())){
+			std::cerr << "Error: cannot write to " << dir << std::endl;
+			return 1;
+		}
+	}
+
+	std::cout << reservationCount << " reservations, " << objectCount << " objects" << std::endl;
+
+	// Each run starts with no sessions, as the server does, so that neither
+	// finds them interned by the other.
+	int result = 0;
+	{
+		Objects objects = makeObjects(objectCount);
+		OfdxSessionTable sessions("open");
+		auto const t0 = std::chrono::steady_clock::now();
+		size_t const n = ofdxImportReservations(textPath, sessions, [&](std::string const& id) -> OfdxReservations* {
+			auto const it = objects.find(id);
+			return (it == objects.end()) ? nullptr : it->second.get();
+		});
+
+		std::cout << "text:   " << msSince(t0) << " ms (" << n << " loaded)" << std::endl;
+	}
+	{
+		// The mapping outlives the indexes and the sessions, as in the server.
+		OfdxSnapshotReader snapshot;
+		Objects objects = makeObjects(objectCount);
+		OfdxSessionTable sessions("open");
+		auto const t0 = std::chrono::steady_clock::now();
+		size_t n = 0;
+
+		if(snapshot.open(binPath)){
+			n = ofdxIndexSnapshot(snapshot, sessions, [&](size_t const i) -> OfdxReservations* {
+				auto const it = objects.find(std::string(snapshot.objectId(i)));
+				return (it == objects.end()) ? nullptr : it->second.get();
+			});
+		} else {
+			std::cerr << "Error: " << binPath << ": " << snapshot.error() << std::endl;
+		}
+
+		double const ms = msSince(t0);
+
+		std::cout << "binary: " << ms << " ms (" << n << " loaded, budget " << budget << " ms)" << std::endl;
+
+		if(n != reservationCount){
+			std::cerr << "Error: " << reservationCount << " reservations written, " << n << " loaded" << std::endl;
+			result = 1;
+		}
+
+		if(ms > budget){
+			std::cerr << "Error: the binary snapshot took longer than " << budget << " ms to load" << std::endl;
+			result = 1;
+		}
+	}
+
+	unlink(textPath.c_str());
+	unlink(binPath.c_str());
+	rmdir(dir);
+
+	return result;
+}
@@ -4,37 +4,128 @@ OUTFILE=../res.h
 
 cd resource;
 
+# Print the bytes of a file as C string literal lines.
+bytes(){
+	od -An -v -tx1 | sed -e 's/ \([0-9a-f][0-9a-f]\)/\\x\1/g' -e 's/^/\t\t\t"/' -e 's/$/"/'
+}
+
 cat > $OUTFILE << EOF
 /*
-	This file is automatically generated during the build by base64 encoding
-	all of the files in the resource directory.
+	This file is automatically generated during the build from all of the
+	files in the resource directory. Everything in it is a constant, so the
+	resources sit in read-only data and need no work at startup.
 */
 
-#include <unordered_map>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string_view>
 
 struct Resource {
-	std::string mime, data;
+	// etag is a hash of the content, quoted, for the ETag header. gzip is the
+	// content compressed, or empty if compressing does not make it smaller.
+	std::string_view name, mime, etag, data, gzip;
 };
 
-std::ostream& operator << (std::ostream &os, Resource const& rsc){
-	os << rsc.data;
+inline std::ostream& operator << (std::ostream &os, Resource const& rsc){
+	os.write(rsc.data.data(), rsc.data.size());
 	return os;
 }
 
-std::unordered_map<std::string, Resource> resources;
-
-void loadResources(){
+constexpr Resource resourceTable[] = {
 EOF
 
 for F in *; do
-	cat >> $OUTFILE <<-EOF
-		resources["$F"] = {
-			.mime = "$(mimetype -b "$F")",
-			.data = $(base64 "$F" | sed -e 's/\(^.*$\)/"\1"/')
-		};
-	EOF
+	SIZE=$(stat -c %s "$F")
+	GZSIZE=$(gzip -9 -n -c "$F" | wc -c)
+
+	echo "	{" >> $OUTFILE
+	echo "		.name = \"$F\"," >> $OUTFILE
+	echo "		.mime = \"$(mimetype -b "$F")\"," >> $OUTFILE
+	echo "		.etag = \"\\\"$(sha1sum "$F" | cut -c1-20)\\\"\"," >> $OUTFILE
+	echo "		.data = std::string_view(" >> $OUTFILE
+
+	bytes < "$F" >> $OUTFILE
+	echo "			\"\", $SIZE)," >> $OUTFILE
+
+	if [ $GZSIZE -lt $SIZE ]; then
+		echo "		.gzip = std::string_view(" >> $OUTFILE
+		gzip -9 -n -c "$F" | bytes >> $OUTFILE
+		echo "			\"\", $GZSIZE)" >> $OUTFILE
+	else
+		echo "		.gzip = std::string_view()" >> $OUTFILE
+	fi
+
+	echo "	}," >> $OUTFILE
 done
 
 cat >> $OUTFILE << EOF
+};
+
+constexpr size_t RESOURCE_COUNT = sizeof(resourceTable) / sizeof(resourceTable[0]);
+
+// Names are found through a perfect hash: the seed is searched for at
+// compile time, so that every name lands in a slot of its own.
+constexpr size_t RESOURCE_SLOTS = [](){
+	size_t n = 1;
+
+	while(n < RESOURCE_COUNT * 2)
+		n <<= 1;
+
+	return n;
+}();
+
+constexpr uint32_t resourceHash(std::string_view const name, uint32_t const seed){
+	uint32_t h = 2166136261u ^ seed;
+
+	for(char const c : name)
+		h = (h ^ (unsigned char) c) * 16777619u;
+
+	return h ^ (h >> 15);
 }
+
+constexpr uint32_t RESOURCE_SEED = [](){
+	for(uint32_t seed = 0;; ++ seed){
+		bool used[RESOURCE_SLOTS] = {};
+		bool ok = true;
+
+		for(size_t i = 0; ok && (i < RESOURCE_COUNT); ++ i){
+			size_t const slot = resourceHash(resourceTable[i].name, seed) & (RESOURCE_SLOTS - 1);
+
+			ok = !used[slot];
+			used[slot] = true;
+		}
+
+		if(ok)
+			return seed;
+	}
+}();
+
+// Index into resourceTable, or -1 for an empty slot.
+constexpr std::array<int, RESOURCE_SLOTS> resourceSlots = [](){
+	std::array<int, RESOURCE_SLOTS> slots = {};
+
+	for(auto &slot : slots)
+		slot = -1;
+
+	for(size_t i = 0; i < RESOURCE_COUNT; ++ i)
+		slots[resourceHash(resourceTable[i].name, RESOURCE_SEED) & (RESOURCE_SLOTS - 1)] = i;
+
+	return slots;
+}();
+
+// Index into resourceTable of the named resource, or -1.
+constexpr int resourceIndex(std::string_view const name){
+	int const i = resourceSlots[resourceHash(name, RESOURCE_SEED) & (RESOURCE_SLOTS - 1)];
+
+	return ((i >= 0) && (resourceTable[i].name == name)) ? i : -1;
+}
+
+// Handles for the resources used by the code, named after their files.
 EOF
+
+for F in *; do
+	ID=$(echo "$F" | tr 'a-z.-' 'A-Z__')
+	echo "constexpr Resource const& RESOURCE_$ID = resourceTable[resourceIndex(\"$F\")];" >> $OUTFILE
+done
@@ -6,22 +6,50 @@
    shared lab environment.
 */
 
-#include "base64.h"
 #include "ofdx_fcgi.h"
 #include "res.h"
-#include "ncsa.h"
-
+#include "ofdx_interval_index.h"
+#include "ofdx_urlencoded.h"
+#include "ofdx_gzip.h"
+#include "ofdx_journal.h"
+#include "ofdx_reservation.h"
+#include "ofdx_session_table.h"
+#include "ofdx_snapshot.h"
+#include "ofdx_token.h"
+
+#include <limits>
 #include <map>
+#include <optional>
 #include <list>
+#include <queue>
 #include <set>
 
 #define BOOKIT_SID "bookit_sid"
 #define OPEN_SID "open"
 #define CLAIMED "Claimed"
 
+// Reservation changes journaled before the snapshot is rewritten.
+#define JOURNAL_COMPACT_RECORDS 1024
+
+// Pages expected to be at least this large are compressed for clients which
+// take gzip. Smaller ones would gain little, so they are sent as they always
+// were: the same to everyone, without Vary.
+#define GZIP_MIN_PAGE_BYTES 4096
+
+// About what each reservation listed adds to a page, to estimate its size
+// before it is written.
+#define PAGE_ROW_BYTES 128
+
 // Files in the resource directory will be available online here:
 std::string const PATH_OFDX_BOOKIT_RSC(PATH_OFDX_BOOKIT + "rsc/");
 
+// Server metrics, for clients on the loopback interface only.
+std::string const PATH_OFDX_BOOKIT_STATUS(PATH_OFDX_BOOKIT + "status");
+
+// The visitor's own reservations, as a page or (with format=json) for
+// scripts. POST cancel=all, or cancel=<id>:<start> for each one, to cancel.
+std::string const PATH_OFDX_BOOKIT_MINE(PATH_OFDX_BOOKIT + "mine");
+
 void get_the_rest(std::stringstream &src, std::string &dest){
 	if(src >> dest){
 		std::string buf;
@@ -31,75 +59,247 @@ void get_the_rest(std::stringstream &src, std::string &dest){
 	}
 }
 
-struct Bookable {
-	struct Reservation {
-		std::string m_sessionId, m_info;
-		time_t m_start, m_end;
+struct OfdxBookItConfig : OfdxBaseConfig {
+	// Write the reservations to reservations.txt and exit.
+	bool m_export;
 
-		void debug(std::stringstream &ss){
-			ss << "m_sessionId[" << m_sessionId << "] m_info[" << m_info << "] "
-				<< "m_start[" << m_start << "] m_end[" << m_end << "] delta[" << m_end - m_start << "]\n";
-		}
+	// Issue session IDs signed with the key in session.key, and accept no
+	// others.
+	bool m_signedSessions;
 
-		Reservation() :
-			m_start(0),
-			m_end(0)
-		{}
-	};
+	OfdxBookItConfig() :
+		OfdxBaseConfig(PORT_OFDX_BOOKIT, PATH_OFDX_BOOKIT),
+		m_export(false),
+		m_signedSessions(false)
+	{}
+
+	void receiveCliOption(std::string const& opt) override {
+		if(opt == "export")
+			m_export = true;
+		else if(opt == "signedsessions")
+			m_signedSessions = true;
+	}
+};
 
+struct Bookable {
+	// The sessions of reservations are interned in OfdxBookIt::m_sessions.
+	typedef OfdxReservation Reservation;
+	typedef OfdxReservations Reservations;
+
+	// Set when objects.txt is read, and constant afterwards.
 	std::string m_id, m_name, m_desc, m_group;
-	std::list<std::shared_ptr<Reservation>> m_reservations;
 
-	static bool cmp(std::shared_ptr<Bookable::Reservation> const& a, std::shared_ptr<Bookable::Reservation> const& b){
-		return (a->m_start < b->m_start);
-	}
-	void maintainReservations(time_t const timenow){
-		m_reservations.sort(cmp);
+	// Guards everything below, so that objects can be booked on several
+	// threads at once. Checking for a conflict and booking happen under the
+	// same lock.
+	std::mutex m_mutex;
 
-		// Find reservations we need to delete.
-		{
-			std::set<std::shared_ptr<Bookable::Reservation>> to_delete;
+	Reservations m_reservations;
 
-			for(auto it = m_reservations.begin(); it != m_reservations.end();){
-				if((*it)->m_end < timenow){
-					// Reservation is historical, delete it.
-					it = m_reservations.erase(it);
-					continue;
+	// Bumped whenever a reservation changes, for the ETag of its page.
+	uint64_t m_generation;
 
-				} else if((*it)->m_sessionId == OPEN_SID){
-					// Reservation is unclaimed space.
-					to_delete.insert(*it);
+	// When the expiry thread is due to look at this object next, or max() if
+	// it is not. Guarded by OfdxBookIt::m_expiryMutex rather than m_mutex.
+	time_t m_expiryDue;
 
-				} else {
-					// Unclaimed space must be preserved because an active
-					// reservation exists after it.
-					to_delete.clear();
-				}
+	Bookable() :
+		m_generation(1),
+		m_expiryDue(std::numeric_limits<time_t>::max())
+	{}
 
-				++ it;
-			}
+	// Earliest end of the reservations, or max() if there are none.
+	time_t earliestEnd() const {
+		time_t end = std::numeric_limits<time_t>::max();
 
-			if(!to_delete.empty()){
-				// Delete empty space.
-				for(auto it = m_reservations.begin(); it != m_reservations.end();){
-					if(to_delete.count(*it)){
-						it = m_reservations.erase(it);
-					} else {
-						++ it;
-					}
-				}
+		for(auto const& e : m_reservations)
+			end = std::min(end, e.m_when.max());
+
+		return end;
+	}
+
+	void addReservation(std::shared_ptr<Reservation> const& r){
+		m_reservations.insert(Reservations::Interval(r->m_start, r->m_end), r);
+	}
+
+	// Insert r, or overwrite the reservation with the same start.
+	void putReservation(std::shared_ptr<Reservation> const& r){
+		if(auto const e = m_reservations.find(r->m_start)){
+			*e->m_value = *r;
+			m_reservations.update(e, Reservations::Interval(r->m_start, r->m_end));
+		} else {
+			addReservation(r);
+		}
+	}
+
+	// Returns the removed reservations.
+	std::vector<std::shared_ptr<Reservation>> maintainReservations(time_t const timenow){
+		std::vector<std::shared_ptr<Reservation>> removed;
+
+		// Unclaimed space must be preserved if an active reservation exists
+		// after it.
+		bool held = false;
+		time_t lastHeldStart = 0;
+
+		for(auto const& e : m_reservations){
+			if((e.m_value->m_end >= timenow) && (e.m_value->m_session != OfdxSessionTable::OPEN)){
+				held = true;
+				lastHeldStart = e.m_value->m_start;
 			}
 		}
+
+		// Delete historical reservations and the remaining unclaimed space.
+		m_reservations.removeIf([&](Reservations::Entry const& e){
+			bool const remove = (e.m_value->m_end < timenow) ||
+				((e.m_value->m_session == OfdxSessionTable::OPEN) && (!held || (e.m_value->m_start > lastHeldStart)));
+
+			if(remove)
+				removed.push_back(e.m_value);
+
+			return remove;
+		});
+
+		return removed;
 	}
 };
 
 class OfdxBookIt : public OfdxFcgiService {
-	time_t m_timenow;
+	// State of the request being handled.
+	struct Request : OfdxRequestContext {
+		std::string m_sessionId;
+
+		// Handle of m_sessionId, or NONE until it holds a reservation.
+		OfdxSessionTable::Handle m_session;
+
+		time_t m_timenow;
+
+		// Last journal record of the changes made by this request, if any.
+		uint64_t m_journalSeq;
+
+		Request() :
+			m_session(OfdxSessionTable::NONE),
+			m_timenow(0),
+			m_journalSeq(0)
+		{}
+	};
+
+	// The list of a group on the home page, rendered for nobody in particular.
+	// A reader's own items are spliced in over the spans they replace.
+	struct HomeFragment {
+		struct Item {
+			Bookable const *m_object;
+			size_t m_begin, m_end;
+		};
+
+		// A rendering, which is never changed once it is published, so that
+		// pages can be sent from it without holding any lock.
+		struct Rendered {
+			std::string m_html;
+			std::vector<Item> m_items;
+
+			// What it was rendered from, and until when it holds.
+			uint64_t m_generation;
+			time_t m_renderedAt, m_validUntil;
+
+			// Counts the renders, for the ETag of the home page.
+			uint64_t m_version;
+		};
+
+		// Bumped whenever a reservation of the group changes, with the lock of
+		// the object held.
+		std::atomic<uint64_t> m_generation;
+
+		// Guards m_rendered, and lets only one reader render at a time.
+		std::mutex m_mutex;
+		std::shared_ptr<Rendered const> m_rendered;
+
+		HomeFragment() :
+			m_generation(1)
+		{}
+	};
+
+	// A resource file, framed for each way it may be asked for.
+	struct FramedResource {
+		struct Variant {
+			std::string m_etag;
+			std::shared_ptr<dmitigr::fcgi::Framed_output const> m_get, m_head, m_notModified;
+		};
+
+		// Without a gzip variant (m_get is null), the response does not vary.
+		Variant m_identity, m_gzip;
+	};
+
+	// Requests may be handled on several worker threads at once. Each object
+	// has a lock of its own (Bookable::m_mutex), so that bookings on different
+	// objects do not wait for each other. The maps of objects below are not
+	// changed after startup. Where an object lock is held, only the locks
+	// of m_held, m_expiries, m_sessions and m_journal may be taken, and
+	// nothing is locked while holding those. No thread holds two object locks
+	// at once. A home page fragment is locked before the objects of its group.
+
+	// Changes to the reservations since the snapshot in reservations.bin.
+	// Records are appended under the lock of their object, so the records of
+	// each object are in order. They are committed after it is released, so
+	// that concurrent requests share the fsync.
+	OfdxJournal m_journal;
+
+	// Only one compaction at a time.
+	std::mutex m_compactMutex;
+	std::atomic<uint64_t> m_compactionCount;
+
+	// Objects by the time their earliest reservation runs out, for the
+	// expiry thread. An entry whose time is not the object's m_expiryDue has
+	// been superseded, and is skipped.
+	typedef std::pair<time_t, Bookable*> Expiry;
+	std::priority_queue<Expiry, std::vector<Expiry>, std::greater<Expiry>> m_expiries;
+
+	// Guards m_expiries, m_expiryStopping, m_compactDue and the m_expiryDue
+	// of each object.
+	std::mutex m_expiryMutex;
+
+	// Woken when an earlier expiry is scheduled, a compaction is due, or to
+	// stop.
+	std::condition_variable m_expiryCv;
+	std::thread m_expiryThread;
+	bool m_expiryStopping;
+
+	// The journal has grown enough to be compacted by the expiry thread, so
+	// that no request waits for the snapshot to be rewritten.
+	bool m_compactDue;
+	std::atomic<uint64_t> m_expiredCount;
+
+	// By group name, one for each group of m_objectsByGroup.
+	std::map<std::string, HomeFragment> m_homeFragments;
+	std::atomic<uint64_t> m_homeCacheHits, m_homeCacheMisses;
+
+	// The snapshot loaded at startup, which the reservations it held are
+	// indexed in place from, and whose sessions m_sessions adopted. Mapped
+	// for as long as the service lives, so declared before them.
+	OfdxSnapshotReader m_snapshot;
+
+	// Object of each object index of m_snapshot, or nullptr for those no
+	// longer in objects.txt.
+	std::vector<Bookable*> m_snapshotObjects;
+
+	// Session IDs of the reservations.
+	OfdxSessionTable m_sessions;
+
+	// The reservations of each session other than OPEN, by start and
+	// object, so a visitor's own are found without looking at anybody
+	// else's. Kept up to date with every change. The reservations themselves
+	// are read under the lock of their object.
+	typedef std::set<std::pair<time_t, Bookable*>> Held;
+	std::unordered_map<OfdxSessionTable::Handle, Held> m_held;
+	std::mutex m_heldMutex;
 
 	// Map by ID of everything we can book.
 	std::map<std::string, std::shared_ptr<Bookable>> m_objects;
 	std::map<std::string, std::shared_ptr<std::list<std::shared_ptr<Bookable>>>> m_objectsByGroup;
 
+	// Complete responses for the resource files, framed once at startup so
+	// they can be sent without copying. Read-only after startup.
+	std::array<FramedResource, RESOURCE_COUNT> m_framedResources;
+
 	void parseObject(std::ifstream &infile){
 		std::shared_ptr<Bookable> b;
 		std::string line;
@@ -134,6 +334,7 @@ class OfdxBookIt : public OfdxFcgiService {
 
 				// Object is complete, add to map.
 				m_objects[b->m_id] = b;
+				m_homeFragments[b->m_group];
 
 				// Add to list ordered by group.
 				auto l = m_objectsByGroup[b->m_group];
@@ -162,36 +363,284 @@ class OfdxBookIt : public OfdxFcgiService {
 		}
 	}
 
-	void parseReservation(std::string const& line){
+	// Text format, for import and export:
+	//  cluster9 1704479574 1704483174 abcd1234b64 mperron
+	std::string reservationLine(std::string const& id, Bookable::Reservation const& r) const {
+		std::string info(r.m_info);
+
+		// Keep the record on one line.
+		for(auto &c : info){
+			if((c == '\n') || (c == '\r'))
+				c = ' ';
+		}
+
+		return id + " " + std::to_string(r.m_start) + " " + std::to_string(r.m_end) + " " + std::string(m_sessions.name(r.m_session)) + " " + info;
+	}
+
+	void importReservations(std::string const& path){
+		ofdxImportReservations(path, m_sessions, [this](std::string const& id) -> Bookable::Reservations* {
+			auto const it = m_objects.find(id);
+			return (it == m_objects.end()) ? nullptr : &it->second->m_reservations;
+		});
+	}
+
+	// The records are indexed where they are in m_snapshot, and their
+	// sessions adopted from it, so that nothing is copied or hashed per
+	// record. Only the objects are looked up.
+	void loadSnapshot(){
+		m_snapshotObjects.assign(m_snapshot.objectCount(), nullptr);
+
+		ofdxIndexSnapshot(m_snapshot, m_sessions, [this](size_t const i) -> Bookable::Reservations* {
+			auto const it = m_objects.find(std::string(m_snapshot.objectId(i)));
+
+			// No longer in objects.txt.
+			if(it == m_objects.end())
+				return nullptr;
+
+			m_snapshotObjects[i] = it->second.get();
+			return &it->second->m_reservations;
+		});
+	}
+
+	// Journal format:
+	//  + <snapshot line>   reservation created or changed
+	//  - cluster9 1704479574   reservation removed
+	void replayJournalLine(std::string const& line){
 		std::stringstream ss(line);
-		std::string id;
+		std::string op, id, session;
 		std::shared_ptr<Bookable::Reservation> r = std::make_shared<Bookable::Reservation>();
 
-		//cluster9 1704479574 1704483174 abcd1234b64 mperron
-		if(ss >> id >> r->m_start >> r->m_end >> r->m_sessionId){
-			// Unknown object?
-			if(!m_objects.count(id))
-				return;
+		if(!(ss >> op >> id >> r->m_start) || !m_objects.count(id))
+			return;
+
+		auto const& b = m_objects[id];
 
-			get_the_rest(ss, r->m_info);
+		if(op == "+"){
+			if((ss >> r->m_end >> session) && (r->m_end >= r->m_start)){
+				std::string info;
+				get_the_rest(ss, info);
 
-			// Add reservation to object.
-			{
-				std::shared_ptr<Bookable> b = m_objects[id];
-				b->m_reservations.push_back(r);
+				r->m_info = std::move(info);
+				r->m_session = m_sessions.intern(session);
+
+				if(auto const e = b->m_reservations.find(r->m_start))
+					releaseReservation(*b, *e->m_value);
+
+				b->putReservation(r);
+				holdReservation(*b, *r);
 			}
+		} else if(op == "-"){
+			b->m_reservations.removeIf([&](Bookable::Reservations::Entry const& e){
+				bool const remove = (e.m_when.min() == r->m_start);
+
+				if(remove)
+					releaseReservation(*b, *e.m_value);
+
+				return remove;
+			});
 		}
 	}
 
-public:
-	struct OfdxBaseConfig m_cfg;
+	// Add r, a reservation of b, to the index of its session. Call with the
+	// lock of b held, and again whenever r changes hands.
+	void holdReservation(Bookable &b, Bookable::Reservation const& r){
+		if(r.m_session != OfdxSessionTable::OPEN){
+			std::lock_guard<std::mutex> lock(m_heldMutex);
+			m_held[r.m_session].insert({ r.m_start, &b });
+		}
+	}
+
+	// Drop r from the index of its session. Call with the lock of b held.
+	void releaseReservation(Bookable &b, Bookable::Reservation const& r){
+		std::lock_guard<std::mutex> lock(m_heldMutex);
+		auto const it = m_held.find(r.m_session);
+
+		if(it != m_held.end()){
+			it->second.erase({ r.m_start, &b });
+
+			if(it->second.empty())
+				m_held.erase(it);
+		}
+	}
+
+	// Index everything imported from the text format.
+	void indexHeldReservations(){
+		m_held.clear();
+
+		for(auto const& kv : m_objects){
+			for(auto const& e : kv.second->m_reservations)
+				holdReservation(*kv.second, *e.m_value);
+		}
+	}
+
+	// Have the expiry thread look at b once a reservation ending at end has
+	// run out. Call with the lock of b held.
+	void scheduleExpiry(Bookable &b, time_t const end){
+		std::lock_guard<std::mutex> lock(m_expiryMutex);
+
+		// Due by then already? This also covers max(), for no reservations.
+		if(end >= b.m_expiryDue - 1)
+			return;
+
+		// Reservations are removed once their end is in the past.
+		b.m_expiryDue = end + 1;
+
+		bool const sooner = m_expiries.empty() || (b.m_expiryDue < m_expiries.top().first);
+		m_expiries.push({ b.m_expiryDue, &b });
+
+		if(sooner)
+			m_expiryCv.notify_one();
+	}
+
+	// The expiry thread. Everything that ran out by the same second goes to
+	// the journal as one batch, with a single commit. Compactions are run
+	// here too.
+	void expireReservations(){
+		std::unique_lock<std::mutex> lock(m_expiryMutex);
+		std::vector<Bookable*> due;
+
+		while(!m_expiryStopping){
+			if(m_compactDue){
+				m_compactDue = false;
+
+				// Object locks come before m_expiryMutex.
+				lock.unlock();
+				compactReservations();
+				lock.lock();
+				continue;
+			}
+
+			if(m_expiries.empty()){
+				m_expiryCv.wait(lock);
+				continue;
+			}
+
+			Request batch;
+			time(&batch.m_timenow);
+
+			if(m_expiries.top().first > batch.m_timenow){
+				m_expiryCv.wait_until(lock, std::chrono::system_clock::from_time_t(m_expiries.top().first));
+				continue;
+			}
+
+			due.clear();
+
+			while(!m_expiries.empty() && (m_expiries.top().first <= batch.m_timenow)){
+				Expiry const top = m_expiries.top();
+				m_expiries.pop();
+
+				if(top.first == top.second->m_expiryDue){
+					top.second->m_expiryDue = std::numeric_limits<time_t>::max();
+					due.push_back(top.second);
+				}
+			}
+
+			// Object locks come before m_expiryMutex.
+			lock.unlock();
+
+			for(Bookable *const b : due){
+				std::lock_guard<std::mutex> objectLock(b->m_mutex);
+
+				auto const removed = b->maintainReservations(batch.m_timenow);
+				m_expiredCount += removed.size();
+				journalRemovals(batch, *b, removed);
 
-	std::string m_sessionId;
+				scheduleExpiry(*b, b->earliestEnd());
+			}
+
+			if(batch.m_journalSeq)
+				commitReservations(batch);
+
+			lock.lock();
+		}
+	}
+
+	// Every change to the reservations is journaled, so this is where the
+	// cached pages learn of them. Call with the lock of b held.
+	void journalReservation(Request &ctx, Bookable &b, Bookable::Reservation const& r){
+		ctx.m_journalSeq = m_journal.append("+ " + reservationLine(b.m_id, r));
+		++ m_homeFragments.at(b.m_group).m_generation;
+		++ b.m_generation;
+	}
+
+	// Call with the lock of b held.
+	void journalRemovals(Request &ctx, Bookable &b, std::vector<std::shared_ptr<Bookable::Reservation>> const& removed){
+		for(auto const& r : removed){
+			ctx.m_journalSeq = m_journal.append("- " + b.m_id + " " + std::to_string(r->m_start));
+			releaseReservation(b, *r);
+		}
+
+		if(!removed.empty()){
+			++ m_homeFragments.at(b.m_group).m_generation;
+			++ b.m_generation;
+		}
+	}
+
+	std::string snapshotPath() const {
+		return m_cfg.m_dataPath + "reservations.bin";
+	}
+
+	// Imported when there is no binary snapshot yet, and written on export.
+	std::string textSnapshotPath() const {
+		return m_cfg.m_dataPath + "reservations.txt";
+	}
+
+	std::string journalPath() const {
+		return m_cfg.m_dataPath + "reservations.journal";
+	}
+
+	// Journal records moved aside by a compaction which has not finished.
+	std::string rotatedJournalPath() const {
+		return m_cfg.m_dataPath + "reservations.journal.old";
+	}
+
+	std::string sessionKeyPath() const {
+		return m_cfg.m_dataPath + "session.key";
+	}
+
+	// Used with signedsessions only.
+	OfdxTokenSigner m_tokenSigner;
+
+public:
+	struct OfdxBookItConfig m_cfg;
 
 	OfdxBookIt() :
-		m_cfg(PORT_OFDX_BOOKIT, PATH_OFDX_BOOKIT)
+		m_compactionCount(0),
+		m_expiryStopping(false), m_compactDue(false), m_expiredCount(0),
+		m_homeCacheHits(0), m_homeCacheMisses(0),
+		m_sessions(OPEN_SID)
 	{}
 
+	~OfdxBookIt(){
+		// Workers must not outlive the handler they call.
+		stopWorkers();
+		stopExpiry();
+	}
+
+	// Remove reservations in the background as they run out, starting with
+	// whatever ran out while the service was down.
+	void startExpiry(){
+		for(auto const& kv : m_objects){
+			std::lock_guard<std::mutex> lock(kv.second->m_mutex);
+			scheduleExpiry(*kv.second, kv.second->earliestEnd());
+		}
+
+		m_expiryThread = std::thread([this](){ expireReservations(); });
+	}
+
+	void stopExpiry(){
+		if(!m_expiryThread.joinable())
+			return;
+
+		{
+			std::lock_guard<std::mutex> lock(m_expiryMutex);
+			m_expiryStopping = true;
+		}
+
+		m_expiryCv.notify_one();
+		m_expiryThread.join();
+	}
+
 	bool processCliArguments(int argc, char **argv){
 		if(m_cfg.processCliArguments(argc, argv)){
 			// Database path must be set...
@@ -204,6 +653,67 @@ public:
 		return true;
 	}
 
+	// Load or create the key for signed session IDs, if they are enabled.
+	bool loadSessionKey(){
+		if(m_cfg.m_signedSessions && !m_tokenSigner.open(sessionKeyPath())){
+			std::cerr << "Error: cannot read or create " << sessionKeyPath() << std::endl;
+			return false;
+		}
+
+		return true;
+	}
+
+	// Frame the responses for every resource file, once.
+	static FramedResource::Variant frameResource(Resource const& rsc, std::string_view const data, std::string const& etag, std::string const& encodingHeaders){
+		std::string const cacheControl("max-age=" + std::to_string(7 * 24 * 60 * 60) /* 1 week */);
+		FramedResource::Variant v;
+		std::stringstream ss;
+
+		ss
+			<< "Status: 200 OK\r\n"
+			<< "Content-Type: " << rsc.mime << "\r\n"
+			<< "Content-Length: " << data.size() << "\r\n"
+			<< encodingHeaders
+			<< "ETag: " << etag << "\r\n"
+			<< "Cache-Control: " << cacheControl << "\r\n"
+			<< "\r\n";
+
+		v.m_etag = etag;
+		v.m_head = std::make_shared<dmitigr::fcgi::Framed_output const>(ss.str());
+
+		ss << data;
+		v.m_get = std::make_shared<dmitigr::fcgi::Framed_output const>(ss.str());
+
+		v.m_notModified = std::make_shared<dmitigr::fcgi::Framed_output const>(
+			"Status: 304 Not Modified\r\n"
+			+ encodingHeaders +
+			"ETag: " + etag + "\r\n"
+			"Cache-Control: " + cacheControl + "\r\n"
+			"\r\n");
+
+		return v;
+	}
+
+	void frameResources(){
+		for(size_t i = 0; i < RESOURCE_COUNT; ++ i){
+			Resource const& rsc = resourceTable[i];
+			FramedResource &f = m_framedResources[i];
+			std::string const etag(rsc.etag);
+
+			if(rsc.gzip.empty()){
+				f.m_identity = frameResource(rsc, rsc.data, etag, "");
+			} else {
+				// Each encoding is a representation of its own, with an ETag
+				// of its own.
+				std::string gzipEtag(etag);
+				gzipEtag.insert(gzipEtag.size() - 1, "-gz");
+
+				f.m_identity = frameResource(rsc, rsc.data, etag, "Vary: Accept-Encoding\r\n");
+				f.m_gzip = frameResource(rsc, rsc.gzip, gzipEtag, "Content-Encoding: gzip\r\nVary: Accept-Encoding\r\n");
+			}
+		}
+	}
+
 	void loadObjects(){
 		std::ifstream infile(m_cfg.m_dataPath + "objects.txt");
 
@@ -211,36 +721,149 @@ public:
 			parseObject(infile);
 	}
 
-	void loadReservations(){
-		std::ifstream infile(m_cfg.m_dataPath + "reservations.txt");
-		std::string line;
+	// Index the snapshot and replay the journal over it. The journal is left
+	// for the expiry thread to compact, so that startup does not wait for
+	// the snapshot to be rewritten; only the first snapshot, taken over from
+	// the text format, is written here.
+	bool loadReservations(){
+		bool imported = false;
+
+		if(m_snapshot.open(snapshotPath())){
+			loadSnapshot();
+		} else if(access(snapshotPath().c_str(), F_OK) == 0){
+			// Better to stop than to start over from an older state.
+			std::cerr << "Error: cannot load " << snapshotPath() << ": " << m_snapshot.error() << std::endl;
+			return false;
+		} else {
+			importReservations(textSnapshotPath());
+			indexHeldReservations();
+			imported = true;
+		}
 
-		while(getline(infile, line)){
-			if(!line.empty())
-				parseReservation(line);
+		size_t replayed = 0;
+		auto const replay = [&](std::string const& line){
+			replayJournalLine(line);
+			++ replayed;
+		};
+
+		ofdxReadLines(rotatedJournalPath(), replay);
+		ofdxReadLines(journalPath(), replay);
+
+		if(!m_journal.open(journalPath()))
+			return false;
+
+		if(imported)
+			return compactReservations();
+
+		if(replayed || (access(rotatedJournalPath().c_str(), F_OK) == 0)){
+			std::lock_guard<std::mutex> lock(m_expiryMutex);
+			m_compactDue = true;
+		}
+
+		return true;
+	}
+
+	// Rewrite the snapshot with the current reservations, and drop the
+	// journal records it covers. Does nothing if a compaction is already
+	// running, unless wait is set: then it waits for that one to finish and
+	// starts another, whose snapshot is sure to include every change made so
+	// far.
+	bool compactReservations(bool const wait = false){
+		std::unique_lock<std::mutex> compacting(m_compactMutex, std::defer_lock);
+
+		if(wait)
+			compacting.lock();
+		else if(!compacting.try_lock())
+			return true;
+
+		OfdxSnapshotWriter writer;
+
+		if(!m_journal.rotate(rotatedJournalPath()))
+			return false;
+
+		// Each object is copied as it is now. Whatever changes it after the
+		// rotation is in the new journal too, and replayed over the snapshot.
+		for(auto const& kv : m_objects){
+			std::lock_guard<std::mutex> lock(kv.second->m_mutex);
+
+			writer.addObject(kv.first);
+
+			// Write each reservation to the snapshot.
+			for(auto const& e : kv.second->m_reservations)
+				writer.addRecord(e.m_value->m_start, e.m_value->m_end, m_sessions.name(e.m_value->m_session), e.m_value->m_info);
 		}
+
+		// Until the snapshot is in place, the rotated journal is still needed.
+		if(!ofdxWriteFileAtomically(snapshotPath(), writer.finish())){
+			std::cerr << "Error: cannot write " << snapshotPath() << std::endl;
+			return false;
+		}
+
+		// A stale rotated journal must not reappear after a crash.
+		unlink(rotatedJournalPath().c_str());
+		ofdxSyncParentDir(rotatedJournalPath());
+
+		++ m_compactionCount;
+		return true;
 	}
 
-	void saveReservations(){
-		std::ofstream outfile(m_cfg.m_dataPath + "reservations.txt");
+	// Write the reservations to reservations.txt.
+	bool exportReservations(){
+		std::string text;
 
-		// For each object
 		for(auto const& kv : m_objects){
+			std::lock_guard<std::mutex> lock(kv.second->m_mutex);
+
+			for(auto const& e : kv.second->m_reservations)
+				text += reservationLine(kv.first, *e.m_value) + "\n";
+		}
 
-			// Write each reservation to the file.
-			for(auto const& el : kv.second->m_reservations){
-				// Format:
-				//  cluster9 1704479574 1704483174 abcd1234b64 mperron
-				outfile
-					<< kv.first << " "
-					<< el->m_start << " "
-					<< el->m_end << " "
-					<< el->m_sessionId << " "
-					<< el->m_info << "\n";
+		if(!ofdxWriteFileAtomically(textSnapshotPath(), text)){
+			std::cerr << "Error: cannot write " << textSnapshotPath() << std::endl;
+			return false;
+		}
+
+		return true;
+	}
+
+	// Wait for the changes made by the request to be on disk, and have the
+	// journal compacted from time to time. Returns false if they could not
+	// be saved. Call without any object lock held, before the response is
+	// written.
+	bool commitReservations(Request const& ctx){
+		if(!ctx.m_journalSeq)
+			return true;
+
+		// If the journal lost the changes, a new snapshot can still save them.
+		if(!m_journal.commit(ctx.m_journalSeq))
+			return compactReservations(true);
+
+		if(m_journal.recordCount() >= JOURNAL_COMPACT_RECORDS){
+			std::lock_guard<std::mutex> lock(m_expiryMutex);
+
+			if(!m_compactDue){
+				m_compactDue = true;
+				m_expiryCv.notify_one();
 			}
 		}
 
-		outfile << std::endl;
+		return true;
+	}
+
+	void writeStatus(std::ostream &os) override {
+		OfdxFcgiService::writeStatus(os);
+
+		auto const journal = m_journal.stats();
+
+		os
+			<< "journal_appends_total " << journal.m_appends << "\n"
+			<< "journal_syncs_total " << journal.m_syncs << "\n"
+			<< "journal_errors_total " << journal.m_errors << "\n"
+			<< "journal_compactions_total " << m_compactionCount << "\n"
+			<< "home_cache_hits_total " << m_homeCacheHits << "\n"
+			<< "home_cache_misses_total " << m_homeCacheMisses << "\n"
+			<< "reservations_expired_total " << m_expiredCount << "\n"
+			<< "sessions " << m_sessions.size() << "\n";
 	}
 
 	void sendBadRequest(std::unique_ptr<dmitigr::fcgi::Server_connection> const& conn) const {
@@ -251,11 +874,22 @@ public:
 			<< "Bad request. You goofed!" << std::endl;
 	}
 
-	void manageSessionId(std::unique_ptr<dmitigr::fcgi::Server_connection> const& conn){
-		m_sessionId = m_cookies[BOOKIT_SID];
+	// A change was made but could not be saved, so it may be gone after a
+	// restart. It is not confirmed to the client.
+	void sendNotSaved(std::unique_ptr<dmitigr::fcgi::Server_connection> const& conn) const {
+		conn->out()
+			<< "Status: 503 Service Unavailable\r\n"
+			<< "Content-Type: text/plain; charset=utf-8\r\n"
+			<< "Cache-Control: no-store\r\n"
+			<< "\r\n"
+			<< "Your change could not be saved. Please check your reservations, and try again later." << std::endl;
+	}
+
+	void manageSessionId(std::unique_ptr<dmitigr::fcgi::Server_connection> const& conn, Request &ctx){
+		ctx.m_sessionId = ctx.cookie(BOOKIT_SID);
 
 		// Validate session ID string.
-		for(char const& c : m_sessionId){
+		for(char const& c : ctx.m_sessionId){
 			if(!(
 				((c >= 'a') && (c <= 'z')) ||
 				((c >= 'A') && (c <= 'Z')) ||
@@ -264,202 +898,635 @@ public:
 				(c == '_') ||
 				(c == '.')
 			)){
-				m_sessionId = "";
+				ctx.m_sessionId = "";
 				break;
 			}
 		}
 
-		// If the user does not have a session ID, assign one at random.
-		if(m_sessionId.empty()){
-			std::ifstream infile("/dev/urandom");
-
-			if(infile){
-				size_t len = 64;
-				char *dbuf = (char*) calloc(len, sizeof(char*));
+		if(m_cfg.m_signedSessions && !m_tokenSigner.verify(ctx.m_sessionId))
+			ctx.m_sessionId = "";
 
-				// Read some random data.
-				infile.read(dbuf, len);
+		// That one stands for unclaimed time, and belongs to nobody.
+		if(ctx.m_sessionId == OPEN_SID)
+			ctx.m_sessionId = "";
 
-				// Store as base64.
-				m_sessionId = base64_encode(std::string(dbuf), len);
-			}
+		// If the user does not have a session ID, assign one at random.
+		if(ctx.m_sessionId.empty()){
+			if(m_cfg.m_signedSessions)
+				ctx.m_sessionId = m_tokenSigner.issue().view();
+			else
+				ctx.m_sessionId = OfdxToken<32>::random().view();
+		} else {
+			ctx.m_session = m_sessions.find(ctx.m_sessionId);
 		}
 
 		// Set or refresh the user's cookie.
 		conn->out()
-			<< "Set-Cookie: " BOOKIT_SID "=" << m_sessionId
+			<< "Set-Cookie: " BOOKIT_SID "=" << ctx.m_sessionId
 			<< "; SameSite=Strict; Path=/; Max-Age=" << (6 * 7 * 24 * 60 * 60) << "\r\n";
 	}
 
-	void sendHomePage(std::unique_ptr<dmitigr::fcgi::Server_connection> const& conn){
-		conn->out()
-			<< "Content-Type: text/html; charset=utf-8\r\n"
-			<< "\r\n"
-			<< resources["header.html"]
-			<< "<p>Select a cluster from the list below to reserve it.</p>\n"
-			<< "<div id=clusters>\n";
+	static void renderHomeItem(std::string &out, Bookable const& el, bool const reservedbyyou, time_t const reserveduntil){
+		out += " <li><a ";
+
+		if(reservedbyyou){
+			out += "class=confirmed ";
+		} else if(reserveduntil){
+			out += "class=reserved ";
+		}
+
+		out += "href=\"" + PATH_OFDX_BOOKIT + el.m_id + "\">";
+
+		if(reservedbyyou)
+			out += "*";
+
+		out += el.m_name + "</a>";
+
+		if(reserveduntil)
+			out += " &mdash; <span class=\"utctime\">" + std::to_string(reserveduntil) + "</span>";
+
+		out += "</li>\n";
+	}
+
+	// Call with the lock of the fragment held. Each object is locked while it
+	// is looked at.
+	std::shared_ptr<HomeFragment::Rendered const> renderHomeFragment(HomeFragment const& hf, std::string const& group, std::list<std::shared_ptr<Bookable>> const& objects, time_t const timenow){
+		auto const rendered = std::make_shared<HomeFragment::Rendered>();
+		HomeFragment::Rendered &f = *rendered;
+
+		// Read first, so a change made while rendering shows as a newer
+		// generation and is rendered next time.
+		f.m_generation = hf.m_generation;
+
+		f.m_html = "<div class=clustergroup><h3>" + group + "</h3>\n<ul>\n";
+		f.m_renderedAt = timenow;
+		f.m_validUntil = std::numeric_limits<time_t>::max();
+		f.m_version = hf.m_rendered ? (hf.m_rendered->m_version + 1) : 1;
+
+		for(auto const& el : objects){
+			std::lock_guard<std::mutex> lock(el->m_mutex);
+
+			HomeFragment::Item item;
+			item.m_object = el.get();
+
+			// The page changes when whoever holds it runs out, or the next
+			// reservation starts.
+			el->m_reservations.forEachAt(timenow, [&](Bookable::Reservations::Entry const& e){
+				if(e.m_value->m_end > timenow)
+					f.m_validUntil = std::min(f.m_validUntil, e.m_value->m_end);
+
+				return true;
+			});
+
+			if(auto const next = el->m_reservations.firstAfter(timenow))
+				f.m_validUntil = std::min(f.m_validUntil, next->m_when.min());
+
+			// Until when is it booked? Unclaimed space at the end is dropped
+			// whenever reservations change.
+			time_t reserveduntil = 0;
+			auto const latest = el->m_reservations.latest();
+
+			if(latest && (latest->m_value->m_end > timenow) && (latest->m_value->m_session != OfdxSessionTable::OPEN)){
+				reserveduntil = latest->m_value->m_end;
+				f.m_validUntil = std::min(f.m_validUntil, reserveduntil);
+			}
+
+			item.m_begin = f.m_html.size();
+			renderHomeItem(f.m_html, *el, false, reserveduntil);
+			item.m_end = f.m_html.size();
+
+			f.m_items.push_back(std::move(item));
+		}
+
+		f.m_html += "</ul>\n</div>\n";
+		return rendered;
+	}
+
+	// Bring the fragment of every group up to date, in the order of
+	// m_objectsByGroup, and return the state of the home page, for its ETag.
+	std::string refreshHomeFragments(Request const& ctx, std::vector<std::shared_ptr<HomeFragment::Rendered const>> &fragments){
+		// The clock on the page shows minutes.
+		std::string state("home " + ctx.m_sessionId + " " + std::to_string(ctx.m_timenow / 60));
 
 		for(auto const& kv : m_objectsByGroup){
-			conn->out() << "<div class=clustergroup><h3>" << kv.first << "</h3>\n<ul>\n";
-
-			for(auto const& el : *kv.second){
-				time_t reserveduntil = 0;
-				bool reservedbyyou = false;
-
-				if(el->m_reservations.size()){
-					for(auto const& r : el->m_reservations){
-						if(r->m_end > m_timenow){
-							if((r->m_start <= m_timenow) && (r->m_sessionId == m_sessionId)){
-								reserveduntil = r->m_end;
-								reservedbyyou = true;
-								break;
-							} else if((r->m_end > reserveduntil) && (r->m_sessionId != OPEN_SID)){
-								reserveduntil = r->m_end;
-							}
-						}
-					}
-				}
+			HomeFragment &hf = m_homeFragments.at(kv.first);
+			std::lock_guard<std::mutex> lock(hf.m_mutex);
+			auto const& f = hf.m_rendered;
 
-				conn->out() << " <li><a ";
+			if(f && (f->m_generation == hf.m_generation) && (ctx.m_timenow >= f->m_renderedAt) && (ctx.m_timenow < f->m_validUntil)){
+				++ m_homeCacheHits;
+			} else {
+				++ m_homeCacheMisses;
+				hf.m_rendered = renderHomeFragment(hf, kv.first, *kv.second, ctx.m_timenow);
+			}
 
-				if(reservedbyyou){
-					conn->out() << "class=confirmed ";
-				} else if(reserveduntil){
-					conn->out() << "class=reserved ";
-				}
+			fragments.push_back(hf.m_rendered);
+			state += " " + std::to_string(hf.m_rendered->m_version);
+		}
 
-				conn->out()
-					<< "href=\"" << PATH_OFDX_BOOKIT << el->m_id << "\">"
-					<< (reservedbyyou ? "*" : "") << el->m_name << "</a>";
+		return state;
+	}
+
+	// A reservation of the visitor's, copied out from under the lock of its
+	// object.
+	struct HeldRow {
+		Bookable *m_object;
+		uint64_t m_generation;
+		Bookable::Reservation m_reservation;
+	};
+
+	// Where the reservations of session starting by startBy may be, in order
+	// of start: those in m_held, and those it held in m_snapshot, which are
+	// not copied into m_held. Either may be out of date, so each must be
+	// checked under the lock of its object.
+	std::vector<std::pair<time_t, Bookable*>> heldCandidates(OfdxSessionTable::Handle const session, time_t const startBy){
+		std::vector<std::pair<time_t, Bookable*>> candidates;
+		{
+			std::lock_guard<std::mutex> lock(m_heldMutex);
 
-				if(reserveduntil){
-					conn->out() << " &mdash; <span class=\"utctime\">" << reserveduntil << "</span>";
+			if(auto const it = m_held.find(session); it != m_held.end()){
+				for(auto const& kv : it->second){
+					if(kv.first > startBy)
+						break;
+
+					candidates.push_back(kv);
 				}
+			}
+		}
+
+		// The snapshot is not changed once loaded, so it is read unlocked.
+		if(size_t const k = m_sessions.attachedIndex(session); k < m_sessions.attachedCount()){
+			size_t const first = candidates.size();
+
+			for(size_t i = 0; i < m_snapshot.heldCount(k); ++ i){
+				auto const h = m_snapshot.held(k, i);
+
+				if(h.m_start > startBy)
+					break;
 
-				conn->out() << "</li>\n";
+				if(Bookable *const b = m_snapshotObjects[h.m_object])
+					candidates.push_back({ h.m_start, b });
 			}
 
-			conn->out() << "</ul>\n</div>\n";
+			// Ties are in order of object index there, not of address.
+			if(candidates.size() > first){
+				std::sort(candidates.begin(), candidates.end());
+				candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+			}
+		}
+
+		return candidates;
+	}
+
+	// The reservations of the visitor's which start by startBy and end
+	// after endAfter, in order of start.
+	std::vector<HeldRow> heldReservations(Request const& ctx, time_t const startBy, time_t const endAfter){
+		std::vector<std::pair<time_t, Bookable*>> const candidates(heldCandidates(ctx.m_session, startBy));
+		std::vector<HeldRow> rows;
+
+		// The index may have changed since, so each one is checked again.
+		for(auto const& c : candidates){
+			std::lock_guard<std::mutex> lock(c.second->m_mutex);
+			auto const e = c.second->m_reservations.find(c.first);
+
+			if(e && (e->m_value->m_session == ctx.m_session) && (e->m_value->m_end > endAfter))
+				rows.push_back({ c.second, c.second->m_generation, *e->m_value });
+		}
+
+		return rows;
+	}
+
+	// How a page is encoded, settled before its headers.
+	struct PageEncoding {
+		// Whether the page is large enough to be compressed for some clients,
+		// so that the response varies with Accept-Encoding.
+		bool m_varies;
+
+		// Whether to gzip it as it is written.
+		bool m_gzip;
+	};
+
+	// Encoding of a page of about size bytes. The gzip stream is checked
+	// too, since the headers must not promise what it cannot do.
+	static PageEncoding pageEncoding(std::unique_ptr<dmitigr::fcgi::Server_connection> const& conn, size_t const size){
+		bool const varies = (size >= GZIP_MIN_PAGE_BYTES) && OfdxGzipStreambuf::available();
+		return { varies, varies && acceptsGzip(conn) };
+	}
+
+	// Headers of a page which depends on the session, and is revalidated on
+	// every visit. Returns false if the body should not be sent: the client
+	// has the page already (so it gets a 304), or only asked for the headers.
+	bool sendPageHeaders(std::unique_ptr<dmitigr::fcgi::Server_connection> const& conn, std::string const& etag, PageEncoding const& encoding, char const *contentType = "text/html; charset=utf-8"){
+		if(ifNoneMatch(conn, etag)){
+			sendNotModified(conn, etag, "private, no-cache", encoding.m_varies ? "Accept-Encoding" : "");
+			return false;
 		}
 
+		conn->out() << "Content-Type: " << contentType << "\r\n";
+
+		if(encoding.m_gzip)
+			conn->out() << "Content-Encoding: gzip\r\n";
+
+		if(encoding.m_varies)
+			conn->out() << "Vary: Accept-Encoding\r\n";
+
 		conn->out()
+			<< "ETag: " << etag << "\r\n"
+			<< "Cache-Control: private, no-cache\r\n"
+			<< "\r\n";
+
+		return !isHeadRequest(conn);
+	}
+
+	void sendHomePage(std::unique_ptr<dmitigr::fcgi::Server_connection> const& conn, Request const& ctx){
+		std::vector<std::shared_ptr<HomeFragment::Rendered const>> fragments;
+		std::string const state(refreshHomeFragments(ctx, fragments));
+
+		size_t size = RESOURCE_HEADER_HTML.data.size() + RESOURCE_FOOTER_HTML.data.size();
+
+		for(auto const& fragment : fragments)
+			size += fragment->m_html.size();
+
+		PageEncoding const encoding(pageEncoding(conn, size));
+		std::string const etag(weakEtag(state + (encoding.m_gzip ? " gzip" : "")));
+
+		if(!sendPageHeaders(conn, etag, encoding))
+			return;
+
+		OfdxGzipStream out(conn->out(), encoding.m_gzip);
+
+		out
+			<< RESOURCE_HEADER_HTML
+			<< "<p>Select a cluster from the list below to reserve it.</p>\n"
+			<< "<div id=clusters>\n";
+
+		// What you hold right now, and until when.
+		std::vector<HeldRow> const yours(heldReservations(ctx, ctx.m_timenow, ctx.m_timenow));
+
+		std::string overlay;
+
+		for(auto const& fragment : fragments){
+			HomeFragment::Rendered const& f = *fragment;
+
+			// Copy the fragment, swapping in the items you hold.
+			size_t copied = 0;
+
+			for(auto const& item : f.m_items){
+				if(yours.empty())
+					break;
+
+				for(auto const& held : yours){
+					if(held.m_object == item.m_object){
+						overlay.clear();
+						renderHomeItem(overlay, *item.m_object, true, held.m_reservation.m_end);
+
+						out.write(f.m_html.data() + copied, item.m_begin - copied);
+						out.write(overlay.data(), overlay.size());
+						copied = item.m_end;
+						break;
+					}
+				}
+			}
+
+			out.write(f.m_html.data() + copied, f.m_html.size() - copied);
+		}
+
+		out
 			<< "</div>\n"
 			<< "<p>Clusters shown in <span class=reserved>red</span> are reserved until the time shown. "
 			<< "Click on them for more details and to reserve at a future time.</p>"
 			<< "<p>Clusters shown in <span class=confirmed>*green</span> are reserved by you until the time shown.</p>"
-			<< "<span id=clock class=utctime>" << m_timenow << "</span>";
+			<< "<p>See <a href=\"" << PATH_OFDX_BOOKIT_MINE << "\">all of your reservations</a>.</p>"
+			<< "<span id=clock class=utctime>" << ctx.m_timenow << "</span>";
 
-		conn->out() << resources["footer.html"] << std::endl;
+		out << RESOURCE_FOOTER_HTML << std::endl;
 	}
 
-	void sendCreatePage(std::unique_ptr<dmitigr::fcgi::Server_connection> const& conn, std::shared_ptr<Bookable> const& b){
-		conn->out()
-			<< "Content-Type: text/html; charset=utf-8\r\n"
-			<< "\r\n"
-			<< resources["header.html"];
+	static void writeHtmlEscaped(std::ostream &os, std::string_view const s){
+		for(char const c : s){
+			switch(c){
+				case '<': os << "&lt;"; break;
+				case '>': os << "&gt;"; break;
+				case '&': os << "&amp;"; break;
+				case '"': os << "&quot;"; break;
+				default: os << c;
+			}
+		}
+	}
 
-		conn->out() << "<h3>" << b->m_name << " (" << b->m_group << ")</h3>\n";
-		if(!b->m_desc.empty()){
-			conn->out() << "<pre>" << b->m_desc << "</pre>\n";
+	static void writeJsonString(std::ostream &os, std::string_view const s){
+		os << '"';
+
+		for(char const c : s){
+			if((c == '"') || (c == '\\')){
+				os << '\\' << c;
+			} else if((unsigned char) c < 0x20){
+				char buf[8];
+				snprintf(buf, sizeof(buf), "\\u%04x", c);
+				os << buf;
+			} else {
+				os << c;
+			}
 		}
 
-		// Check for a claim or cancelation in the query string.
-		time_t tocancel = 0, toclaim = 0;
-		{
-			// FIXME - there is a bug somewhere near here related to string handling.
-			std::string const f_cancel("cancel=");
-			std::string const f_claim("claim=");
-			std::string q(conn->parameter("QUERY_STRING"));
+		os << '"';
+	}
+
+	// Cancel what the POST body asks for. Returns how many were canceled.
+	size_t cancelMine(std::unique_ptr<dmitigr::fcgi::Server_connection> const& conn, Request &ctx){
+		std::string line;
+		size_t canceled = 0;
+
+		if(!getline(conn->in(), line))
+			return 0;
+
+		// Starts of the reservations to cancel, by object, so that each object
+		// is locked once.
+		std::map<Bookable*, std::vector<time_t>> targets;
 
-			for(auto &c : q){
-				if(c == '&')
-					c = ' ';
+		for(auto const& f : ofdxUrlEncoded(line)){
+			if(f.m_name != "cancel")
+				continue;
+
+			if(f.m_value == "all"){
+				for(auto const& kv : heldCandidates(ctx.m_session, std::numeric_limits<time_t>::max()))
+					targets[kv.second].push_back(kv.first);
+			} else {
+				// <id>:<start>
+				size_t const colon = f.m_value.rfind(':');
+				auto const obj = (colon != std::string_view::npos) ? m_objects.find(std::string(f.m_value.substr(0, colon))) : m_objects.end();
+
+				if(obj != m_objects.end())
+					targets[obj->second.get()].push_back(ofdxToNumber<time_t>(f.m_value.substr(colon + 1)));
 			}
+		}
 
-			std::stringstream qss(q);
-			std::string kv;
+		for(auto const& kv : targets){
+			Bookable &b = *kv.first;
+			std::lock_guard<std::mutex> lock(b.m_mutex);
+			bool changed = false;
 
-			while(qss >> kv){
-				if(kv.find(f_cancel) == 0){
-					tocancel = atoi(kv.substr(f_cancel.size()).c_str());
-				} else if(kv.find(f_claim) == 0){
-					toclaim = atoi(kv.substr(f_claim.size()).c_str());
+			for(time_t const start : kv.second){
+				if(auto const e = b.m_reservations.find(start); e && cancelReservation(ctx, b, *e->m_value)){
+					changed = true;
+					++ canceled;
 				}
 			}
+
+			if(changed)
+				journalRemovals(ctx, b, b.maintainReservations(ctx.m_timenow));
 		}
 
-		bool needPersist = false;
-		bool willExtend = false;
-		for(auto const& el : b->m_reservations){
+		return canceled;
+	}
 
-			// Is this reservation historical?
-			if(el->m_end < m_timenow){
-				needPersist = true;
-				continue;
+	// Your reservations which have not ended, from the index of your session.
+	void sendMinePage(std::unique_ptr<dmitigr::fcgi::Server_connection> const& conn, Request &ctx){
+		bool json = false;
+
+		if(auto const i = conn->parameter_index("QUERY_STRING"))
+			json = (ofdxUrlEncoded(conn->parameter(*i)).last("format") == "json");
+
+		bool const post = (conn->parameter("REQUEST_METHOD") == "POST");
+		size_t const canceled = post ? cancelMine(conn, ctx) : 0;
+
+		if(!commitReservations(ctx)){
+			sendNotSaved(conn);
+			return;
+		}
+
+		std::vector<HeldRow> const rows(heldReservations(ctx, std::numeric_limits<time_t>::max(), ctx.m_timenow - 1));
+
+		PageEncoding const encoding(pageEncoding(conn, RESOURCE_HEADER_HTML.data.size() + RESOURCE_FOOTER_HTML.data.size() + rows.size() * PAGE_ROW_BYTES));
+		char const* const contentType = json ? "application/json" : "text/html; charset=utf-8";
+
+		if(post){
+			// The result of a change, which is not to be cached.
+			conn->out() << "Content-Type: " << contentType << "\r\n";
+
+			if(encoding.m_gzip)
+				conn->out() << "Content-Encoding: gzip\r\n";
+
+			if(encoding.m_varies)
+				conn->out() << "Vary: Accept-Encoding\r\n";
+
+			conn->out()
+				<< "Cache-Control: no-store\r\n"
+				<< "\r\n";
+		} else {
+			std::string state("mine " + ctx.m_sessionId + " " + std::to_string(ctx.m_timenow / 60));
+
+			for(auto const& row : rows)
+				state += " " + row.m_object->m_id + " " + std::to_string(row.m_generation);
+
+			if(!sendPageHeaders(conn, weakEtag(state + (json ? " json" : "") + (encoding.m_gzip ? " gzip" : "")), encoding, contentType))
+				return;
+		}
+
+		OfdxGzipStream out(conn->out(), encoding.m_gzip);
+
+		if(json){
+			out << "{\"now\":" << ctx.m_timenow << ",\"canceled\":" << canceled << ",\"reservations\":[";
+
+			for(size_t i = 0; i < rows.size(); ++ i){
+				auto const& b = *rows[i].m_object;
+				auto const& r = rows[i].m_reservation;
+
+				out << (i ? "," : "") << "{\"id\":";
+				writeJsonString(out, b.m_id);
+				out << ",\"name\":";
+				writeJsonString(out, b.m_name);
+				out << ",\"start\":" << r.m_start << ",\"end\":" << r.m_end << ",\"info\":";
+				writeJsonString(out, r.m_info);
+				out << "}";
 			}
 
+			out << "]}" << std::endl;
+			return;
+		}
+
+		out
+			<< RESOURCE_HEADER_HTML
+			<< "<h3>Your reservations</h3>\n";
+
+		if(canceled)
+			out << "<p>Canceled " << canceled << ((canceled == 1) ? " reservation" : " reservations") << ".</p>\n";
+
+		if(rows.empty())
+			out << "<p>You have no reservations.</p>\n";
+
+		for(auto const& row : rows){
+			auto const& b = *row.m_object;
+			auto const& r = row.m_reservation;
+
+			out << "<p><a href=\"" << PATH_OFDX_BOOKIT << b.m_id << "\">" << b.m_name << "</a> ";
+
+			if(r.m_start > ctx.m_timenow)
+				out << "from <span class=utctime>" << r.m_start << "</span> ";
+
+			out << "until <span class=utctime>" << r.m_end << "</span>";
+
+			if(!r.m_info.empty()){
+				out << " &mdash; ";
+				writeHtmlEscaped(out, r.m_info);
+			}
+
+			out << " <a class=cancelres href=\"" << PATH_OFDX_BOOKIT << b.m_id << "?cancel=" << r.m_start << "\">Cancel</a></p>\n";
+		}
+
+		if(rows.size() > 1){
+			out << "<form method=POST>"
+				<< "<input type=hidden name=cancel value=all>"
+				<< "<input type=submit value=\"Cancel all\">"
+				<< "</form>\n";
+		}
+
+		out
+			<< "<p>&nbsp;</p><p><a href=\"" << PATH_OFDX_BOOKIT << "\">Return</a> to main page.</p>"
+			<< "<span id=clock class=utctime>" << ctx.m_timenow << "</span>"
+			<< RESOURCE_FOOTER_HTML << std::endl;
+	}
+
+	// Give up a reservation of the visitor's which has not ended, leaving
+	// its time unclaimed. Returns false if there is no such reservation.
+	// Call with the lock of b held.
+	bool cancelReservation(Request &ctx, Bookable &b, Bookable::Reservation &r){
+		if((r.m_end < ctx.m_timenow) || (r.m_session != ctx.m_session))
+			return false;
+
+		releaseReservation(b, r);
+
+		// Clear session and info to indicate that nobody owns this time.
+		r.m_session = OfdxSessionTable::OPEN;
+		r.m_info = "";
+
+		journalReservation(ctx, b, r);
+		return true;
+	}
+
+	void sendCreatePage(std::unique_ptr<dmitigr::fcgi::Server_connection> const& conn, Request &ctx, std::shared_ptr<Bookable> const& b){
+		// Check for a claim or cancelation in the query string.
+		time_t tocancel = 0, toclaim = 0;
+
+		if(auto const i = conn->parameter_index("QUERY_STRING")){
+			for(auto const& f : ofdxUrlEncoded(conn->parameter(*i))){
+				if(f.m_name == "cancel")
+					tocancel = ofdxToNumber<time_t>(f.m_value);
+				else if(f.m_name == "claim")
+					toclaim = ofdxToNumber<time_t>(f.m_value);
+			}
+		}
+
+		// What the page shows, copied so that it is written after the lock of
+		// b is released. A slow client would hold up everybody else otherwise.
+		std::vector<Bookable::Reservation> rows;
+		std::optional<Bookable::Reservation> latest;
+		std::string state;
+		{
+			std::lock_guard<std::mutex> lock(b->m_mutex);
+
+			// Unclaimed time left at the end by a change is dropped along with
+			// it. Reservations which run out are left to the expiry thread.
+			bool needPersist = false;
+
 			// Cancel a reservation
-			if((el->m_start == tocancel) && (el->m_sessionId == m_sessionId)){
-				// Clear sessionid and info to indicate that nobody owns this time.
-				el->m_sessionId = OPEN_SID;
-				el->m_info = "";
-				needPersist = true;
+			if(auto const e = tocancel ? b->m_reservations.find(tocancel) : nullptr){
+				if(cancelReservation(ctx, *b, *e->m_value))
+					needPersist = true;
 			}
 
 			// Claim this session for us.
-			if((el->m_start == toclaim) && (el->m_sessionId == OPEN_SID)){
-				el->m_sessionId = m_sessionId;
-				el->m_info = CLAIMED;
-				needPersist = true;
+			if(auto const e = toclaim ? b->m_reservations.find(toclaim) : nullptr){
+				auto const& el = e->m_value;
+
+				if((el->m_end >= ctx.m_timenow) && (el->m_session == OfdxSessionTable::OPEN)){
+					el->m_session = ctx.m_session = m_sessions.intern(ctx.m_sessionId);
+					el->m_info = CLAIMED;
+					needPersist = true;
+
+					holdReservation(*b, *el);
+
+					journalReservation(ctx, *b, *el);
+				}
 			}
 
+			if(needPersist)
+				journalRemovals(ctx, *b, b->maintainReservations(ctx.m_timenow));
+
+			for(auto const& e : b->m_reservations)
+				rows.push_back(*e.m_value);
+
+			if(auto const e = b->m_reservations.latest())
+				latest = *e->m_value;
+
+			// Besides the reservations, the page shows which of them have
+			// started, the minutes left on the latest one, and the clock.
+			auto const next = b->m_reservations.firstAfter(ctx.m_timenow);
+
+			state = "object " + b->m_id + " " + ctx.m_sessionId + " " + std::to_string(b->m_generation) + " "
+				+ std::to_string(ctx.m_timenow / 60) + " "
+				+ (next ? std::to_string(next->m_when.min()) : "-") + " "
+				+ (latest ? std::to_string((latest->m_end - ctx.m_timenow) / 60) : "-");
+		}
+
+		if(!commitReservations(ctx)){
+			sendNotSaved(conn);
+			return;
 		}
 
-		if(needPersist)
-			b->maintainReservations(m_timenow);
+		PageEncoding const encoding(pageEncoding(conn, RESOURCE_HEADER_HTML.data.size() + RESOURCE_FOOTER_HTML.data.size() + b->m_desc.size() + rows.size() * PAGE_ROW_BYTES));
+
+		if(!sendPageHeaders(conn, weakEtag(state + (encoding.m_gzip ? " gzip" : "")), encoding))
+			return;
 
-		std::shared_ptr<Bookable::Reservation> latest = nullptr;
-		for(auto const& el : b->m_reservations){
-			bool isOpen = (el->m_sessionId == OPEN_SID);
-			bool isYours = (el->m_sessionId == m_sessionId);
+		OfdxGzipStream out(conn->out(), encoding.m_gzip);
 
-			conn->out() << "<p><span class=";
+		out << RESOURCE_HEADER_HTML;
+
+		out << "<h3>" << b->m_name << " (" << b->m_group << ")</h3>\n";
+		if(!b->m_desc.empty()){
+			out << "<pre>" << b->m_desc << "</pre>\n";
+		}
+
+		for(auto const& row : rows){
+			auto const* const el = &row;
+			bool isOpen = (el->m_session == OfdxSessionTable::OPEN);
+			bool isYours = (el->m_session == ctx.m_session);
+
+			out << "<p><span class=";
 
 			if(isYours){
-				conn->out() << "confirmed>*Reserved</span> (by you) ";
+				out << "confirmed>*Reserved</span> (by you) ";
 			} else if(isOpen){
-				conn->out() << "confirmed>Available</span> ";
+				out << "confirmed>Available</span> ";
 			} else {
-				conn->out() << "reserved>Reserved</span> ";
+				out << "reserved>Reserved</span> ";
 			}
 			
-			if(el->m_start > m_timenow)
-				conn->out() << "from <span class=utctime>" << el->m_start << "</span> ";
+			if(el->m_start > ctx.m_timenow)
+				out << "from <span class=utctime>" << el->m_start << "</span> ";
 
-			conn->out() << "until <span class=utctime>" << el->m_end << "</span>" << (el->m_info.empty() ? "" : " &mdash; ") << el->m_info;
+			out << "until <span class=utctime>" << el->m_end << "</span>" << (el->m_info.empty() ? "" : " &mdash; ") << el->m_info;
 
 			if(isYours){
-				conn->out() << " <a class=cancelres href=\"?cancel=" << el->m_start << "\">Cancel</a>";
+				out << " <a class=cancelres href=\"?cancel=" << el->m_start << "\">Cancel</a>";
 			} else if(isOpen){
-				conn->out() << " <a class=cancelres href=\"?claim=" << el->m_start << "\">Claim</a>";
+				out << " <a class=cancelres href=\"?claim=" << el->m_start << "\">Claim</a>";
 			}
 
-			conn->out() << "</p>\n";
-
-			if(!latest || el->m_end > latest->m_end){
-				willExtend = isYours;
-				latest = el;
-			}
+			out << "</p>\n";
 		}
 
-		conn->out() << "<br>"
+		bool const willExtend = latest && (latest->m_session == ctx.m_session);
+
+		out << "<br>"
 			<< "<button duration=60>1 hour</button>"
 			<< "<button duration=120>2 hours</button>"
 			<< "<button duration=240>4 hours</button>"
 			<< "<button duration=360>6 hours</button>"
 			<< "<button duration=480>8 hours</button>";
 
-		conn->out() << "<form id=reserver method=POST>"
+		out << "<form id=reserver method=POST>"
 			<< "<input id=m_id type=hidden name=m_id value=\"" << b->m_id << "\">"
 
 			<< "<label for=m_duration>Duration:</label><br>"
@@ -475,31 +1542,28 @@ public:
 		if(latest){
 			if(willExtend){
 				// You have the cluster reserved and can extend your time.
-				conn->out() << "<p>You have this cluster reserved for <span class=confirmed>" << ((latest->m_end - m_timenow) / 60) << " more minutes</span>. "
+				out << "<p>You have this cluster reserved for <span class=confirmed>" << ((latest->m_end - ctx.m_timenow) / 60) << " more minutes</span>. "
 					<< "Booking time will extend your reservation.</p>\n";
 			} else {
 				// Somebody else has the cluster reserved.
-				conn->out() << "<p>Your reservation will start <span class=reserved>" << ((latest->m_end - m_timenow) / 60) << " minutes from now</span>, after <span class=utctime>" << latest->m_end << "</span>.</p>\n";
+				out << "<p>Your reservation will start <span class=reserved>" << ((latest->m_end - ctx.m_timenow) / 60) << " minutes from now</span>, after <span class=utctime>" << latest->m_end << "</span>.</p>\n";
 			}
 		} else {
 			// No active reservation.
-			conn->out() << "<p>This cluster is <b>free</b>. Your reservation will start immediately.</p>\n";
+			out << "<p>This cluster is <b>free</b>. Your reservation will start immediately.</p>\n";
 		}
 
-		conn->out()
+		out
 			<< "<p>&nbsp;</p><p><a href=\"" << PATH_OFDX_BOOKIT << "\">Return</a> to main page.</p>"
-			<< "<span id=clock class=utctime>" << m_timenow << "</span>"
-			<< resources["footer.html"] << std::endl;
-
-		if(needPersist)
-			saveReservations();
+			<< "<span id=clock class=utctime>" << ctx.m_timenow << "</span>"
+			<< RESOURCE_FOOTER_HTML << std::endl;
 	}
 
-	void sendReservedPage(std::unique_ptr<dmitigr::fcgi::Server_connection> const& conn, std::shared_ptr<Bookable> const& b){
-		conn->out() << "Content-Type: text/html; charset=utf-8\r\n";
-
+	void sendReservedPage(std::unique_ptr<dmitigr::fcgi::Server_connection> const& conn, Request &ctx, std::shared_ptr<Bookable> const& b){
 		std::shared_ptr<Bookable::Reservation> r_new = std::make_shared<Bookable::Reservation>();
-		r_new->m_sessionId = m_sessionId;
+
+		// What was booked, copied while the object is locked.
+		Bookable::Reservation booked;
 
 		// Read POST data, perform reservation.
 		int code = 200;
@@ -512,34 +1576,19 @@ public:
 				code = 400;
 				message = "Your browser sent an invalid request. Please try again.";
 			} else {
-				std::stringstream iss;
-
-				// Split on ampersands
-				for(auto &c : line)
-					if((c == '&') || (c == ';'))
-						c = ' ';
-
-				iss.str(line);
-
-				std::string const
-					f_duration("m_duration="),
-					f_info("m_info=");
-
 				time_t duration = 0;
 
-				while(iss >> line){
-					if(line.find(f_duration) == 0){
-						duration = atoi(line.substr(f_duration.size()).c_str());
+				for(auto const& f : ofdxUrlEncoded(line)){
+					if(f.m_name == "m_duration"){
+						duration = ofdxToNumber<time_t>(f.m_value);
 
 						// Duration should be at least 15 minutes and no more than 24 hours.
 						if((duration < 15) || (duration > (60 * 24))){
 							// Clear the invalid value.
 							duration = 0;
 						}
-					} else if(line.find(f_info) == 0){
-						line = line.substr(f_info.size());
-						unescape_url_param(line);
-						r_new->m_info = line;
+					} else if(f.m_name == "m_info"){
+						r_new->m_info = std::string(ofdxUrlDecode(line, f.m_value));
 					}
 				}
 
@@ -551,49 +1600,68 @@ public:
 					message = "Please reserve for at least 15 minutes, and no more than 1440 minutes (24 hours).";
 				}
 
-				// Actually perform the reservation.
+				// Actually perform the reservation. Finding the free time and
+				// taking it happen under one lock, so two bookings of the same
+				// object cannot both get it.
 				if(code == 200){
+					std::lock_guard<std::mutex> lock(b->m_mutex);
 					std::shared_ptr<Bookable::Reservation> r_latest;
 
-					// Clean up and sort the list, including removal of expired reservations.
-					b->maintainReservations(m_timenow);
+					r_new->m_session = ctx.m_session = m_sessions.intern(ctx.m_sessionId);
 
-					// Find the latest reservation.
-					for(auto const& r : b->m_reservations){
-						// If the reservation ends in the future, and it ends at the furthest future date we have seen...
-						if((r->m_end > m_timenow) && (!r_latest || (r->m_end > r_latest->m_end)))
-							r_latest = r;
-					}
+					// Find the latest reservation, if it ends in the future.
+					auto const latest = b->m_reservations.latest();
+
+					if(latest && (latest->m_value->m_end > ctx.m_timenow))
+						r_latest = latest->m_value;
 
 					if(!r_latest){
 						// If not reserved, create reservation starting now.
-						r_new->m_start = m_timenow;
+						r_new->m_start = ctx.m_timenow;
 						r_new->m_end = (r_new->m_start + (duration * 60));
 
-						b->m_reservations.push_back(r_new);
+						b->addReservation(r_new);
+						holdReservation(*b, *r_new);
+						scheduleExpiry(*b, r_new->m_end);
+						journalReservation(ctx, *b, *r_new);
 
-					} else if(r_latest->m_sessionId == m_sessionId){
+					} else if(r_latest->m_session == ctx.m_session){
 						// If reserved and we own it, extend by duration.
 						r_latest->m_end += (duration * 60);
 						r_latest->m_info = r_new->m_info;
 						r_new = r_latest;
+
+						b->m_reservations.update(latest, Bookable::Reservations::Interval(r_latest->m_start, r_latest->m_end));
+						journalReservation(ctx, *b, *r_latest);
 					} else {
 						// If reserved and we don't own it, set start time to end time + 1.
+						// Gaps left by cancelations are not filled, as the page
+						// promised a start after the latest reservation.
 						r_new->m_start = r_latest->m_end + 1;
 						r_new->m_end = (r_new->m_start + (duration * 60));
 
-						b->m_reservations.push_back(r_new);
+						b->addReservation(r_new);
+						holdReservation(*b, *r_new);
+						scheduleExpiry(*b, r_new->m_end);
+						journalReservation(ctx, *b, *r_new);
 					}
 
-					saveReservations();
+					booked = *r_new;
 				}
 			}
 		}
 
+		// Only a reservation which is on disk is confirmed.
+		if(!commitReservations(ctx)){
+			sendNotSaved(conn);
+			return;
+		}
+
 		conn->out()
 			<< "Status: " << code << "\r\n"
+			<< "Content-Type: text/html; charset=utf-8\r\n"
 			<< "\r\n"
-			<< resources["header.html"];
+			<< RESOURCE_HEADER_HTML;
 
 		// Display success or error page.
 		switch(code){
@@ -606,11 +1674,11 @@ public:
 				conn->out()
 					<< "<p>Your reservation for <a href=\"" << PATH_OFDX_BOOKIT << b->m_id << "\">" << b->m_name << "</a> "
 					<< "is <span class=confirmed>confirmed</span>: "
-					<< "<span class=utctime>" << ((r_new->m_start == m_timenow) ? std::string("now") : std::to_string(r_new->m_start)) << "</span> &mdash; "
-					<< "<span class=utctime>" << r_new->m_end << "</span></p>\n";
+					<< "<span class=utctime>" << ((booked.m_start == ctx.m_timenow) ? std::string("now") : std::to_string(booked.m_start)) << "</span> &mdash; "
+					<< "<span class=utctime>" << booked.m_end << "</span></p>\n";
 
-				if(r_new->m_info != CLAIMED)
-					conn->out() << "<p>Thanks " << r_new->m_info << "!</p>\n";
+				if(booked.m_info != CLAIMED)
+					conn->out() << "<p>Thanks " << booked.m_info << "!</p>\n";
 
 				if(!b->m_desc.empty()){
 					conn->out() << "<pre>" << b->m_desc << "</pre>\n";
@@ -619,66 +1687,77 @@ public:
 
 		conn->out()
 			<< "<p><a href=\"" << PATH_OFDX_BOOKIT << "\">Return</a> to main page.</p>"
-			<< "<span id=clock class=utctime>" << m_timenow << "</span>"
-			<< resources["footer.html"] << std::endl;
+			<< "<span id=clock class=utctime>" << ctx.m_timenow << "</span>"
+			<< RESOURCE_FOOTER_HTML << std::endl;
 	}
 
 	void handleConnection(std::unique_ptr<dmitigr::fcgi::Server_connection> const& conn) override {
 		std::string const SCRIPT_NAME(conn->parameter("SCRIPT_NAME"));
-		time(&m_timenow);
+		Request ctx;
+		time(&ctx.m_timenow);
 
-		parseCookies(conn);
-		manageSessionId(conn);
+		if((SCRIPT_NAME == PATH_OFDX_BOOKIT_STATUS) && sendStatus(conn))
+			return;
 
-		if(SCRIPT_NAME == PATH_OFDX_BOOKIT){
-			sendHomePage(conn);
-		} else if(SCRIPT_NAME.find(PATH_OFDX_BOOKIT) == 0){
-			if(SCRIPT_NAME.find(PATH_OFDX_BOOKIT_RSC) == 0){
-				// Serve a file from the resource directory.
-				std::string const fname(SCRIPT_NAME.substr(PATH_OFDX_BOOKIT_RSC.size()));
-
-				if(resources.count(fname)){
-					conn->out()
-						<< "Status: 200 OK\r\n"
-						<< "Content-Type: " << resources[fname].mime << "\r\n"
-						<< "Content-Length: " << resources[fname].data.size() << "\r\n"
-						<< "Cache-Control: max-age=" << (7 * 24 * 60 * 60) /* 1 week */ << "\r\n"
-						<< "\r\n"
-						<< resources[fname]
-						<< std::endl;
+		if(SCRIPT_NAME.find(PATH_OFDX_BOOKIT_RSC) == 0){
+			// Serve a file from the resource directory. These are static, so no
+			// session is needed.
+			int const i = resourceIndex(std::string_view(SCRIPT_NAME).substr(PATH_OFDX_BOOKIT_RSC.size()));
+
+			if(i >= 0){
+				FramedResource const& f = m_framedResources[i];
+				auto const& v = (f.m_gzip.m_get && acceptsGzip(conn)) ? f.m_gzip : f.m_identity;
+
+				if(ifNoneMatch(conn, v.m_etag)){
+					conn->write_framed(v.m_notModified);
+				} else if(isHeadRequest(conn)){
+					conn->write_framed(v.m_head);
 				} else {
-					conn->out()
-						<< "Status: 404 Not Found\r\n"
-						<< "Content-Type: text/plain; charset=utf-8\r\n"
-						<< "\r\n"
-						<< "Not found."
-						<< std::endl;
+					conn->write_framed(v.m_get);
 				}
 			} else {
-				// Managing a cluster... which one?
-				std::string clusterId(SCRIPT_NAME.substr(PATH_OFDX_BOOKIT.size()));
+				conn->out()
+					<< "Status: 404 Not Found\r\n"
+					<< "Content-Type: text/plain; charset=utf-8\r\n"
+					<< "\r\n"
+					<< "Not found."
+					<< std::endl;
+			}
 
-				if(m_objects.count(clusterId)){
-					auto b = m_objects[clusterId];
+			return;
+		}
 
-					// Cluster exists
-					if(conn->parameter("REQUEST_METHOD") == std::string("POST")){
-						// Create the reservation and show the success page.
-						sendReservedPage(conn, b);
-					} else {
-						// Show the create reservation page.
-						sendCreatePage(conn, b);
-					}
+		parseCookies(conn, ctx);
+		manageSessionId(conn, ctx);
+
+		if(SCRIPT_NAME == PATH_OFDX_BOOKIT){
+			sendHomePage(conn, ctx);
+		} else if(SCRIPT_NAME == PATH_OFDX_BOOKIT_MINE){
+			sendMinePage(conn, ctx);
+		} else if(SCRIPT_NAME.find(PATH_OFDX_BOOKIT) == 0){
+			// Managing a cluster... which one?
+			std::string clusterId(SCRIPT_NAME.substr(PATH_OFDX_BOOKIT.size()));
+
+			if(auto const it = m_objects.find(clusterId); it != m_objects.end()){
+				auto const& b = it->second;
+
+				// Cluster exists
+				if(conn->parameter("REQUEST_METHOD") == std::string("POST")){
+					// Create the reservation and show the success page.
+					sendReservedPage(conn, ctx, b);
 				} else {
-					// Malformed URL or a bad cluster ID.
-					conn->out()
-						<< "Status: 404 Not Found\r\n"
-						<< "Content-Type: text/html; charset=utf-8\r\n"
-						<< "\r\n"
-						<< "<!doctype html><html><head><title>Not Found - BookIt!</title></head><body>"
-						<< "<p>The requested cluster was not found. <a href=\"" << PATH_OFDX_BOOKIT << "\">Return to reservation page</a>.</p>"
-						<< std::endl;
+					// Show the create reservation page.
+					sendCreatePage(conn, ctx, b);
 				}
+			} else {
+				// Malformed URL or a bad cluster ID.
+				conn->out()
+					<< "Status: 404 Not Found\r\n"
+					<< "Content-Type: text/html; charset=utf-8\r\n"
+					<< "\r\n"
+					<< "<!doctype html><html><head><title>Not Found - BookIt!</title></head><body>"
+					<< "<p>The requested cluster was not found. <a href=\"" << PATH_OFDX_BOOKIT << "\">Return to reservation page</a>.</p>"
+					<< std::endl;
 			}
 		} else {
 			// Generic not found.
@@ -699,14 +1778,20 @@ int main(int argc, char **argv){
 	if(!app.processCliArguments(argc, argv))
 		return 1;
 
-	loadResources();
+	if(!app.loadSessionKey())
+		return 1;
 
-	// Decode base64 encoded files.
-	for(auto & kv : resources)
-		kv.second.data = base64_decode(kv.second.data);
+	app.frameResources();
 
 	app.loadObjects();
-	app.loadReservations();
+
+	if(!app.loadReservations())
+		return 1;
+
+	if(app.m_cfg.m_export)
+		return app.exportReservations() ? 0 : 1;
+
+	app.startExpiry();
 
 	app.listen(app.m_cfg);
 
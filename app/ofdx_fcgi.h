@@ -4,10 +4,20 @@
 */
 
 #include "fcgi/fcgi.hpp"
+#include "ofdx_mpmc.h"
+#include "ofdx_template.h"
+#include "ofdx_urlencoded.h"
 
+#include <cstdio>
 #include <iostream>
 #include <fstream>
 #include <sstream>
+#include <unordered_map>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
 
 #define PORT_OFDX_BOOKIT            9020
 std::string const PATH_OFDX_BOOKIT("/bookit/");
@@ -16,10 +26,34 @@ struct OfdxBaseConfig {
 	std::string m_addr;
 	int m_port, m_backlog;
 
+	// Connections kept open by the web server (fastcgi_keep_conn) are closed
+	// after this many seconds of inactivity. Zero disables connection reuse.
+	int m_keepAliveTimeout, m_keepAliveMax;
+
+	// Concurrent requests per connection when multiplexing. Zero disables it.
+	int m_multiplexMax;
+
+	// Threads handling requests handed over by the accepting thread. Zero
+	// handles every request on the accepting thread.
+	int m_workers;
+
+	// Milliseconds spent draining a closed connection in the background
+	// before it is dropped. Zero closes connections without draining.
+	int m_lingerTimeout;
+
+	// Ignore flushes (std::endl) within a response, so it is sent in as few
+	// records as the buffer allows.
+	bool m_coalesceOutput;
+
 	std::string m_baseUriPath, m_dataPath;
 
 	OfdxBaseConfig(int port, std::string const& baseUriPath) :
 		m_addr("127.0.0.1"), m_port(port), m_backlog(64),
+		m_keepAliveTimeout(60), m_keepAliveMax(64),
+		m_multiplexMax(0),
+		m_workers(0),
+		m_lingerTimeout(1000),
+		m_coalesceOutput(true),
 
 		m_baseUriPath(baseUriPath)
 	{}
@@ -43,6 +77,36 @@ struct OfdxBaseConfig {
 
 					if(ss >> vi)
 						m_backlog = vi;
+				} else if(k == "keepalive"){
+					int vi;
+
+					if((ss >> vi) && (vi >= 0))
+						m_keepAliveTimeout = vi;
+				} else if(k == "keepalivemax"){
+					int vi;
+
+					if((ss >> vi) && (vi >= 0))
+						m_keepAliveMax = vi;
+				} else if(k == "multiplex"){
+					int vi;
+
+					if((ss >> vi) && (vi >= 0))
+						m_multiplexMax = vi;
+				} else if(k == "workers"){
+					int vi;
+
+					if((ss >> vi) && (vi >= 0))
+						m_workers = vi;
+				} else if(k == "linger"){
+					int vi;
+
+					if((ss >> vi) && (vi >= 0))
+						m_lingerTimeout = vi;
+				} else if(k == "coalesce"){
+					int vi;
+
+					if(ss >> vi)
+						m_coalesceOutput = (vi != 0);
 				} else if(ss >> v){
 					if(k == "addr"){
 						m_addr.assign(v);
@@ -63,105 +127,368 @@ struct OfdxBaseConfig {
 	}
 };
 
+// State of a single request. Requests may be handled on several worker
+// threads at once, so anything request specific belongs here rather than in
+// the service.
+struct OfdxRequestContext {
+	// The Cookie header, which the connection keeps for as long as it lasts.
+	std::string_view m_cookieHeader;
+
+	// Value of the named cookie, or an empty view.
+	std::string_view cookie(std::string_view const name) const {
+		return ofdxCookies(m_cookieHeader).last(name);
+	}
+};
+
 class OfdxFcgiService {
+	// Connections waiting for a worker thread, which reads the request, so
+	// that a slow client holds up only the worker serving it.
+	OfdxMpmcQueue<std::unique_ptr<dmitigr::net::Descriptor>> m_queue;
+	std::vector<std::thread> m_workers;
+
+	// Workers only sleep on the condition variable when the queue is empty.
+	std::mutex m_idleMutex;
+	std::condition_variable m_idleCv;
+	std::atomic<int> m_idleWorkers;
+	std::atomic<bool> m_stopping;
+
+	// Documents for serveTemplatedDocument(), compiled once per change.
+	OfdxTemplateCache m_templates;
+
+	bool nextConnection(std::unique_ptr<dmitigr::net::Descriptor> &conn){
+		if(m_queue.pop(conn))
+			return true;
+
+		std::unique_lock<std::mutex> lock(m_idleMutex);
+		++ m_idleWorkers;
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+
+		while(!m_queue.pop(conn)){
+			if(m_stopping){
+				-- m_idleWorkers;
+				return false;
+			}
+
+			m_idleCv.wait(lock);
+		}
+
+		-- m_idleWorkers;
+		return true;
+	}
+
+	// Read the request from io and handle it.
+	void serve(std::unique_ptr<dmitigr::net::Descriptor> io){
+		try {
+			auto const conn = m_pServer->open(std::move(io));
+			handleConnection(conn);
+
+			// Closing the connection (flushing the response) happens here too.
+		} catch(std::exception const& e){
+			std::cerr << "Error: " << e.what() << std::endl;
+		}
+	}
+
+	void work(){
+		std::unique_ptr<dmitigr::net::Descriptor> io;
+
+		while(nextConnection(io))
+			serve(std::move(io));
+	}
+
+	// Returns false if every worker is swamped and the queue is full.
+	bool dispatch(std::unique_ptr<dmitigr::net::Descriptor> &conn){
+		if(!m_queue.push(conn))
+			return false;
+
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if(m_idleWorkers > 0){
+			std::lock_guard<std::mutex> lock(m_idleMutex);
+			m_idleCv.notify_one();
+		}
+
+		return true;
+	}
+
 protected:
 	std::shared_ptr<dmitigr::fcgi::Listener> m_pServer;
-	std::unordered_map<std::string, std::string> m_cookies;
 
 	virtual void handleConnection(std::unique_ptr<dmitigr::fcgi::Server_connection> const& conn) = 0;
 
-	void parseCookies(std::unique_ptr<dmitigr::fcgi::Server_connection> const& conn){
-		std::string session;
+	void parseCookies(std::unique_ptr<dmitigr::fcgi::Server_connection> const& conn, OfdxRequestContext &ctx){
+		auto const i = conn->parameter_index("HTTP_COOKIE");
+		ctx.m_cookieHeader = i ? conn->parameter(*i) : std::string_view();
+	}
 
-		// Erase anything that might be in here from a previous connection.
-		m_cookies.clear();
+	static bool isHeadRequest(std::unique_ptr<dmitigr::fcgi::Server_connection> const& conn){
+		auto const i = conn->parameter_index("REQUEST_METHOD");
+		return i && (conn->parameter(*i) == "HEAD");
+	}
 
-		try {
-			std::string http_cookie(conn->parameter("HTTP_COOKIE"));
-			std::stringstream http_cookie_ss(http_cookie);
-			std::string cookie;
+	// Whether Accept-Encoding allows gzip: names it without q=0, or else has
+	// a "*" without q=0.
+	static bool acceptsGzip(std::unique_ptr<dmitigr::fcgi::Server_connection> const& conn){
+		auto const i = conn->parameter_index("HTTP_ACCEPT_ENCODING");
 
-			while(http_cookie_ss >> cookie){
-				size_t n = cookie.find('=');
+		if(!i)
+			return false;
 
-				for(auto & c : cookie){
-					if(c == ';'){
-						c = 0;
-						break;
-					}
-				}
+		std::string_view const header(conn->parameter(*i));
+		bool any = false;
+
+		for(size_t a = 0; a < header.size();){
+			size_t b = header.find(',', a);
+
+			if(b == std::string_view::npos)
+				b = header.size();
+
+			std::string_view coding(header.substr(a, b - a)), params;
+			a = b + 1;
+
+			auto const semi = coding.find(';');
+
+			if(semi != std::string_view::npos){
+				params = coding.substr(semi + 1);
+				coding = coding.substr(0, semi);
+			}
 
-				if((n > 0) && (n < cookie.size() - 1)){
-					m_cookies[cookie.substr(0, n).c_str()] = cookie.substr(n + 1).c_str();
+			while(!coding.empty() && ((coding.front() == ' ') || (coding.front() == '\t')))
+				coding.remove_prefix(1);
+
+			while(!coding.empty() && ((coding.back() == ' ') || (coding.back() == '\t')))
+				coding.remove_suffix(1);
+
+			bool const gzip = (coding == "gzip") || (coding == "x-gzip");
+
+			if(!gzip && (coding != "*"))
+				continue;
+
+			// Refused with q=0, q=0.0 and so on.
+			bool refused = false;
+			auto const q = params.find("q=");
+
+			if(q != std::string_view::npos){
+				std::string_view value(params.substr(q + 2));
+				refused = true;
+
+				for(size_t j = 0; (j < value.size()) && (value[j] != ' ') && (value[j] != ';'); ++ j){
+					if((value[j] != '0') && (value[j] != '.'))
+						refused = false;
 				}
 			}
 
-		} catch(...){}
+			if(gzip)
+				return !refused;
+
+			any = !refused;
+		}
+
+		return any;
 	}
 
-	// Callback for template processing. If a document contains "<?ofdx example tpl here>" then text will contain " example tpl here".
-	virtual void fillTemplate(std::unique_ptr<dmitigr::fcgi::Server_connection> const& conn, std::string const& text){}
+	// Weak validator for a page rendered from the given state, which should
+	// name everything the page depends on.
+	static std::string weakEtag(std::string const& state){
+		uint64_t h = 0xcbf29ce484222325ULL;
 
-	void parseTemplateLine(std::unique_ptr<dmitigr::fcgi::Server_connection> const& conn, std::string const& line){
-		std::string const keystr("<?ofdx");
+		for(unsigned char const c : state)
+			h = (h ^ c) * 0x100000001b3ULL;
 
-		// Look for template and if found, call the replacement function.
-		auto a = line.find(keystr);
+		char buf[24];
+		snprintf(buf, sizeof(buf), "W/\"%016llx\"", (unsigned long long) h);
 
-		if(a != std::string::npos){
-			auto const b = line.find('>', a);
+		return buf;
+	}
 
-			if(b != std::string::npos){
-				conn->out() << line.substr(0, a);
+	// Whether If-None-Match lists etag, by weak comparison.
+	static bool ifNoneMatch(std::unique_ptr<dmitigr::fcgi::Server_connection> const& conn, std::string_view etag){
+		auto const i = conn->parameter_index("HTTP_IF_NONE_MATCH");
 
-				a += keystr.length();
+		if(!i)
+			return false;
 
-				std::string const text(line.substr(a, (b - a)));
+		if(etag.substr(0, 2) == "W/")
+			etag.remove_prefix(2);
 
-				fillTemplate(conn, text);
-				parseTemplateLine(conn, line.substr(b + 1));
+		std::string_view const header(conn->parameter(*i));
 
-				return;
-			}
+		for(size_t a = 0; a < header.size();){
+			size_t b = header.find(',', a);
+
+			if(b == std::string_view::npos)
+				b = header.size();
+
+			std::string_view tag(header.substr(a, b - a));
+			a = b + 1;
+
+			while(!tag.empty() && ((tag.front() == ' ') || (tag.front() == '\t')))
+				tag.remove_prefix(1);
+
+			while(!tag.empty() && ((tag.back() == ' ') || (tag.back() == '\t')))
+				tag.remove_suffix(1);
+
+			if(tag.substr(0, 2) == "W/")
+				tag.remove_prefix(2);
+
+			if((tag == "*") || (tag == etag))
+				return true;
 		}
 
-		conn->out() << line << std::endl;
+		return false;
 	}
 
-	bool serveTemplatedDocument(std::unique_ptr<dmitigr::fcgi::Server_connection> const& conn, std::string fname, bool includeHtmlContentType = false){
-		std::ifstream infile(fname);
+	// Call after any other headers (such as Set-Cookie). The headers which
+	// describe the cached response must be repeated; vary may be empty.
+	static void sendNotModified(std::unique_ptr<dmitigr::fcgi::Server_connection> const& conn, std::string const& etag, std::string const& cacheControl, std::string const& vary){
+		conn->out() << "Status: 304 Not Modified\r\n";
+
+		if(!vary.empty())
+			conn->out() << "Vary: " << vary << "\r\n";
 
-		if(infile){
-			std::string line;
+		conn->out()
+			<< "ETag: " << etag << "\r\n"
+			<< "Cache-Control: " << cacheControl << "\r\n"
+			<< "\r\n";
+	}
 
-			if(includeHtmlContentType)
-				conn->out() << "Content-Type: text/html; charset=utf-8" << std::endl << std::endl;
+	// Plain text metrics, one "name value" pair per line.
+	virtual void writeStatus(std::ostream &os){
+		os
+			<< "dispatch_workers " << m_workers.size() << "\n"
+			<< "dispatch_queue_depth " << m_queue.depth() << "\n"
+			<< "dispatch_queue_capacity " << m_queue.capacity() << "\n";
+
+		if(m_pServer){
+			auto const io = m_pServer->io_stats();
+
+			os
+				<< "fcgi_requests_total " << io.request_count << "\n"
+				<< "fcgi_reads_total " << io.read_count << "\n"
+				<< "fcgi_writes_total " << io.write_count << "\n"
+				<< "fcgi_records_total " << io.record_count << "\n"
+				<< "fcgi_records_per_response " << (io.request_count ? (double) io.record_count / io.request_count : 0.0) << "\n";
+
+			auto const buffers = m_pServer->buffer_pool_stats();
+
+			os
+				<< "buffer_pool_hits_total " << buffers.hit_count << "\n"
+				<< "buffer_pool_misses_total " << buffers.miss_count << "\n"
+				<< "buffer_pool_free " << buffers.free_count << "\n";
+
+			auto const reaper = m_pServer->reaper_stats();
+
+			os
+				<< "reaper_pending " << reaper.pending_count << "\n"
+				<< "reaper_closed_total " << reaper.closed_count << "\n"
+				<< "reaper_timeouts_total " << reaper.timed_out_count << "\n"
+				<< "reaper_overflows_total " << reaper.overflow_count << "\n"
+				<< "reaper_drain_seconds_total " << (reaper.total_drain_time.count() / 1e6) << "\n"
+				<< "reaper_drain_seconds_max " << (reaper.max_drain_time.count() / 1e6) << "\n";
+		}
+	}
 
-			while(std::getline(infile, line))
-				parseTemplateLine(conn, line);
+	// The status page is only served to clients on the loopback interface.
+	bool sendStatus(std::unique_ptr<dmitigr::fcgi::Server_connection> const& conn){
+		try {
+			std::string const addr(conn->parameter("REMOTE_ADDR"));
 
-			return true;
+			if((addr.find("127.") != 0) && (addr != "::1"))
+				return false;
+
+		} catch(...){
+			return false;
 		}
 
-		return false;
+		conn->out()
+			<< "Content-Type: text/plain; charset=utf-8\r\n"
+			<< "Cache-Control: no-store\r\n"
+			<< "\r\n";
+
+		writeStatus(conn->out());
+		return true;
+	}
+
+	// Callback for template processing. If a document contains "<?ofdx example tpl here>" then text will contain " example tpl here".
+	virtual void fillTemplate(std::unique_ptr<dmitigr::fcgi::Server_connection> const& conn, std::string const& text){}
+
+	bool serveTemplatedDocument(std::unique_ptr<dmitigr::fcgi::Server_connection> const& conn, std::string fname, bool includeHtmlContentType = false){
+		auto const tpl = m_templates.get(fname);
+
+		if(!tpl)
+			return false;
+
+		if(includeHtmlContentType)
+			conn->out() << "Content-Type: text/html; charset=utf-8\n\n";
+
+		tpl->render(conn->out(), [&](std::string const& text){ fillTemplate(conn, text); });
+
+		return true;
 	}
 
 public:
+	OfdxFcgiService() :
+		m_queue(1024),
+		m_idleWorkers(0),
+		m_stopping(false)
+	{}
+
+	virtual ~OfdxFcgiService(){
+		stopWorkers();
+	}
+
+	void stopWorkers(){
+		m_stopping = true;
+
+		{
+			std::lock_guard<std::mutex> lock(m_idleMutex);
+			m_idleCv.notify_all();
+		}
+
+		for(auto & t : m_workers)
+			t.join();
+
+		m_workers.clear();
+		m_stopping = false;
+	}
+
+	size_t queueDepth() const {
+		return m_queue.depth();
+	}
+
 	void listen(OfdxBaseConfig const& cfg){
 		if(!m_pServer){
 			dmitigr::fcgi::Listener_options options {
 				cfg.m_addr, cfg.m_port, cfg.m_backlog
 			};
 
+			options
+				.set_idle_timeout(std::chrono::seconds(cfg.m_keepAliveTimeout))
+				.set_max_idle_connections(cfg.m_keepAliveMax)
+				.set_linger_timeout(std::chrono::milliseconds(cfg.m_lingerTimeout))
+				.set_flush_policy(cfg.m_coalesceOutput ?
+					dmitigr::fcgi::Flush_policy::coalesce :
+					dmitigr::fcgi::Flush_policy::sync);
+
+			if(cfg.m_multiplexMax > 0){
+				options
+					.set_multiplexing(true)
+					.set_max_multiplexed_requests(cfg.m_multiplexMax);
+			}
+
 			m_pServer = std::make_shared<dmitigr::fcgi::Listener>(options);
 			m_pServer->listen();
+
+			for(int i = 0; i < cfg.m_workers; ++ i)
+				m_workers.emplace_back(&OfdxFcgiService::work, this);
 		}
 	}
 
 	bool accept(){
 		try {
-			if(const auto conn = m_pServer->accept())
-				handleConnection(conn);
+			if(auto io = m_pServer->take()){
+				// Without workers, or with all of them swamped, handle it here.
+				if(m_workers.empty() || !dispatch(io))
+					serve(std::move(io));
+			}
 
 		} catch(std::exception const& e){
 			std::cerr << "Error: " << e.what() << std::endl;
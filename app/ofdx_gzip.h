@@ -0,0 +1,171 @@
+/*
+   OFDX Gzip Stream
+
+   An output stream which gzips everything written to it into another stream,
+   for compressing responses on the fly. Flushes (std::endl) are ignored
+   while compressing, since each one would cost compression ratio; the gzip
+   trailer is written by finish(), or at the latest by the destructor.
+
+   Setting up deflate allocates a few hundred KB, so each thread keeps one
+   deflate state and resets it for every stream. Only one compressing stream
+   may be open per thread at a time. If the state cannot be set up, streams
+   on that thread pass everything through, so check available() before
+   sending "Content-Encoding: gzip".
+*/
+
+#ifndef OFDX_GZIP_H
+#define OFDX_GZIP_H
+
+#include <cstring>
+#include <ostream>
+#include <streambuf>
+
+#include <zlib.h>
+
+class OfdxGzipStreambuf : public std::streambuf {
+	std::ostream &m_out;
+	bool const m_compress;
+
+	// Null once finished.
+	z_stream *m_z;
+
+	char m_in[4096], m_deflated[4096];
+
+	static z_stream* threadStream(){
+		thread_local struct Deflater {
+			z_stream m_z;
+			bool m_ok;
+
+			Deflater(){
+				memset(&m_z, 0, sizeof(m_z));
+
+				// 16 + 15: gzip wrapper, 32 KB window.
+				m_ok = (deflateInit2(&m_z, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 16 + 15, 8, Z_DEFAULT_STRATEGY) == Z_OK);
+			}
+
+			~Deflater(){
+				if(m_ok)
+					deflateEnd(&m_z);
+			}
+		} deflater;
+
+		return deflater.m_ok ? &deflater.m_z : nullptr;
+	}
+
+	// Deflate the put area into m_out.
+	bool deflatePending(int const flush){
+		m_z->next_in = (Bytef*) pbase();
+		m_z->avail_in = pptr() - pbase();
+
+		for(;;){
+			m_z->next_out = (Bytef*) m_deflated;
+			m_z->avail_out = sizeof(m_deflated);
+
+			int const rc = deflate(m_z, flush);
+
+			if(rc == Z_STREAM_ERROR)
+				return false;
+
+			m_out.write(m_deflated, sizeof(m_deflated) - m_z->avail_out);
+
+			// Room left over means all of the input was taken.
+			if((flush == Z_FINISH) ? (rc == Z_STREAM_END) : (m_z->avail_out != 0))
+				break;
+		}
+
+		setp(m_in, m_in + sizeof(m_in));
+		return !m_out.fail();
+	}
+
+protected:
+	int_type overflow(int_type c) override {
+		if(!m_compress){
+			return traits_type::eq_int_type(c, traits_type::eof()) ?
+				traits_type::not_eof(c) : m_out.rdbuf()->sputc(traits_type::to_char_type(c));
+		}
+
+		if(!m_z || !deflatePending(Z_NO_FLUSH))
+			return traits_type::eof();
+
+		if(!traits_type::eq_int_type(c, traits_type::eof())){
+			*pptr() = traits_type::to_char_type(c);
+			pbump(1);
+		}
+
+		return traits_type::not_eof(c);
+	}
+
+	std::streamsize xsputn(char const *s, std::streamsize n) override {
+		if(!m_compress)
+			return m_out.rdbuf()->sputn(s, n);
+
+		return std::streambuf::xsputn(s, n);
+	}
+
+	int sync() override {
+		if(!m_compress)
+			m_out.flush();
+
+		return 0;
+	}
+
+public:
+	// Whether streams on this thread can compress.
+	static bool available(){
+		return threadStream() != nullptr;
+	}
+
+	// Passes everything through unchanged unless compress is set and the
+	// stream can compress.
+	OfdxGzipStreambuf(std::ostream &out, bool const compress) :
+		m_out(out),
+		m_compress(compress && available()),
+		m_z(m_compress ? threadStream() : nullptr)
+	{
+		if(m_z){
+			deflateReset(m_z);
+			setp(m_in, m_in + sizeof(m_in));
+		}
+	}
+
+	~OfdxGzipStreambuf(){
+		finish();
+	}
+
+	OfdxGzipStreambuf(OfdxGzipStreambuf const&) = delete;
+	OfdxGzipStreambuf& operator=(OfdxGzipStreambuf const&) = delete;
+
+	// Write out the rest of the compressed stream. Returns false on error.
+	bool finish(){
+		if(!m_compress)
+			return !m_out.fail();
+
+		if(!m_z)
+			return false;
+
+		bool const ok = deflatePending(Z_FINISH);
+
+		setp(nullptr, nullptr);
+		m_z = nullptr;
+
+		return ok;
+	}
+};
+
+class OfdxGzipStream : public std::ostream {
+	OfdxGzipStreambuf m_buf;
+
+public:
+	OfdxGzipStream(std::ostream &out, bool const compress) :
+		std::ostream(nullptr),
+		m_buf(out, compress)
+	{
+		rdbuf(&m_buf);
+	}
+
+	bool finish(){
+		return m_buf.finish();
+	}
+};
+
+#endif
@@ -0,0 +1,309 @@
+/*
+   OFDX Interval Index
+
+   Closed intervals [min, max] with a value each, kept in a vector sorted by
+   min so that lookups touch a few contiguous cache lines rather than chasing
+   list nodes. Three augmentations are rebuilt after every change:
+
+   - An implicit interval tree laid over the sorted vector: the element in the
+     middle of each run of 2^(k+1)-1 elements is the root of that run, and it
+     records the greatest max of its subtree. Stabbing and overlap queries
+     prune whole subtrees which end too early, so they cost O(log n + hits).
+   - The running greatest max of each prefix, which answers "does anything
+     overlap" with a single binary search.
+   - A max-tree of the free space before each element, which finds the first
+     gap of a given length in O(log n).
+
+   Changes cost O(n), which is fine since reads outnumber writes by far.
+*/
+
+#ifndef OFDX_INTERVAL_INDEX_H
+#define OFDX_INTERVAL_INDEX_H
+
+#include "math/interval.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <limits>
+#include <utility>
+#include <vector>
+
+template<typename T, typename V>
+class OfdxIntervalIndex {
+public:
+	typedef dmitigr::math::Interval<T> Interval;
+
+	struct Entry {
+		Interval m_when;
+		V m_value;
+	};
+
+private:
+	std::vector<Entry> m_entries;
+
+	// Greatest max of the implicit subtree rooted at each element.
+	std::vector<T> m_subtreeMax;
+
+	// Greatest max of the elements [0, i].
+	std::vector<T> m_prefixMax;
+
+	// Free space before each element (see gapBefore()), as a max-tree with
+	// the leaves starting at m_gapLeaves.
+	std::vector<T> m_gapTree;
+	size_t m_gapLeaves;
+
+	// Level of the root of the implicit tree.
+	int m_rootLevel;
+
+	// Position of the first element with the greatest max.
+	size_t m_latest;
+
+	// Number of seconds (or whatever T counts) strictly between the elements
+	// before i and the element i.
+	T gapBefore(size_t i) const {
+		return (i == 0) ? std::numeric_limits<T>::max() :
+			std::max<T>(0, m_entries[i].m_when.min() - m_prefixMax[i - 1] - 1);
+	}
+
+	void rebuild(){
+		size_t const n = m_entries.size();
+
+		m_subtreeMax.resize(n);
+		m_prefixMax.resize(n);
+		m_latest = 0;
+
+		for(size_t i = 0; i < n; ++ i){
+			T const& max = m_entries[i].m_when.max();
+
+			m_prefixMax[i] = i ? std::max(m_prefixMax[i - 1], max) : max;
+
+			if(max > m_entries[m_latest].m_when.max())
+				m_latest = i;
+		}
+
+		// Leaves are the even positions; each level up doubles the stride.
+		// Subtrees cut off by the end of the vector take the max of whatever
+		// exists to their left at that level.
+		m_rootLevel = -1;
+
+		if(n){
+			size_t lastPos = 0;
+			T last = T();
+
+			for(size_t i = 0; i < n; i += 2){
+				lastPos = i;
+				last = m_subtreeMax[i] = m_entries[i].m_when.max();
+			}
+
+			int k = 1;
+
+			for(; ((size_t) 1 << k) <= n; ++ k){
+				size_t const x = (size_t) 1 << (k - 1);
+				size_t const step = x << 2;
+
+				for(size_t i = (x << 1) - 1; i < n; i += step){
+					T const& left = m_subtreeMax[i - x];
+					T const& right = (i + x < n) ? m_subtreeMax[i + x] : last;
+
+					m_subtreeMax[i] = std::max({ m_entries[i].m_when.max(), left, right });
+				}
+
+				lastPos = ((lastPos >> k) & 1) ? (lastPos - x) : (lastPos + x);
+
+				if((lastPos < n) && (m_subtreeMax[lastPos] > last))
+					last = m_subtreeMax[lastPos];
+			}
+
+			m_rootLevel = k - 1;
+		}
+
+		m_gapLeaves = 1;
+		while(m_gapLeaves < n)
+			m_gapLeaves <<= 1;
+
+		m_gapTree.assign(m_gapLeaves * 2, std::numeric_limits<T>::min());
+
+		for(size_t i = 0; i < n; ++ i)
+			m_gapTree[m_gapLeaves + i] = gapBefore(i);
+
+		for(size_t i = m_gapLeaves - 1; i > 0; -- i)
+			m_gapTree[i] = std::max(m_gapTree[i << 1], m_gapTree[(i << 1) | 1]);
+	}
+
+	// First position >= from whose gapBefore() is at least length, or size().
+	size_t firstGap(size_t from, T const& length, size_t node, size_t lo, size_t hi) const {
+		if((hi <= from) || (m_gapTree[node] < length))
+			return m_entries.size();
+
+		if(node >= m_gapLeaves)
+			return (lo >= from) ? lo : m_entries.size();
+
+		size_t const mid = (lo + hi) / 2;
+		size_t const found = firstGap(from, length, node << 1, lo, mid);
+
+		return (found != m_entries.size()) ? found : firstGap(from, length, (node << 1) | 1, mid, hi);
+	}
+
+	// First position whose min is greater than t.
+	size_t upperBound(T const& t) const {
+		return std::upper_bound(m_entries.begin(), m_entries.end(), t,
+			[](T const& t, Entry const& e){ return t < e.m_when.min(); }) - m_entries.begin();
+	}
+
+public:
+	OfdxIntervalIndex() :
+		m_gapLeaves(1), m_rootLevel(-1), m_latest(0)
+	{
+		rebuild();
+	}
+
+	typedef typename std::vector<Entry>::const_iterator const_iterator;
+
+	// In the order of min, then of insertion.
+	const_iterator begin() const { return m_entries.begin(); }
+	const_iterator end() const { return m_entries.end(); }
+
+	size_t size() const { return m_entries.size(); }
+	bool empty() const { return m_entries.empty(); }
+
+	void insert(Interval const& when, V value){
+		m_entries.insert(m_entries.begin() + upperBound(when.min()), Entry{ when, std::move(value) });
+		rebuild();
+	}
+
+	// Replace the whole content, with a single rebuild. Entries with the same
+	// min keep their order. Entries already in order, as a snapshot has
+	// them, are not sorted again.
+	void assign(std::vector<Entry> entries){
+		auto const byMin = [](Entry const& a, Entry const& b){ return a.m_when.min() < b.m_when.min(); };
+
+		m_entries = std::move(entries);
+
+		if(!std::is_sorted(m_entries.begin(), m_entries.end(), byMin))
+			std::stable_sort(m_entries.begin(), m_entries.end(), byMin);
+
+		rebuild();
+	}
+
+	// Replace the interval of an entry of this index.
+	void update(Entry const* e, Interval const& when){
+		size_t const i = e - m_entries.data();
+		Entry moved{ when, std::move(m_entries[i].m_value) };
+
+		m_entries.erase(m_entries.begin() + i);
+		insert(moved.m_when, std::move(moved.m_value));
+	}
+
+	// Remove the entries matching pred(Entry const&). Returns how many.
+	template<typename P>
+	size_t removeIf(P pred){
+		size_t const n = m_entries.size();
+
+		m_entries.erase(std::remove_if(m_entries.begin(), m_entries.end(), pred), m_entries.end());
+
+		if(m_entries.size() != n)
+			rebuild();
+
+		return n - m_entries.size();
+	}
+
+	// First entry with the given min, or null.
+	Entry const* find(T const& min) const {
+		auto const it = std::lower_bound(m_entries.begin(), m_entries.end(), min,
+			[](Entry const& e, T const& t){ return e.m_when.min() < t; });
+
+		return ((it != m_entries.end()) && (it->m_when.min() == min)) ? &*it : nullptr;
+	}
+
+	// First entry with a min greater than t, or null.
+	Entry const* firstAfter(T const& t) const {
+		size_t const i = upperBound(t);
+
+		return (i < m_entries.size()) ? &m_entries[i] : nullptr;
+	}
+
+	// The entry which ends last (the earliest one of a tie), or null.
+	Entry const* latest() const {
+		return m_entries.empty() ? nullptr : &m_entries[m_latest];
+	}
+
+	// Whether anything intersects [min, max].
+	bool overlaps(Interval const& when) const {
+		size_t const i = upperBound(when.max());
+
+		return i && (m_prefixMax[i - 1] >= when.min());
+	}
+
+	// Call f(Entry const&) for each entry intersecting [min, max], in order
+	// of min. Stop early if f returns false.
+	template<typename F>
+	void forEachOverlap(Interval const& when, F f) const {
+		struct Frame {
+			int k;
+			size_t x;
+			bool leftDone;
+		};
+
+		size_t const n = m_entries.size();
+		T const& qmin = when.min();
+		T const& qmax = when.max();
+
+		// A subtree holds at most 64 levels, and each one pushes two frames.
+		Frame stack[128];
+		int top = 0;
+
+		if(m_rootLevel < 0)
+			return;
+
+		stack[top ++] = { m_rootLevel, ((size_t) 1 << m_rootLevel) - 1, false };
+
+		while(top){
+			Frame const z = stack[-- top];
+
+			if(z.k <= 3){
+				// Small subtree, scan it.
+				size_t const i0 = z.x >> z.k << z.k;
+				size_t const i1 = std::min(n, i0 + ((size_t) 1 << (z.k + 1)) - 1);
+
+				for(size_t i = i0; (i < i1) && (m_entries[i].m_when.min() <= qmax); ++ i){
+					if((qmin <= m_entries[i].m_when.max()) && !f(m_entries[i]))
+						return;
+				}
+			} else if(!z.leftDone){
+				size_t const y = z.x - ((size_t) 1 << (z.k - 1));
+
+				stack[top ++] = { z.k, z.x, true };
+
+				if((y >= n) || (m_subtreeMax[y] >= qmin))
+					stack[top ++] = { z.k - 1, y, false };
+			} else if((z.x < n) && (m_entries[z.x].m_when.min() <= qmax)){
+				if((qmin <= m_entries[z.x].m_when.max()) && !f(m_entries[z.x]))
+					return;
+
+				stack[top ++] = { z.k - 1, z.x + ((size_t) 1 << (z.k - 1)), false };
+			}
+		}
+	}
+
+	// Call f(Entry const&) for each entry holding t.
+	template<typename F>
+	void forEachAt(T const& t, F f) const {
+		forEachOverlap(Interval(t, t), f);
+	}
+
+	// Earliest start >= from of a free [start, start + length].
+	T nextGap(T const& from, T const& length) const {
+		size_t const i0 = upperBound(from);
+		T const start = (i0 && (m_prefixMax[i0 - 1] >= from)) ? (m_prefixMax[i0 - 1] + 1) : from;
+
+		if(i0 == m_entries.size() || (start + length < m_entries[i0].m_when.min()))
+			return start;
+
+		// Fits before the element j, after everything ahead of it.
+		size_t const j = firstGap(i0 + 1, length + 1, 1, 0, m_gapLeaves);
+
+		return m_prefixMax[((j < m_entries.size()) ? j : m_entries.size()) - 1] + 1;
+	}
+};
+
+#endif
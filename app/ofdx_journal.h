@@ -0,0 +1,312 @@
+/*
+   OFDX Journal
+
+   Append-only log of text records, one per line, with group commit: a
+   record is queued under whatever lock orders the changes it describes, and
+   commit() waits for it to reach the disk after that lock is released. The
+   first waiter writes everything queued so far with a single write and
+   fsync, so concurrent requests share the cost of the sync.
+
+   The journal is compacted by the owner: rotate() moves the records aside
+   while the owner takes a snapshot of its state, the snapshot is written with
+   ofdxWriteFileAtomically(), and then the rotated records are discarded.
+   Recovery replays the snapshot, then the rotated records (if a compaction
+   did not finish), then the journal. Records must therefore be idempotent.
+
+   A failed write leaves the end of the journal in an unknown state, so the
+   records from then on are dropped, and commit() fails for them, until the
+   next rotation. The owner's snapshot after that covers them again.
+*/
+
+#ifndef OFDX_JOURNAL_H
+#define OFDX_JOURNAL_H
+
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <mutex>
+#include <string>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+// Write all of data to fd. Returns false on error.
+static bool ofdxWriteAll(int const fd, char const *data, size_t size){
+	while(size){
+		ssize_t const n = write(fd, data, size);
+
+		if(n < 0){
+			if(errno == EINTR)
+				continue;
+
+			return false;
+		}
+
+		data += n;
+		size -= n;
+	}
+
+	return true;
+}
+
+// Flush the directory entry of path, so that a rename or a new file survives
+// a crash.
+static bool ofdxSyncParentDir(std::string const& path){
+	auto const slash = path.rfind('/');
+	std::string const dir((slash == std::string::npos) ? std::string(".") : path.substr(0, slash + 1));
+
+	int const fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+	if(fd < 0)
+		return false;
+
+	bool const ok = (fsync(fd) == 0);
+	close(fd);
+
+	return ok;
+}
+
+// Replace the file at path with data, so that a crash leaves either the old
+// or the new content in place.
+static bool ofdxWriteFileAtomically(std::string const& path, std::string const& data){
+	std::string const tmp(path + ".tmp");
+	int const fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+	if(fd < 0)
+		return false;
+
+	bool ok = ofdxWriteAll(fd, data.data(), data.size()) && (fsync(fd) == 0);
+	ok = (close(fd) == 0) && ok;
+
+	if(ok && (rename(tmp.c_str(), path.c_str()) == 0))
+		return ofdxSyncParentDir(path);
+
+	unlink(tmp.c_str());
+	return false;
+}
+
+// Call f(std::string const& line) for each complete line of the file at path.
+// A torn line at the end (from a crash during a write) is ignored.
+template<typename F>
+static void ofdxReadLines(std::string const& path, F f){
+	std::ifstream infile(path, std::ios::binary);
+	std::string const data((std::istreambuf_iterator<char>(infile)), std::istreambuf_iterator<char>());
+
+	for(size_t a = 0, b; (b = data.find('\n', a)) != std::string::npos; a = b + 1){
+		if(b > a)
+			f(data.substr(a, b - a));
+	}
+}
+
+class OfdxJournal {
+	std::string m_path;
+	int m_fd;
+
+	std::mutex m_mutex;
+	std::condition_variable m_committed;
+
+	// Records queued since the last write, and their sequence numbers.
+	std::string m_pending;
+	uint64_t m_queued, m_durable;
+
+	// A write (or rotation) is in progress outside the mutex.
+	bool m_busy;
+
+	// Sequence numbers of the records lost to the last failed write, from
+	// the failed batch up to the rotation which ended it. While m_broken,
+	// the range is still open and nothing is written.
+	bool m_broken;
+	uint64_t m_lostFrom, m_lostTo;
+
+	// Records in the journal since the last rotation.
+	size_t m_recordCount;
+
+	std::atomic<uint64_t> m_appendCount, m_syncCount, m_errorCount;
+
+	// Write out the pending records. Called with the lock held, which is
+	// released meanwhile.
+	bool flush(std::unique_lock<std::mutex> &lock){
+		std::string batch;
+		batch.swap(m_pending);
+
+		uint64_t const upto = m_queued;
+
+		if(m_broken){
+			m_durable = upto;
+			m_committed.notify_all();
+			return false;
+		}
+
+		m_busy = true;
+		lock.unlock();
+
+		bool const ok = batch.empty() || (ofdxWriteAll(m_fd, batch.data(), batch.size()) && (fdatasync(m_fd) == 0));
+
+		lock.lock();
+		m_busy = false;
+
+		if(ok){
+			m_durable = upto;
+
+			if(!batch.empty())
+				++ m_syncCount;
+		} else {
+			// Nothing more can be done for these records.
+			++ m_errorCount;
+			m_broken = true;
+			m_lostFrom = m_durable + 1;
+			m_durable = upto;
+			std::cerr << "Error: cannot write journal " << m_path << ": " << strerror(errno) << std::endl;
+		}
+
+		m_committed.notify_all();
+		return ok;
+	}
+
+public:
+	struct Stats {
+		uint64_t m_appends, m_syncs, m_errors;
+	};
+
+	OfdxJournal() :
+		m_fd(-1),
+		m_queued(0), m_durable(0),
+		m_busy(false),
+		m_broken(false), m_lostFrom(0), m_lostTo(0),
+		m_recordCount(0),
+		m_appendCount(0), m_syncCount(0), m_errorCount(0)
+	{}
+
+	~OfdxJournal(){
+		std::unique_lock<std::mutex> lock(m_mutex);
+
+		while(m_busy)
+			m_committed.wait(lock);
+
+		if(m_fd >= 0){
+			flush(lock);
+			close(m_fd);
+		}
+	}
+
+	OfdxJournal(OfdxJournal const&) = delete;
+	OfdxJournal& operator=(OfdxJournal const&) = delete;
+
+	// Open (creating if needed) the journal at path for appending.
+	bool open(std::string const& path){
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		m_path = path;
+		m_fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+
+		if(m_fd < 0){
+			std::cerr << "Error: cannot open journal " << path << ": " << strerror(errno) << std::endl;
+			return false;
+		}
+
+		return ofdxSyncParentDir(path);
+	}
+
+	// Queue a record, which must not contain line breaks. Returns the
+	// sequence number to pass to commit().
+	uint64_t append(std::string const& record){
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		m_pending += record;
+		m_pending += '\n';
+		++ m_recordCount;
+		++ m_appendCount;
+
+		return ++ m_queued;
+	}
+
+	// Wait until the record seq (and every one before it) is on disk. Returns
+	// false if it could not be written, in which case only a rotation and a
+	// new snapshot of the owner's state can make the change durable.
+	bool commit(uint64_t const seq){
+		std::unique_lock<std::mutex> lock(m_mutex);
+
+		while(m_durable < seq){
+			if(m_busy){
+				m_committed.wait(lock);
+			} else if(m_fd >= 0){
+				flush(lock);
+			} else {
+				return false;
+			}
+		}
+
+		return !(m_lostFrom && (seq >= m_lostFrom) && (m_broken || (seq <= m_lostTo)));
+	}
+
+	// Move the records written so far to rotatedPath (appending if it is
+	// still there from a compaction which did not finish), and start an empty
+	// journal. Records appended meanwhile may land in either, so the owner's
+	// snapshot must be taken after this returns; records it already covers
+	// are replayed over it, which idempotent records allow. This also ends
+	// the loss of records after a failed write, as the snapshot covers them.
+	bool rotate(std::string const& rotatedPath){
+		std::unique_lock<std::mutex> lock(m_mutex);
+
+		while(m_busy)
+			m_committed.wait(lock);
+
+		if(m_fd < 0)
+			return false;
+
+		flush(lock);
+
+		bool ok;
+
+		if(access(rotatedPath.c_str(), F_OK) == 0){
+			std::string data;
+			ofdxReadLines(m_path, [&](std::string const& line){ data += line; data += '\n'; });
+
+			int const fd = ::open(rotatedPath.c_str(), O_WRONLY | O_APPEND | O_CLOEXEC);
+			ok = (fd >= 0) && ofdxWriteAll(fd, data.data(), data.size()) && (fsync(fd) == 0);
+
+			if(fd >= 0)
+				close(fd);
+
+			ok = ok && (ftruncate(m_fd, 0) == 0) && (fsync(m_fd) == 0);
+		} else {
+			ok = (rename(m_path.c_str(), rotatedPath.c_str()) == 0);
+
+			if(ok){
+				close(m_fd);
+				m_fd = ::open(m_path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+				ok = (m_fd >= 0) && ofdxSyncParentDir(m_path);
+			}
+		}
+
+		if(ok){
+			m_recordCount = 0;
+
+			if(m_broken){
+				m_broken = false;
+				m_lostTo = m_durable;
+			}
+		} else
+			std::cerr << "Error: cannot rotate journal " << m_path << ": " << strerror(errno) << std::endl;
+
+		return ok;
+	}
+
+	// Records appended since the last rotation.
+	size_t recordCount(){
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_recordCount;
+	}
+
+	Stats stats() const {
+		return { m_appendCount.load(), m_syncCount.load(), m_errorCount.load() };
+	}
+};
+
+#endif
@@ -0,0 +1,119 @@
+/*
+   OFDX Bounded Lock-free MPMC Queue
+
+   Dmitry Vyukov's bounded queue: each cell carries a sequence number which
+   tells producers and consumers whose turn it is, so neither side takes a
+   lock. Capacity is rounded up to a power of two.
+*/
+
+#ifndef OFDX_MPMC_H
+#define OFDX_MPMC_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+
+template<typename T>
+class OfdxMpmcQueue {
+	struct Cell {
+		std::atomic<size_t> m_sequence;
+		T m_data;
+	};
+
+	// Keep the producer and consumer positions on separate cache lines.
+	static constexpr size_t CACHE_LINE = 64;
+
+	std::unique_ptr<Cell[]> m_cells;
+	size_t m_mask;
+
+	alignas(CACHE_LINE) std::atomic<size_t> m_enqueuePos;
+	alignas(CACHE_LINE) std::atomic<size_t> m_dequeuePos;
+
+public:
+	OfdxMpmcQueue(size_t capacity) :
+		m_enqueuePos(0), m_dequeuePos(0)
+	{
+		size_t size = 2;
+		while(size < capacity)
+			size <<= 1;
+
+		m_cells.reset(new Cell[size]);
+		m_mask = size - 1;
+
+		for(size_t i = 0; i < size; ++ i)
+			m_cells[i].m_sequence.store(i, std::memory_order_relaxed);
+	}
+
+	OfdxMpmcQueue(OfdxMpmcQueue const&) = delete;
+	OfdxMpmcQueue& operator=(OfdxMpmcQueue const&) = delete;
+
+	size_t capacity() const {
+		return m_mask + 1;
+	}
+
+	// Approximate number of queued items, for monitoring only.
+	size_t depth() const {
+		size_t const enq = m_enqueuePos.load(std::memory_order_relaxed);
+		size_t const deq = m_dequeuePos.load(std::memory_order_relaxed);
+
+		return (enq > deq) ? (enq - deq) : 0;
+	}
+
+	// Returns false if the queue is full, in which case value is untouched.
+	bool push(T &value){
+		size_t pos = m_enqueuePos.load(std::memory_order_relaxed);
+		Cell *cell;
+
+		while(true){
+			cell = &m_cells[pos & m_mask];
+
+			size_t const seq = cell->m_sequence.load(std::memory_order_acquire);
+			intptr_t const diff = (intptr_t) seq - (intptr_t) pos;
+
+			if(diff == 0){
+				if(m_enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+					break;
+			} else if(diff < 0){
+				return false;
+			} else {
+				pos = m_enqueuePos.load(std::memory_order_relaxed);
+			}
+		}
+
+		cell->m_data = std::move(value);
+		cell->m_sequence.store(pos + 1, std::memory_order_release);
+
+		return true;
+	}
+
+	// Returns false if the queue is empty.
+	bool pop(T &value){
+		size_t pos = m_dequeuePos.load(std::memory_order_relaxed);
+		Cell *cell;
+
+		while(true){
+			cell = &m_cells[pos & m_mask];
+
+			size_t const seq = cell->m_sequence.load(std::memory_order_acquire);
+			intptr_t const diff = (intptr_t) seq - (intptr_t) (pos + 1);
+
+			if(diff == 0){
+				if(m_dequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+					break;
+			} else if(diff < 0){
+				return false;
+			} else {
+				pos = m_dequeuePos.load(std::memory_order_relaxed);
+			}
+		}
+
+		value = std::move(cell->m_data);
+		cell->m_sequence.store(pos + m_mask + 1, std::memory_order_release);
+
+		return true;
+	}
+};
+
+#endif
@@ -0,0 +1,197 @@
+/*
+   OFDX Reservation
+
+   A reservation, the index of the reservations of an object, and the two
+   ways of filling such indexes at startup: importing the text format, and
+   indexing a mapped binary snapshot in place. The server and the snapshot
+   benchmark load through the same functions.
+
+   Text format, for import and export:
+     cluster9 1704479574 1704483174 abcd1234b64 mperron
+*/
+
+#ifndef OFDX_RESERVATION_H
+#define OFDX_RESERVATION_H
+
+#include "ofdx_interval_index.h"
+#include "ofdx_journal.h"
+#include "ofdx_session_table.h"
+#include "ofdx_snapshot.h"
+
+#include <ctime>
+#include <map>
+#include <memory>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Text which may stay where it is, in a mapping that outlives it, until it
+// is changed. Copies share the text they own.
+class OfdxInPlaceString {
+	std::string_view m_view;
+	std::shared_ptr<std::string const> m_owned;
+
+public:
+	OfdxInPlaceString() = default;
+
+	OfdxInPlaceString(std::string s) :
+		m_owned(std::make_shared<std::string const>(std::move(s)))
+	{
+		m_view = *m_owned;
+	}
+
+	OfdxInPlaceString(char const *s) :
+		OfdxInPlaceString(std::string(s))
+	{}
+
+	// s is not copied, so it must outlive this and every copy of it.
+	static OfdxInPlaceString inPlace(std::string_view const s){
+		OfdxInPlaceString result;
+		result.m_view = s;
+		return result;
+	}
+
+	operator std::string_view() const {
+		return m_view;
+	}
+
+	bool empty() const {
+		return m_view.empty();
+	}
+
+	bool operator==(std::string_view const s) const {
+		return m_view == s;
+	}
+
+	bool operator!=(std::string_view const s) const {
+		return m_view != s;
+	}
+};
+
+inline std::ostream& operator<<(std::ostream &os, OfdxInPlaceString const& s){
+	return os << std::string_view(s);
+}
+
+struct OfdxReservation {
+	// Interned in the session table of the owner.
+	OfdxSessionTable::Handle m_session;
+
+	OfdxInPlaceString m_info;
+	time_t m_start, m_end;
+
+	void debug(std::stringstream &ss){
+		ss << "m_session[" << m_session << "] m_info[" << m_info << "] "
+			<< "m_start[" << m_start << "] m_end[" << m_end << "] delta[" << m_end - m_start << "]\n";
+	}
+
+	OfdxReservation() :
+		m_session(OfdxSessionTable::NONE),
+		m_start(0),
+		m_end(0)
+	{}
+};
+
+// Reservations by [m_start, m_end], in order of m_start. The interval of an
+// entry must be updated along with its reservation.
+typedef OfdxIntervalIndex<time_t, std::shared_ptr<OfdxReservation>> OfdxReservations;
+
+// Parse a line of the text format into id, session and r, but for the
+// session of r. Returns false if it is not one, or its times are nonsense.
+static bool ofdxParseReservation(std::string const& line, std::string &id, std::string &session, OfdxReservation &r){
+	std::stringstream ss(line);
+
+	if(!(ss >> id >> r.m_start >> r.m_end >> session) || (r.m_end < r.m_start))
+		return false;
+
+	// The rest of the line, from its first word on.
+	std::string info, rest;
+
+	if(ss >> info){
+		if(getline(ss, rest))
+			info += rest;
+	}
+
+	r.m_info = std::move(info);
+	return true;
+}
+
+// Read the text format at path into the index which index(id) gives for
+// each object, or skip the object if it gives nullptr. Each index is filled
+// at once. Returns the number of reservations read.
+template<typename F>
+static size_t ofdxImportReservations(std::string const& path, OfdxSessionTable &sessions, F index){
+	std::map<OfdxReservations*, std::vector<OfdxReservations::Entry>> loaded;
+	size_t count = 0;
+
+	ofdxReadLines(path, [&](std::string const& line){
+		std::string id, session;
+		auto const r = std::make_shared<OfdxReservation>();
+
+		if(!ofdxParseReservation(line, id, session, *r))
+			return;
+
+		if(OfdxReservations *const reservations = index(id)){
+			r->m_session = sessions.intern(session);
+			loaded[reservations].push_back({ OfdxReservations::Interval(r->m_start, r->m_end), r });
+			++ count;
+		}
+	});
+
+	for(auto &kv : loaded)
+		kv.first->assign(std::move(kv.second));
+
+	return count;
+}
+
+// Index the records of a mapped snapshot in place. index(i) gives the index
+// for the snapshot's object i, or nullptr to skip it, and is called once for
+// each object in order. The sessions of the snapshot are attached to
+// sessions, so nothing is hashed. The reservations share one allocation,
+// which is freed once none of them is left, and their infos stay in the
+// mapping until they are changed; the snapshot must therefore outlive them
+// and the session table. Returns the number of reservations indexed.
+template<typename F>
+static size_t ofdxIndexSnapshot(OfdxSnapshotReader const& snapshot, OfdxSessionTable &sessions, F index){
+	sessions.attach(snapshot.sessionCount(), [&snapshot](size_t const i){ return snapshot.sessionName(i); });
+
+	// Never reallocated, as the entries point into it.
+	auto const block = std::make_shared<std::vector<OfdxReservation>>();
+	block->reserve(snapshot.recordCount());
+
+	size_t count = 0;
+
+	for(size_t i = 0; i < snapshot.objectCount(); ++ i){
+		OfdxReservations *const reservations = index(i);
+
+		if(!reservations)
+			continue;
+
+		size_t const n = snapshot.recordCount(i);
+		std::vector<OfdxReservations::Entry> entries;
+		entries.reserve(n);
+
+		for(size_t j = 0; j < n; ++ j){
+			auto const rec = snapshot.record(i, j);
+
+			if(rec.m_end < rec.m_start)
+				continue;
+
+			OfdxReservation &r = block->emplace_back();
+			r.m_start = rec.m_start;
+			r.m_end = rec.m_end;
+			r.m_session = sessions.attachedHandle(rec.m_session);
+			r.m_info = OfdxInPlaceString::inPlace(rec.m_info);
+
+			entries.push_back({ OfdxReservations::Interval(r.m_start, r.m_end), std::shared_ptr<OfdxReservation>(block, &r) });
+		}
+
+		count += entries.size();
+		reservations->assign(std::move(entries));
+	}
+
+	return count;
+}
+
+#endif
@@ -0,0 +1,194 @@
+/*
+   OFDX Session Table
+
+   Interns session IDs into 32-bit handles, so that a reservation keeps four
+   bytes rather than a copy of the ID, and telling whose it is takes an
+   integer compare. Handles are never reused or renumbered, so they may be
+   kept anywhere for as long as the table lives. The table grows by one entry
+   for each session which ever held a reservation.
+
+   The sessions of a snapshot are adopted in place with attach(): they are
+   looked up by a binary search over the snapshot's sorted names rather than
+   hashed, so loading costs nothing per session.
+
+   OPEN is the handle of the unclaimed time a cancelation leaves behind, and
+   NONE that of a session which holds nothing, so it matches no reservation.
+*/
+
+#ifndef OFDX_SESSION_TABLE_H
+#define OFDX_SESSION_TABLE_H
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+class OfdxSessionTable {
+public:
+	typedef uint32_t Handle;
+
+	static constexpr Handle OPEN = 0;
+	static constexpr Handle NONE = UINT32_MAX;
+
+	// Name of the attached session at an index.
+	typedef std::function<std::string_view(size_t)> AttachedName;
+
+private:
+	mutable std::shared_mutex m_mutex;
+
+	// Names by handle, apart from the attached ones. A deque never moves its
+	// elements, so the views in m_handles stay valid as it grows.
+	std::deque<std::string> m_names;
+	std::unordered_map<std::string_view, Handle> m_handles;
+
+	// Attached sessions have the handles from m_attachedFirst on, except for
+	// those interned before, which keep their handles (m_aliases). Set once
+	// by attach(), before the table is shared between threads, so they are
+	// read without the lock.
+	AttachedName m_attachedName;
+	size_t m_attachedCount;
+	Handle m_attachedFirst;
+	std::vector<std::pair<size_t, Handle>> m_aliases;
+
+	// Index of name among the attached sessions, or m_attachedCount.
+	size_t findAttached(std::string_view const name) const {
+		size_t lo = 0, hi = m_attachedCount;
+
+		while(lo < hi){
+			size_t const mid = lo + (hi - lo) / 2;
+
+			if(m_attachedName(mid) < name)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+
+		return ((lo < m_attachedCount) && (m_attachedName(lo) == name)) ? lo : m_attachedCount;
+	}
+
+	Handle handleOfAttached(size_t const i) const {
+		for(auto const& alias : m_aliases){
+			if(alias.first == i)
+				return alias.second;
+		}
+
+		return m_attachedFirst + i;
+	}
+
+	Handle findLocked(std::string_view const name) const {
+		auto const it = m_handles.find(name);
+
+		if(it != m_handles.end())
+			return it->second;
+
+		size_t const i = findAttached(name);
+		return (i < m_attachedCount) ? handleOfAttached(i) : NONE;
+	}
+
+public:
+	// openName is how OPEN is spelled in the reservation files.
+	explicit OfdxSessionTable(std::string_view const openName) :
+		m_attachedCount(0),
+		m_attachedFirst(0)
+	{
+		intern(openName);
+	}
+
+	OfdxSessionTable(OfdxSessionTable const&) = delete;
+	OfdxSessionTable& operator=(OfdxSessionTable const&) = delete;
+
+	// Adopt count sessions, whose names name(i) gives in order and without
+	// duplicates. The names must stay valid for as long as the table lives.
+	// Allowed once, before anything but openName is interned.
+	void attach(size_t const count, AttachedName name){
+		std::unique_lock<std::shared_mutex> lock(m_mutex);
+
+		m_attachedName = std::move(name);
+		m_attachedCount = count;
+		m_attachedFirst = m_names.size();
+
+		for(Handle h = 0; h < m_names.size(); ++ h){
+			size_t const i = findAttached(m_names[h]);
+
+			if(i < m_attachedCount)
+				m_aliases.push_back({ i, h });
+		}
+	}
+
+	// Handle of the attached session at index i.
+	Handle attachedHandle(size_t const i) const {
+		return handleOfAttached(i);
+	}
+
+	// Index of the attached session with handle h, or attachedCount() if it
+	// is not one.
+	size_t attachedIndex(Handle const h) const {
+		if((h >= m_attachedFirst) && (h - m_attachedFirst < m_attachedCount))
+			return h - m_attachedFirst;
+
+		for(auto const& alias : m_aliases){
+			if(alias.second == h)
+				return alias.first;
+		}
+
+		return m_attachedCount;
+	}
+
+	size_t attachedCount() const {
+		return m_attachedCount;
+	}
+
+	// Handle of name, or NONE if it has never been interned.
+	Handle find(std::string_view const name) const {
+		std::shared_lock<std::shared_mutex> lock(m_mutex);
+		return findLocked(name);
+	}
+
+	// Handle of name, which is added if it is new.
+	Handle intern(std::string_view const name){
+		Handle const found = find(name);
+
+		if(found != NONE)
+			return found;
+
+		std::unique_lock<std::shared_mutex> lock(m_mutex);
+
+		if(Handle const h = findLocked(name); h != NONE)
+			return h;
+
+		// Past the attached sessions, if any.
+		Handle const h = m_names.size() + m_attachedCount;
+
+		m_names.emplace_back(name);
+		m_handles.emplace(m_names.back(), h);
+
+		return h;
+	}
+
+	// Name of a handle from this table, or an empty view for NONE.
+	std::string_view name(Handle const h) const {
+		std::shared_lock<std::shared_mutex> lock(m_mutex);
+
+		if(h < m_attachedFirst)
+			return std::string_view(m_names[h]);
+
+		if(h - m_attachedFirst < m_attachedCount)
+			return m_attachedName(h - m_attachedFirst);
+
+		size_t const i = h - m_attachedCount;
+		return (i < m_names.size()) ? std::string_view(m_names[i]) : std::string_view();
+	}
+
+	size_t size() const {
+		std::shared_lock<std::shared_mutex> lock(m_mutex);
+		return m_names.size() + m_attachedCount - m_aliases.size();
+	}
+};
+
+#endif
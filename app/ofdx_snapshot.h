@@ -0,0 +1,459 @@
+/*
+   OFDX Binary Snapshot
+
+   A versioned snapshot of reservations, laid out to be used in place once
+   it is mapped into memory:
+
+     Header        magic, version, byte order, counts, checksum
+     Objects       { id, first record, record count }, one per object
+     Records       { start, end, session, info }, fixed width, grouped by
+                   object and in order of start within each group
+     Sessions      { name, first held, held count }, in order of name, so
+                   that a session is found by a binary search
+     Held          { start, object }, the records of each session, grouped
+                   by session and in order of start within each group
+     Strings       the ids, session names and infos the tables point into
+
+   Loading is a bounds check and a checksum pass over the mapping, after
+   which the records are read directly. Nothing is parsed, and nothing needs
+   to be copied for as long as the mapping is kept.
+*/
+
+#ifndef OFDX_SNAPSHOT_H
+#define OFDX_SNAPSHOT_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+struct OfdxSnapshotFormat {
+	static constexpr char MAGIC[8] = { 'O', 'F', 'D', 'X', 'B', 'K', 'S', 'N' };
+	static constexpr uint32_t VERSION = 2;
+	static constexpr uint32_t ORDER_MARK = 0x01020304;
+
+	struct Header {
+		char m_magic[8];
+		uint32_t m_version;
+		uint32_t m_byteOrder;
+		uint64_t m_objectCount;
+		uint64_t m_recordCount;
+		uint64_t m_sessionCount;
+		uint64_t m_stringsSize;
+
+		// Of everything after the header.
+		uint64_t m_checksum;
+	};
+
+	// A string in the string table.
+	struct Str {
+		uint32_t m_offset;
+		uint32_t m_size;
+	};
+
+	struct Object {
+		Str m_id;
+		uint32_t m_reserved;
+		uint32_t m_recordCount;
+		uint64_t m_firstRecord;
+	};
+
+	struct Record {
+		int64_t m_start;
+		int64_t m_end;
+
+		// Index into the session table.
+		uint32_t m_session;
+		uint32_t m_reserved;
+
+		Str m_info;
+	};
+
+	struct Session {
+		Str m_name;
+		uint32_t m_reserved;
+		uint32_t m_heldCount;
+		uint64_t m_firstHeld;
+	};
+
+	struct Held {
+		int64_t m_start;
+
+		// Index into the object table.
+		uint32_t m_object;
+		uint32_t m_reserved;
+	};
+
+	// Not a cryptographic hash; it only has to catch torn and damaged files,
+	// at memory speed. FNV-1a over 64-bit words in four interleaved lanes, so
+	// that the multiplications overlap, then over the tail.
+	static uint64_t checksum(char const *data, size_t size){
+		uint64_t constexpr basis = 0xcbf29ce484222325ULL, prime = 0x100000001b3ULL;
+		uint64_t lanes[4] = { basis, basis + 1, basis + 2, basis + 3 };
+
+		for(; size >= 32; data += 32, size -= 32){
+			uint64_t words[4];
+			memcpy(words, data, 32);
+
+			for(int i = 0; i < 4; ++ i)
+				lanes[i] = (lanes[i] ^ words[i]) * prime;
+		}
+
+		uint64_t h = basis;
+
+		for(uint64_t const lane : lanes)
+			h = (h ^ lane) * prime;
+
+		for(; size; ++ data, -- size)
+			h = (h ^ (unsigned char) *data) * prime;
+
+		return h;
+	}
+};
+
+static_assert(sizeof(OfdxSnapshotFormat::Header) == 56, "snapshot header layout");
+static_assert(sizeof(OfdxSnapshotFormat::Object) == 24, "snapshot object layout");
+static_assert(sizeof(OfdxSnapshotFormat::Record) == 32, "snapshot record layout");
+static_assert(sizeof(OfdxSnapshotFormat::Session) == 24, "snapshot session layout");
+static_assert(sizeof(OfdxSnapshotFormat::Held) == 16, "snapshot held layout");
+
+// Builds a snapshot. Add each object, then its records in order of start.
+class OfdxSnapshotWriter {
+	typedef OfdxSnapshotFormat F;
+
+	std::vector<F::Object> m_objects;
+	std::vector<F::Record> m_records;
+	std::string m_strings;
+
+	// Sessions in order of first use, which m_session of each record indexes
+	// until finish() puts them in order of name.
+	std::unordered_map<std::string, uint32_t> m_sessionIndex;
+	std::vector<std::string const*> m_sessionNames;
+
+	F::Str addString(std::string_view s){
+		F::Str const result = { (uint32_t) m_strings.size(), (uint32_t) s.size() };
+		m_strings.append(s);
+		return result;
+	}
+
+	template<typename T>
+	static void append(std::string &out, std::vector<T> const& table){
+		out.append((char const*) table.data(), table.size() * sizeof(T));
+	}
+
+public:
+	void addObject(std::string_view id){
+		F::Object o = {};
+		o.m_id = addString(id);
+		o.m_firstRecord = m_records.size();
+		m_objects.push_back(o);
+	}
+
+	void addRecord(int64_t start, int64_t end, std::string_view session, std::string_view info){
+		auto const it = m_sessionIndex.emplace(std::string(session), (uint32_t) m_sessionNames.size()).first;
+
+		if(it->second == m_sessionNames.size())
+			m_sessionNames.push_back(&it->first);
+
+		F::Record r = {};
+		r.m_start = start;
+		r.m_end = end;
+		r.m_session = it->second;
+		r.m_info = addString(info);
+		m_records.push_back(r);
+		++ m_objects.back().m_recordCount;
+	}
+
+	// The complete file.
+	std::string finish() const {
+		// Sessions in order of name, and where each one went.
+		std::vector<uint32_t> byName(m_sessionNames.size()), rank(m_sessionNames.size());
+
+		for(uint32_t i = 0; i < byName.size(); ++ i)
+			byName[i] = i;
+
+		std::sort(byName.begin(), byName.end(), [&](uint32_t const a, uint32_t const b){
+			return *m_sessionNames[a] < *m_sessionNames[b];
+		});
+
+		std::string strings(m_strings);
+		std::vector<F::Session> sessions(byName.size());
+
+		for(uint32_t i = 0; i < byName.size(); ++ i){
+			rank[byName[i]] = i;
+			sessions[i].m_name = { (uint32_t) strings.size(), (uint32_t) m_sessionNames[byName[i]]->size() };
+			strings.append(*m_sessionNames[byName[i]]);
+		}
+
+		std::vector<F::Record> records(m_records);
+
+		for(auto &r : records){
+			r.m_session = rank[r.m_session];
+			++ sessions[r.m_session].m_heldCount;
+		}
+
+		// Held entries grouped by session, then sorted within each group.
+		uint64_t first = 0;
+
+		for(auto &s : sessions){
+			s.m_firstHeld = first;
+			first += s.m_heldCount;
+		}
+
+		std::vector<F::Held> held(records.size());
+		std::vector<uint64_t> next(sessions.size());
+
+		for(size_t i = 0; i < sessions.size(); ++ i)
+			next[i] = sessions[i].m_firstHeld;
+
+		for(uint32_t o = 0; o < m_objects.size(); ++ o){
+			for(uint64_t i = 0; i < m_objects[o].m_recordCount; ++ i){
+				F::Record const& r = records[m_objects[o].m_firstRecord + i];
+				F::Held &h = held[next[r.m_session] ++];
+				h.m_start = r.m_start;
+				h.m_object = o;
+			}
+		}
+
+		for(auto const& s : sessions){
+			std::sort(held.begin() + s.m_firstHeld, held.begin() + s.m_firstHeld + s.m_heldCount, [](F::Held const& a, F::Held const& b){
+				return (a.m_start != b.m_start) ? (a.m_start < b.m_start) : (a.m_object < b.m_object);
+			});
+		}
+
+		F::Header h = {};
+		memcpy(h.m_magic, F::MAGIC, sizeof(h.m_magic));
+		h.m_version = F::VERSION;
+		h.m_byteOrder = F::ORDER_MARK;
+		h.m_objectCount = m_objects.size();
+		h.m_recordCount = records.size();
+		h.m_sessionCount = sessions.size();
+		h.m_stringsSize = strings.size();
+
+		std::string out(sizeof(h), '\0');
+		append(out, m_objects);
+		append(out, records);
+		append(out, sessions);
+		append(out, held);
+		out.append(strings);
+
+		h.m_checksum = F::checksum(out.data() + sizeof(h), out.size() - sizeof(h));
+		memcpy(&out[0], &h, sizeof(h));
+
+		return out;
+	}
+};
+
+// A snapshot mapped into memory. What it hands out points into the mapping,
+// and is valid for as long as the reader is.
+class OfdxSnapshotReader {
+	typedef OfdxSnapshotFormat F;
+
+	void *m_map;
+	size_t m_size;
+
+	F::Header m_header;
+	F::Object const *m_objects;
+	F::Record const *m_records;
+	F::Session const *m_sessions;
+	F::Held const *m_held;
+	char const *m_strings;
+
+	std::string m_error;
+
+	bool fail(char const *error){
+		m_error = error;
+		return false;
+	}
+
+	bool validate(){
+		if(m_size < sizeof(F::Header))
+			return fail("truncated header");
+
+		char const *base = (char const*) m_map;
+		memcpy(&m_header, base, sizeof(m_header));
+
+		if(memcmp(m_header.m_magic, F::MAGIC, sizeof(F::MAGIC)))
+			return fail("not a snapshot");
+
+		if(m_header.m_version != F::VERSION)
+			return fail("unsupported version");
+
+		if(m_header.m_byteOrder != F::ORDER_MARK)
+			return fail("written on a machine of another byte order");
+
+		// Each table must fit in what is left, without overflowing. There is
+		// a held entry for each record.
+		size_t left = m_size - sizeof(F::Header);
+
+		if(m_header.m_objectCount > left / sizeof(F::Object))
+			return fail("truncated object table");
+		left -= m_header.m_objectCount * sizeof(F::Object);
+
+		if(m_header.m_recordCount > left / (sizeof(F::Record) + sizeof(F::Held)))
+			return fail("truncated record table");
+		left -= m_header.m_recordCount * (sizeof(F::Record) + sizeof(F::Held));
+
+		if(m_header.m_sessionCount > left / sizeof(F::Session))
+			return fail("truncated session table");
+		left -= m_header.m_sessionCount * sizeof(F::Session);
+
+		if(m_header.m_stringsSize != left)
+			return fail("wrong size");
+
+		if(F::checksum(base + sizeof(F::Header), m_size - sizeof(F::Header)) != m_header.m_checksum)
+			return fail("checksum mismatch");
+
+		m_objects = (F::Object const*) (base + sizeof(F::Header));
+		m_records = (F::Record const*) (m_objects + m_header.m_objectCount);
+		m_sessions = (F::Session const*) (m_records + m_header.m_recordCount);
+		m_held = (F::Held const*) (m_sessions + m_header.m_sessionCount);
+		m_strings = (char const*) (m_held + m_header.m_recordCount);
+
+		// So that the accessors need no checks.
+		for(uint64_t i = 0; i < m_header.m_objectCount; ++ i){
+			F::Object const& o = m_objects[i];
+
+			if(!inStrings(o.m_id) || (o.m_firstRecord > m_header.m_recordCount) || (o.m_recordCount > m_header.m_recordCount - o.m_firstRecord))
+				return fail("object out of bounds");
+		}
+
+		for(uint64_t i = 0; i < m_header.m_recordCount; ++ i){
+			if((m_records[i].m_session >= m_header.m_sessionCount) || !inStrings(m_records[i].m_info))
+				return fail("record out of bounds");
+
+			if(m_held[i].m_object >= m_header.m_objectCount)
+				return fail("held entry out of bounds");
+		}
+
+		for(uint64_t i = 0; i < m_header.m_sessionCount; ++ i){
+			F::Session const& s = m_sessions[i];
+
+			if(!inStrings(s.m_name) || (s.m_firstHeld > m_header.m_recordCount) || (s.m_heldCount > m_header.m_recordCount - s.m_firstHeld))
+				return fail("session out of bounds");
+		}
+
+		return true;
+	}
+
+	bool inStrings(F::Str const& s) const {
+		return (s.m_offset <= m_header.m_stringsSize) && (s.m_size <= m_header.m_stringsSize - s.m_offset);
+	}
+
+	std::string_view str(F::Str const& s) const {
+		return std::string_view(m_strings + s.m_offset, s.m_size);
+	}
+
+public:
+	struct Record {
+		int64_t m_start, m_end;
+
+		// Index of the session, for sessionName().
+		uint32_t m_session;
+
+		std::string_view m_info;
+	};
+
+	struct Held {
+		int64_t m_start;
+
+		// Index of the object, for objectId() and record().
+		uint32_t m_object;
+	};
+
+	OfdxSnapshotReader() :
+		m_map(nullptr), m_size(0), m_header(),
+		m_objects(nullptr), m_records(nullptr), m_sessions(nullptr), m_held(nullptr), m_strings(nullptr)
+	{}
+
+	~OfdxSnapshotReader(){
+		if(m_map)
+			munmap(m_map, m_size);
+	}
+
+	OfdxSnapshotReader(OfdxSnapshotReader const&) = delete;
+	OfdxSnapshotReader& operator=(OfdxSnapshotReader const&) = delete;
+
+	// Map and validate the snapshot at path. On failure, error() tells why.
+	bool open(std::string const& path){
+		int const fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+
+		if(fd < 0)
+			return fail("cannot open");
+
+		struct stat st;
+		bool ok = (fstat(fd, &st) == 0);
+
+		if(ok && st.st_size > 0){
+			m_size = st.st_size;
+			m_map = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+
+			if(m_map == MAP_FAILED){
+				m_map = nullptr;
+				ok = false;
+			}
+		}
+
+		close(fd);
+
+		if(!ok)
+			return fail("cannot map");
+
+		return validate();
+	}
+
+	std::string const& error() const {
+		return m_error;
+	}
+
+	size_t objectCount() const {
+		return m_header.m_objectCount;
+	}
+
+	std::string_view objectId(size_t i) const {
+		return str(m_objects[i].m_id);
+	}
+
+	// Of all the objects.
+	size_t recordCount() const {
+		return m_header.m_recordCount;
+	}
+
+	size_t recordCount(size_t object) const {
+		return m_objects[object].m_recordCount;
+	}
+
+	Record record(size_t object, size_t i) const {
+		F::Record const& r = m_records[m_objects[object].m_firstRecord + i];
+		return { r.m_start, r.m_end, r.m_session, str(r.m_info) };
+	}
+
+	size_t sessionCount() const {
+		return m_header.m_sessionCount;
+	}
+
+	// Names are in order, and each appears once.
+	std::string_view sessionName(size_t i) const {
+		return str(m_sessions[i].m_name);
+	}
+
+	size_t heldCount(size_t session) const {
+		return m_sessions[session].m_heldCount;
+	}
+
+	// The records of a session, in order of start.
+	Held held(size_t session, size_t i) const {
+		F::Held const& h = m_held[m_sessions[session].m_firstHeld + i];
+		return { h.m_start, h.m_object };
+	}
+};
+
+#endif
@@ -0,0 +1,165 @@
+/*
+   OFDX Templates
+
+   A document with "<?ofdx some text>" tags, compiled once into a flat list of
+   literal spans and slots, so that rendering is a run of writes with a call
+   for each slot. A tag may span lines; one without its closing '>' is kept
+   as literal text.
+
+   OfdxTemplateCache keeps the compiled documents by path, and compiles a
+   document again when its file changes (by mtime, size or inode).
+*/
+
+#ifndef OFDX_TEMPLATE_H
+#define OFDX_TEMPLATE_H
+
+#include <cerrno>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+class OfdxTemplate {
+	struct Part {
+		// A span of m_text, or the text of a tag (without "<?ofdx" and '>').
+		size_t m_offset, m_size;
+		bool m_slot;
+	};
+
+	std::string m_text;
+	std::vector<Part> m_parts;
+
+	// The text of each slot, in order, so rendering does not copy them.
+	std::vector<std::string> m_slots;
+
+public:
+	explicit OfdxTemplate(std::string text) :
+		m_text(std::move(text))
+	{
+		static char const KEY[] = "<?ofdx";
+		size_t const keyLength = sizeof(KEY) - 1;
+
+		size_t literal = 0;
+
+		for(size_t a; (a = m_text.find(KEY, literal)) != std::string::npos;){
+			size_t const b = m_text.find('>', a + keyLength);
+
+			if(b == std::string::npos)
+				break;
+
+			if(a > literal)
+				m_parts.push_back({ literal, a - literal, false });
+
+			m_parts.push_back({ a + keyLength, b - a - keyLength, true });
+			m_slots.emplace_back(m_text, a + keyLength, b - a - keyLength);
+
+			literal = b + 1;
+		}
+
+		if(literal < m_text.size())
+			m_parts.push_back({ literal, m_text.size() - literal, false });
+	}
+
+	// Write the document to os, calling fill(std::string const& text) for
+	// each tag in its place.
+	template<typename F>
+	void render(std::ostream &os, F fill) const {
+		size_t slot = 0;
+
+		for(auto const& part : m_parts){
+			if(part.m_slot)
+				fill(m_slots[slot ++]);
+			else
+				os.write(m_text.data() + part.m_offset, part.m_size);
+		}
+	}
+};
+
+class OfdxTemplateCache {
+	struct Entry {
+		std::shared_ptr<OfdxTemplate const> m_template;
+		struct timespec m_mtime;
+		off_t m_size;
+		ino_t m_inode;
+		dev_t m_device;
+	};
+
+	std::mutex m_mutex;
+	std::unordered_map<std::string, Entry> m_entries;
+
+	static bool same(Entry const& e, struct stat const& st){
+		return (e.m_mtime.tv_sec == st.st_mtim.tv_sec) && (e.m_mtime.tv_nsec == st.st_mtim.tv_nsec) &&
+			(e.m_size == st.st_size) && (e.m_inode == st.st_ino) && (e.m_device == st.st_dev);
+	}
+
+public:
+	// The compiled document at path, or null if it cannot be read.
+	std::shared_ptr<OfdxTemplate const> get(std::string const& path){
+		struct stat st;
+
+		if(stat(path.c_str(), &st) != 0){
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_entries.erase(path);
+			return nullptr;
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			auto const it = m_entries.find(path);
+
+			if((it != m_entries.end()) && same(it->second, st))
+				return it->second.m_template;
+		}
+
+		// Compile the file as it was opened, whatever happens to the path.
+		int const fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+
+		if(fd < 0)
+			return nullptr;
+
+		std::string text;
+		bool ok = (fstat(fd, &st) == 0);
+
+		if(ok){
+			text.resize(st.st_size);
+
+			for(size_t done = 0; ok && (done < text.size());){
+				ssize_t const n = read(fd, &text[done], text.size() - done);
+
+				if(n > 0){
+					done += n;
+				} else if(n == 0){
+					// Truncated meanwhile.
+					text.resize(done);
+				} else if(errno != EINTR){
+					ok = false;
+				}
+			}
+		}
+
+		close(fd);
+
+		if(!ok)
+			return nullptr;
+
+		Entry e;
+		e.m_template = std::make_shared<OfdxTemplate const>(std::move(text));
+		e.m_mtime = st.st_mtim;
+		e.m_size = st.st_size;
+		e.m_inode = st.st_ino;
+		e.m_device = st.st_dev;
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_entries[path] = e;
+
+		return e.m_template;
+	}
+};
+
+#endif
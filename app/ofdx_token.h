@@ -0,0 +1,377 @@
+/*
+   OFDX Session Tokens
+
+   Random tokens for session cookies. Each thread keeps a ChaCha20 generator
+   seeded once with getrandom(), and hands out bytes from a buffer of several
+   blocks. Every refill takes the start of the new output as the next key and
+   bytes are wiped as they are handed out, so a later look at memory does not
+   reveal earlier tokens.
+
+   Tokens are a fixed number of random bytes in URL-safe base64 without
+   padding, built in place with no allocation. OfdxTokenSigner adds a SipHash
+   tag under a key of the server's, so a token can be checked without looking
+   anything up.
+*/
+
+#ifndef OFDX_TOKEN_H
+#define OFDX_TOKEN_H
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <system_error>
+
+#include <fcntl.h>
+#include <sys/random.h>
+#include <unistd.h>
+
+class OfdxRandom {
+	// Blocks of output per refill.
+	static constexpr size_t BLOCKS = 8;
+
+	uint32_t m_key[8];
+	uint8_t m_buffer[BLOCKS * 64];
+	size_t m_used;
+
+	static uint32_t rotl(uint32_t const v, int const n){
+		return (v << n) | (v >> (32 - n));
+	}
+
+	static void quarterRound(uint32_t *x, int const a, int const b, int const c, int const d){
+		x[a] += x[b]; x[d] = rotl(x[d] ^ x[a], 16);
+		x[c] += x[d]; x[b] = rotl(x[b] ^ x[c], 12);
+		x[a] += x[b]; x[d] = rotl(x[d] ^ x[a], 8);
+		x[c] += x[d]; x[b] = rotl(x[b] ^ x[c], 7);
+	}
+
+	// One ChaCha20 block (RFC 8439) of the key at the counter, with a zero
+	// nonce.
+	static void block(uint32_t const *key, uint32_t const counter, uint8_t *out){
+		uint32_t const init[16] = {
+			0x61707865, 0x3320646e, 0x79622d32, 0x6b206574,
+			key[0], key[1], key[2], key[3], key[4], key[5], key[6], key[7],
+			counter, 0, 0, 0
+		};
+		uint32_t x[16];
+
+		memcpy(x, init, sizeof(x));
+
+		for(int i = 0; i < 10; ++ i){
+			quarterRound(x, 0, 4, 8, 12);
+			quarterRound(x, 1, 5, 9, 13);
+			quarterRound(x, 2, 6, 10, 14);
+			quarterRound(x, 3, 7, 11, 15);
+			quarterRound(x, 0, 5, 10, 15);
+			quarterRound(x, 1, 6, 11, 12);
+			quarterRound(x, 2, 7, 8, 13);
+			quarterRound(x, 3, 4, 9, 14);
+		}
+
+		for(int i = 0; i < 16; ++ i){
+			uint32_t const v = x[i] + init[i];
+
+			out[i * 4] = v;
+			out[i * 4 + 1] = v >> 8;
+			out[i * 4 + 2] = v >> 16;
+			out[i * 4 + 3] = v >> 24;
+		}
+	}
+
+	// Read n bytes from the kernel. Throws if there is no way to.
+	static void seed(void *const dst, size_t const n){
+		uint8_t *const p = (uint8_t*) dst;
+		size_t done = 0;
+
+		while(done < n){
+			ssize_t const got = getrandom(p + done, n - done, 0);
+
+			if(got > 0){
+				done += got;
+			} else if(errno == ENOSYS){
+				break;
+			} else if(errno != EINTR){
+				throw std::system_error(errno, std::generic_category(), "getrandom");
+			}
+		}
+
+		// Kernels older than getrandom() still have the device.
+		if(done < n){
+			int const fd = open("/dev/urandom", O_RDONLY | O_CLOEXEC);
+
+			while((fd >= 0) && (done < n)){
+				ssize_t const got = read(fd, p + done, n - done);
+
+				if(got > 0)
+					done += got;
+				else if((got == 0) || (errno != EINTR))
+					break;
+			}
+
+			if(fd >= 0)
+				close(fd);
+
+			if(done < n)
+				throw std::system_error(errno, std::generic_category(), "/dev/urandom");
+		}
+	}
+
+	void refill(){
+		for(size_t i = 0; i < BLOCKS; ++ i)
+			block(m_key, i, m_buffer + i * 64);
+
+		// The first 32 bytes become the next key, and are never handed out.
+		for(int i = 0; i < 8; ++ i){
+			uint8_t const* b = m_buffer + i * 4;
+			m_key[i] = b[0] | (b[1] << 8) | (b[2] << 16) | ((uint32_t) b[3] << 24);
+		}
+
+		memset(m_buffer, 0, sizeof(m_key));
+		m_used = sizeof(m_key);
+	}
+
+	OfdxRandom(){
+		seed(m_key, sizeof(m_key));
+		refill();
+	}
+
+	static OfdxRandom& local(){
+		thread_local OfdxRandom random;
+		return random;
+	}
+
+public:
+	// Fill dst with n random bytes.
+	static void fill(void *const dst, size_t n){
+		OfdxRandom &r = local();
+		uint8_t *p = (uint8_t*) dst;
+
+		while(n){
+			if(r.m_used == sizeof(r.m_buffer))
+				r.refill();
+
+			size_t const take = std::min(n, sizeof(r.m_buffer) - r.m_used);
+
+			memcpy(p, r.m_buffer + r.m_used, take);
+			memset(r.m_buffer + r.m_used, 0, take);
+
+			r.m_used += take;
+			p += take;
+			n -= take;
+		}
+	}
+};
+
+// A token of BYTES bytes, as URL-safe base64 without padding.
+template<size_t BYTES>
+class OfdxToken {
+public:
+	static constexpr size_t LENGTH = (BYTES * 4 + 2) / 3;
+
+private:
+	char m_text[LENGTH];
+
+public:
+	explicit OfdxToken(uint8_t const *bytes){
+		static char const ALPHABET[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+		size_t out = 0;
+
+		for(size_t i = 0; i < BYTES; i += 3){
+			uint32_t v = bytes[i] << 16;
+
+			if(i + 1 < BYTES)
+				v |= bytes[i + 1] << 8;
+
+			if(i + 2 < BYTES)
+				v |= bytes[i + 2];
+
+			for(int k = 0; (k < 4) && (out < LENGTH); ++ k)
+				m_text[out ++] = ALPHABET[(v >> (18 - k * 6)) & 63];
+		}
+	}
+
+	// A token of fresh random bytes.
+	static OfdxToken random(){
+		uint8_t bytes[BYTES];
+
+		OfdxRandom::fill(bytes, BYTES);
+		return OfdxToken(bytes);
+	}
+
+	// Decode text, which must be a token of this length, into bytes.
+	static bool decode(std::string_view const text, uint8_t *bytes){
+		auto const value = [](char const c) -> int {
+			if((c >= 'A') && (c <= 'Z'))
+				return c - 'A';
+
+			if((c >= 'a') && (c <= 'z'))
+				return c - 'a' + 26;
+
+			if((c >= '0') && (c <= '9'))
+				return c - '0' + 52;
+
+			return (c == '-') ? 62 : (c == '_') ? 63 : -1;
+		};
+
+		if(text.size() != LENGTH)
+			return false;
+
+		uint32_t acc = 0;
+		int bits = 0;
+		size_t out = 0;
+
+		for(char const c : text){
+			int const v = value(c);
+
+			if(v < 0)
+				return false;
+
+			acc = (acc << 6) | v;
+			bits += 6;
+
+			if(bits >= 8){
+				bits -= 8;
+				bytes[out ++] = acc >> bits;
+			}
+		}
+
+		// Unused low bits must be zero, so that each token has one spelling.
+		return (out == BYTES) && !(acc & ((1u << bits) - 1));
+	}
+
+	std::string_view view() const {
+		return std::string_view(m_text, LENGTH);
+	}
+};
+
+// Tokens of 16 random bytes and an 8 byte SipHash-2-4 tag of them.
+class OfdxTokenSigner {
+	static constexpr size_t RANDOM_BYTES = 16;
+
+	uint64_t m_k0, m_k1;
+
+	static uint64_t rotl(uint64_t const v, int const n){
+		return (v << n) | (v >> (64 - n));
+	}
+
+	static uint64_t load64(uint8_t const *b){
+		uint64_t v = 0;
+
+		for(int i = 7; i >= 0; -- i)
+			v = (v << 8) | b[i];
+
+		return v;
+	}
+
+	uint64_t tag(uint8_t const *data, size_t const n) const {
+		uint64_t v0 = m_k0 ^ 0x736f6d6570736575ull;
+		uint64_t v1 = m_k1 ^ 0x646f72616e646f6dull;
+		uint64_t v2 = m_k0 ^ 0x6c7967656e657261ull;
+		uint64_t v3 = m_k1 ^ 0x7465646279746573ull;
+
+		auto const round = [&](){
+			v0 += v1; v1 = rotl(v1, 13); v1 ^= v0; v0 = rotl(v0, 32);
+			v2 += v3; v3 = rotl(v3, 16); v3 ^= v2;
+			v0 += v3; v3 = rotl(v3, 21); v3 ^= v0;
+			v2 += v1; v1 = rotl(v1, 17); v1 ^= v2; v2 = rotl(v2, 32);
+		};
+
+		auto const compress = [&](uint64_t const m){
+			v3 ^= m;
+			round();
+			round();
+			v0 ^= m;
+		};
+
+		size_t i = 0;
+
+		for(; i + 8 <= n; i += 8)
+			compress(load64(data + i));
+
+		uint64_t last = (uint64_t) n << 56;
+
+		for(size_t k = 0; i + k < n; ++ k)
+			last |= (uint64_t) data[i + k] << (k * 8);
+
+		compress(last);
+
+		v2 ^= 0xff;
+
+		for(int k = 0; k < 4; ++ k)
+			round();
+
+		return v0 ^ v1 ^ v2 ^ v3;
+	}
+
+public:
+	typedef OfdxToken<RANDOM_BYTES + 8> Token;
+
+	OfdxTokenSigner() :
+		m_k0(0), m_k1(0)
+	{}
+
+	// Load the key from path, or create it there with a fresh random key.
+	// Returns false if neither works.
+	bool open(std::string const& path){
+		uint8_t key[16];
+		int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+		bool ok = false;
+
+		if(fd >= 0){
+			ok = (read(fd, key, sizeof(key)) == sizeof(key));
+			close(fd);
+		} else if(errno == ENOENT){
+			fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+
+			if(fd >= 0){
+				OfdxRandom::fill(key, sizeof(key));
+				ok = (write(fd, key, sizeof(key)) == sizeof(key)) && (fsync(fd) == 0);
+				close(fd);
+
+				if(!ok)
+					unlink(path.c_str());
+			}
+		}
+
+		if(ok){
+			m_k0 = load64(key);
+			m_k1 = load64(key + 8);
+		}
+
+		memset(key, 0, sizeof(key));
+		return ok;
+	}
+
+	Token issue() const {
+		uint8_t bytes[RANDOM_BYTES + 8];
+		OfdxRandom::fill(bytes, RANDOM_BYTES);
+
+		uint64_t const t = tag(bytes, RANDOM_BYTES);
+
+		for(int i = 0; i < 8; ++ i)
+			bytes[RANDOM_BYTES + i] = t >> (i * 8);
+
+		return Token(bytes);
+	}
+
+	// Whether text is a token issued under this key.
+	bool verify(std::string_view const text) const {
+		uint8_t bytes[RANDOM_BYTES + 8];
+
+		if(!Token::decode(text, bytes))
+			return false;
+
+		uint64_t const t = tag(bytes, RANDOM_BYTES);
+		uint8_t diff = 0;
+
+		// Compare every byte, so the time taken says nothing about the tag.
+		for(int i = 0; i < 8; ++ i)
+			diff |= bytes[RANDOM_BYTES + i] ^ (uint8_t) (t >> (i * 8));
+
+		return !diff;
+	}
+};
+
+#endif
@@ -0,0 +1,217 @@
+/*
+   OFDX Form and Cookie Parsing
+
+   Iterates over the name=value pairs of a Cookie header or of
+   application/x-www-form-urlencoded data (query strings and POST bodies)
+   as string_views into the original text, so parsing allocates nothing.
+   Delimiters are found 16 bytes at a time with SSE2 where it is available.
+
+   Values are not decoded while iterating; ofdxUrlDecode() decodes one in
+   place, in a buffer the caller owns.
+*/
+
+#ifndef OFDX_URLENCODED_H
+#define OFDX_URLENCODED_H
+
+#include <charconv>
+#include <cstddef>
+#include <iterator>
+#include <string>
+#include <string_view>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Position of the first a or b in s at or after from, or s.size().
+inline size_t ofdxFindEither(std::string_view const s, size_t from, char const a, char const b){
+#ifdef __SSE2__
+	__m128i const va = _mm_set1_epi8(a);
+	__m128i const vb = _mm_set1_epi8(b);
+
+	for(; from + 16 <= s.size(); from += 16){
+		__m128i const chunk = _mm_loadu_si128((__m128i const*) (s.data() + from));
+		int const mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(chunk, va), _mm_cmpeq_epi8(chunk, vb)));
+
+		if(mask)
+			return from + __builtin_ctz(mask);
+	}
+#endif
+
+	for(; from < s.size(); ++ from){
+		if((s[from] == a) || (s[from] == b))
+			break;
+	}
+
+	return from;
+}
+
+// The pairs of s, split on either separator. Pairs without a name are
+// skipped, and a pair without '=' has an empty value. With trim set, spaces
+// and tabs around each pair are dropped, as cookie headers have them.
+class OfdxFields {
+	std::string_view m_text;
+	char m_sep1, m_sep2;
+	bool m_trim;
+
+public:
+	struct Field {
+		std::string_view m_name, m_value;
+	};
+
+	class const_iterator {
+		OfdxFields const* m_fields;
+		size_t m_next;
+		Field m_field;
+
+		// Move to the next pair with a name, or to the end.
+		void advance(){
+			std::string_view const text = m_fields->m_text;
+
+			while(m_next <= text.size()){
+				size_t const end = ofdxFindEither(text, m_next, m_fields->m_sep1, m_fields->m_sep2);
+				std::string_view pair = text.substr(m_next, end - m_next);
+
+				m_next = end + 1;
+
+				if(m_fields->m_trim){
+					while(!pair.empty() && ((pair.front() == ' ') || (pair.front() == '\t')))
+						pair.remove_prefix(1);
+
+					while(!pair.empty() && ((pair.back() == ' ') || (pair.back() == '\t')))
+						pair.remove_suffix(1);
+				}
+
+				size_t const eq = pair.find('=');
+
+				if(pair.empty() || (eq == 0))
+					continue;
+
+				m_field.m_name = pair.substr(0, eq);
+				m_field.m_value = (eq == std::string_view::npos) ? std::string_view() : pair.substr(eq + 1);
+				return;
+			}
+
+			m_fields = nullptr;
+		}
+
+	public:
+		typedef std::forward_iterator_tag iterator_category;
+		typedef Field value_type;
+		typedef std::ptrdiff_t difference_type;
+		typedef Field const* pointer;
+		typedef Field const& reference;
+
+		const_iterator() :
+			m_fields(nullptr), m_next(0)
+		{}
+
+		explicit const_iterator(OfdxFields const* fields) :
+			m_fields(fields), m_next(0)
+		{
+			advance();
+		}
+
+		Field const& operator * () const { return m_field; }
+		Field const* operator -> () const { return &m_field; }
+
+		const_iterator& operator ++ (){
+			advance();
+			return *this;
+		}
+
+		const_iterator operator ++ (int){
+			const_iterator const was(*this);
+			advance();
+			return was;
+		}
+
+		// Only the end iterators compare equal, which is all a loop needs.
+		bool operator == (const_iterator const& o) const { return !m_fields && !o.m_fields; }
+		bool operator != (const_iterator const& o) const { return !(*this == o); }
+	};
+
+	OfdxFields(std::string_view const text, char const sep1, char const sep2, bool const trim) :
+		m_text(text), m_sep1(sep1), m_sep2(sep2), m_trim(trim)
+	{}
+
+	const_iterator begin() const { return const_iterator(this); }
+	const_iterator end() const { return const_iterator(); }
+
+	// Value of the last pair with the given name, or an empty view.
+	std::string_view last(std::string_view const name) const {
+		std::string_view value;
+
+		for(auto const& f : *this){
+			if(f.m_name == name)
+				value = f.m_value;
+		}
+
+		return value;
+	}
+};
+
+// The pairs of a Cookie header: "a=1; b=2".
+inline OfdxFields ofdxCookies(std::string_view const header){
+	return OfdxFields(header, ';', ';', true);
+}
+
+// The pairs of form data or a query string: "a=1&b=2", or with ';'.
+inline OfdxFields ofdxUrlEncoded(std::string_view const data){
+	return OfdxFields(data, '&', ';', false);
+}
+
+// Decode '+' and %XX escapes of the n bytes at s, in place. Returns the
+// decoded length. A '%' without two hex digits after it is kept as it is.
+inline size_t ofdxUrlDecode(char *const s, size_t const n){
+	auto const hex = [](char const c) -> int {
+		if((c >= '0') && (c <= '9'))
+			return c - '0';
+
+		if((c >= 'a') && (c <= 'f'))
+			return c - 'a' + 10;
+
+		if((c >= 'A') && (c <= 'F'))
+			return c - 'A' + 10;
+
+		return -1;
+	};
+
+	// Nothing moves before the first escape.
+	size_t in = ofdxFindEither(std::string_view(s, n), 0, '%', '+');
+	size_t out = in;
+
+	while(in < n){
+		char const c = s[in ++];
+
+		if(c == '+'){
+			s[out ++] = ' ';
+		} else if((c == '%') && (in + 1 < n) && (hex(s[in]) >= 0) && (hex(s[in + 1]) >= 0)){
+			s[out ++] = (char) ((hex(s[in]) << 4) | hex(s[in + 1]));
+			in += 2;
+		} else {
+			s[out ++] = c;
+		}
+	}
+
+	return out;
+}
+
+// Decode part, which must lie within buffer, in place. Returns the decoded
+// text, which stays within buffer.
+inline std::string_view ofdxUrlDecode(std::string &buffer, std::string_view const part){
+	char *const s = &buffer[part.data() - buffer.data()];
+
+	return std::string_view(s, ofdxUrlDecode(s, part.size()));
+}
+
+// Leading decimal integer of s, or 0, like atoi() without the copy.
+template<typename T>
+T ofdxToNumber(std::string_view const s){
+	T value = 0;
+
+	std::from_chars(s.data(), s.data() + s.size(), value);
+	return value;
+}
+
+#endif
@@ -24,11 +24,13 @@
 #include <algorithm>
 #include <array>
 #include <cstddef>
+#include <cstdint>
 #include <cstring>
 #include <istream>
 #include <memory>
 #include <optional>
 #include <string>
+#include <string_view>
 #include <vector>
 
 namespace dmitigr::fcgi::detail {
@@ -325,41 +327,86 @@ private:
 // Names_values
 // -----------------------------------------------------------------------------
 
+/// @returns The FNV-1a hash of `str`.
+constexpr std::uint32_t parameter_hash(const std::string_view str) noexcept
+{
+  std::uint32_t result{2166136261u};
+  for (const char c : str) {
+    result ^= static_cast<unsigned char>(c);
+    result *= 16777619u;
+  }
+  return result;
+}
+
+/// The names of the CGI variables which indexes are resolved in advance.
+inline constexpr std::array<std::string_view, 12> well_known_parameters{
+  "CONTENT_LENGTH", "CONTENT_TYPE", "DOCUMENT_URI", "HTTP_ACCEPT_ENCODING",
+  "HTTP_COOKIE", "HTTP_IF_NONE_MATCH", "PATH_INFO", "QUERY_STRING",
+  "REMOTE_ADDR", "REQUEST_METHOD", "REQUEST_URI", "SCRIPT_NAME"};
+
+/// The hashes of well_known_parameters.
+inline constexpr auto well_known_parameter_hashes = []
+{
+  std::array<std::uint32_t, well_known_parameters.size()> result{};
+  for (std::size_t i = 0; i < result.size(); ++i)
+    result[i] = parameter_hash(well_known_parameters[i]);
+  return result;
+}();
+
 /// A value type of Names_values container.
 class Name_value final {
 public:
   /// The constructor.
-  Name_value(std::unique_ptr<char[]> data,
-    const std::size_t name_size, const std::size_t value_size) noexcept
-    : data_{std::move(data)}
-    , name_size_{name_size}
-    , value_size_{value_size}
+  Name_value(const std::string_view name, const std::string_view value) noexcept
+    : name_{name}
+    , value_{value}
   {}
 
   /// @returns The name.
   std::string_view name() const noexcept
   {
-    return std::string_view{data_.get(), name_size_};
+    return name_;
   }
 
   /// @returns The value.
   std::string_view value() const noexcept
   {
-    return std::string_view{data_.get() + name_size_, value_size_};
+    return value_;
   }
 
 private:
-  std::unique_ptr<char[]> data_;
-  std::size_t name_size_{};
-  std::size_t value_size_{};
+  friend Names_values;
+
+  std::string_view name_;
+  std::string_view value_;
 };
 
-/// A container of name-value pairs to store variable-length values.
+/**
+ * @brief A container of name-value pairs to store variable-length values.
+ *
+ * @details The pairs are stored in the single memory area (arena) as they are
+ * transmitted by a FastCGI client, and Name_value just refers to it. The
+ * pairs are indexed by the open-addressing hash table, and the indexes of
+ * the well-known CGI variables (such as `SCRIPT_NAME`) are resolved in
+ * advance.
+ */
 class Names_values final {
 public:
   /// The default constructor.
   Names_values() = default;
 
+  /// Non copy-constructible, since the pairs refer to the arena.
+  Names_values(const Names_values&) = delete;
+
+  /// Non copy-assignable.
+  Names_values& operator=(const Names_values&) = delete;
+
+  /// Move-constructible. (The arena is not moved in memory.)
+  Names_values(Names_values&&) = default;
+
+  /// Move-assignable.
+  Names_values& operator=(Names_values&&) = default;
+
   /**
    * @brief Constructs by reading the given `stream`.
    *
@@ -380,49 +427,52 @@ public:
   {
     DMITIGR_ASSERT(stream && (reserve <= 64));
 
-    using Traits_type = std::istream::traits_type;
+    // Reading the whole stream at once.
+    std::size_t size{};
+    arena_.resize(std::max<std::size_t>(reserve * 64, 256));
+    while (stream) {
+      if (size == arena_.size())
+        arena_.resize(arena_.size() * 2);
+      stream.read(arena_.data() + size,
+        static_cast<std::streamsize>(arena_.size() - size));
+      size += static_cast<std::size_t>(stream.gcount());
+    }
+    arena_.resize(size);
 
-    const auto read_length = [&]() -> int
+    std::size_t offset{};
+    const auto read_length = [&]() -> std::size_t
     {
       // Note: length can be 1 or 4 bytes.
-      const auto result = stream.get();
-      if (result != Traits_type::eof()) {
-        if ((result & 0x80) != 0) {
-          std::array<unsigned char, 3> buf;
-          stream.read(reinterpret_cast<char*>(buf.data()), buf.size());
-          if (stream.gcount() == static_cast<std::streamsize>(buf.size()))
-            return ((result & 0x7f) << 24) + (buf[0] << 16) + (buf[1] << 8) + buf[2];
-          else
-            throw Exception{"cannot read length of FastCGI parameters"};
-        }
+      const auto* const data = reinterpret_cast<const unsigned char*>(
+        arena_.data() + offset);
+      if ((data[0] & 0x80) != 0) {
+        if (size - offset < 4)
+          throw Exception{"cannot read length of FastCGI parameters"};
+        offset += 4;
+        return (static_cast<std::size_t>(data[0] & 0x7f) << 24) +
+          (static_cast<std::size_t>(data[1]) << 16) +
+          (static_cast<std::size_t>(data[2]) << 8) + data[3];
       }
-      return result;
+      offset += 1;
+      return data[0];
     };
 
-    const auto read_data = [&](const int count) -> std::unique_ptr<char[]>
-    {
-      std::unique_ptr<char[]> result{new char[static_cast<unsigned>(count)]};
-      stream.read(result.get(), count);
-      if (stream.gcount() == count)
-        return result;
-      else
+    pairs_.reserve(reserve);
+    while (offset < size) {
+      const auto name_length = read_length();
+      if (offset == size)
+        throw Exception{"FastCGI protocol violation"};
+      const auto value_length = read_length();
+      if (size - offset < name_length + value_length)
         throw Exception{"cannot read FastCGI parameters"};
-    };
 
-    pairs_.reserve(reserve);
-    while (true) {
-      if (const int name_length = read_length();
-        name_length != Traits_type::eof()) {
-        if (const int value_length = read_length();
-          value_length != Traits_type::eof()) {
-          auto data = read_data(name_length + value_length);
-          add(std::move(data), static_cast<unsigned>(name_length),
-            static_cast<unsigned>(value_length));
-        } else
-          throw Exception{"FastCGI protocol violation"};
-      } else
-        break;
+      const std::string_view name{arena_.data() + offset, name_length};
+      offset += name_length;
+      const std::string_view value{arena_.data() + offset, value_length};
+      offset += value_length;
+      pairs_.emplace_back(name, value);
     }
+    rebuild_index();
   }
 
   /// @returns The pair count.
@@ -434,13 +484,21 @@ public:
   /// @returns The pair index by the given `name`.
   std::optional<std::size_t> pair_index(const std::string_view name) const noexcept
   {
-    const auto b = cbegin(pairs_);
-    const auto e = cend(pairs_);
-    const auto i = find_if(b, e, [&](const auto& p)
-    {
-      return p.name() == name;
-    });
-    return i != e ? std::make_optional<std::size_t>(i - b) : std::nullopt;
+    const auto hash = parameter_hash(name);
+    for (std::size_t i = 0; i < well_known_parameters.size(); ++i) {
+      if (well_known_parameter_hashes[i] == hash && well_known_parameters[i] == name)
+        return slot_to_index(well_known_slots_[i]);
+    }
+
+    if (index_.empty())
+      return std::nullopt;
+
+    const auto mask = index_.size() - 1;
+    for (auto i = hash & mask; index_[i]; i = (i + 1) & mask) {
+      if (pairs_[index_[i] - 1].name() == name)
+        return slot_to_index(index_[i]);
+    }
+    return std::nullopt;
   }
 
   /// @returns The pair by the given `index`.
@@ -450,31 +508,123 @@ public:
     return pairs_[index];
   }
 
-  /**
-   * @brief Adds the name-value pair.
-   *
-   * @param data - the name-value data.
-   * @param name_size - the size of name in `data`.
-   * @param value_size - the size of value in `data`.
-   */
-  void add(std::unique_ptr<char[]> data, const std::size_t name_size,
-    const std::size_t value_size)
+  /// Adds the name-value pair.
+  void add(const std::string_view name, const std::string_view value)
+  {
+    const auto* const old_data = arena_.data();
+    const auto offset = arena_.size();
+    arena_.insert(arena_.end(), name.begin(), name.end());
+    arena_.insert(arena_.end(), value.begin(), value.end());
+
+    // Rebasing the pairs if the arena is reallocated.
+    if (arena_.data() != old_data) {
+      for (auto& pair : pairs_) {
+        pair.name_ = rebased(pair.name_, old_data);
+        pair.value_ = rebased(pair.value_, old_data);
+      }
+    }
+    pairs_.emplace_back(std::string_view{arena_.data() + offset, name.size()},
+      std::string_view{arena_.data() + offset + name.size(), value.size()});
+    rebuild_index();
+  }
+
+private:
+  std::vector<char> arena_;
+  std::vector<Name_value> pairs_;
+  // The slots are indexes of pairs_ plus one. (Zero denotes an empty slot.)
+  std::vector<std::uint32_t> index_;
+  std::array<std::uint32_t, well_known_parameters.size()> well_known_slots_{};
+
+  static std::optional<std::size_t> slot_to_index(const std::uint32_t slot) noexcept
   {
-    pairs_.emplace_back(std::move(data), name_size, value_size);
+    return slot ? std::make_optional<std::size_t>(slot - 1) : std::nullopt;
   }
 
-  /// @overload
-  void add(const char* const name, const char* const value)
+  std::string_view rebased(const std::string_view str,
+    const char* const old_data) const noexcept
   {
-    DMITIGR_ASSERT(name && value);
-    const std::size_t name_size = std::strlen(name);
-    const std::size_t value_size = std::strlen(value);
-    std::unique_ptr<char[]> data{new char[name_size + value_size]};
-    add(std::move(data), name_size, value_size);
+    return {arena_.data() + (str.data() - old_data), str.size()};
   }
 
-private:
-  std::vector<Name_value> pairs_;
+  /// Indexes the pairs. In case of duplicates the first pair wins.
+  void rebuild_index()
+  {
+    well_known_slots_.fill(0);
+    std::size_t capacity{8};
+    while (capacity < pairs_.size() * 2)
+      capacity *= 2;
+    index_.assign(capacity, 0);
+
+    const auto mask = capacity - 1;
+    for (std::size_t p = 0; p < pairs_.size(); ++p) {
+      const auto name = pairs_[p].name();
+      const auto hash = parameter_hash(name);
+      const auto slot = static_cast<std::uint32_t>(p + 1);
+      for (std::size_t i = 0; i < well_known_parameters.size(); ++i) {
+        if (well_known_parameter_hashes[i] == hash && well_known_parameters[i] == name &&
+          !well_known_slots_[i]) {
+          well_known_slots_[i] = slot;
+          break;
+        }
+      }
+
+      auto i = hash & mask;
+      for (; index_[i]; i = (i + 1) & mask) {
+        if (pairs_[index_[i] - 1].name() == name)
+          break;
+      }
+      if (!index_[i])
+        index_[i] = slot;
+    }
+  }
 };
 
+// -----------------------------------------------------------------------------
+// Management records
+// -----------------------------------------------------------------------------
+
+/**
+ * @returns The get-values-result record to transmit to a FastCGI client in
+ * response to the get-values record with the specified `variables`.
+ *
+ * @param max_conns The value of `FCGI_MAX_CONNS` variable.
+ * @param max_reqs The value of `FCGI_MAX_REQS` variable.
+ * @param mpxs_conns The value of `FCGI_MPXS_CONNS` variable.
+ *
+ * @remarks Only known variables are included to the response.
+ */
+inline std::string make_get_values_result_record(const Names_values& variables,
+  const std::size_t max_conns, const std::size_t max_reqs, const bool mpxs_conns)
+{
+  std::string content;
+  const auto variables_count = variables.pair_count();
+  for (std::size_t i = 0; i < variables_count; ++i) {
+    const auto name = variables.pair(i).name();
+    std::string value;
+    if (name == "FCGI_MAX_CONNS")
+      value = std::to_string(max_conns);
+    else if (name == "FCGI_MAX_REQS")
+      value = std::to_string(max_reqs);
+    else if (name == "FCGI_MPXS_CONNS")
+      value = mpxs_conns ? "1" : "0";
+    else
+      continue; // Ignoring other variables specified in the get-values record.
+
+    // Note: the lengths of known names and values are always encoded in one byte.
+    DMITIGR_ASSERT(name.size() <= 127 && value.size() <= 127);
+    content += static_cast<char>(name.size());
+    content += static_cast<char>(value.size());
+    content.append(name);
+    content.append(value);
+  }
+
+  const auto padding_length = math::padding<std::size_t>(content.size(), 8);
+  const Header header{Record_type::get_values_result, Header::null_request_id,
+    content.size(), padding_length};
+  std::string result(reinterpret_cast<const char*>(&header), sizeof(header));
+  result.append(content);
+  result.append(padding_length, '\0');
+  return result;
+}
+
 } // namespace dmitigr::fcgi::detail
@@ -64,6 +64,22 @@ enum class Stream_type {
   data = 8
 };
 
+/// Represents a policy of transmitting the output buffered by a stream.
+enum class Flush_policy {
+  /**
+   * @brief The buffered output is transmitted upon each flush of the stream
+   * (e.g. by `std::flush` or `std::endl`).
+   */
+  sync,
+
+  /**
+   * @brief The flushes of the stream are ignored, so the buffered output is
+   * transmitted only when the buffer is full, upon Ostream::transmit(), or
+   * upon the close of the stream.
+   */
+  coalesce
+};
+
 } // namespace dmitigr::fcgi
 
 #ifndef DMITIGR_FCGI_NOT_HEADER_ONLY
@@ -0,0 +1,191 @@
+// -*- C++ -*-
+//
+// Copyright 2022 Dmitry Igrishin
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "../base/assert.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+namespace dmitigr::fcgi::detail {
+
+/**
+ * @brief A pool of the stream buffers of the server connections.
+ *
+ * @details The buffers released by the connections are kept on the free
+ * lists (one per buffer size) to be reused by the subsequent connections
+ * instead of being allocated anew.
+ *
+ * The connections can be served (and thus destroyed) by the threads other
+ * than the one of the Listener, so the free lists are guarded by the mutex.
+ * The pool is shared by the Listener and the connections, so it's alive as
+ * long as any of the buffers is in use.
+ */
+class Buffer_pool final : public std::enable_shared_from_this<Buffer_pool> {
+public:
+  /// A buffer which is returned to the pool upon destruction.
+  class Buffer final {
+  public:
+    /// The destructor.
+    ~Buffer()
+    {
+      if (pool_)
+        pool_->release(size_, std::move(data_));
+    }
+
+    /// Constructs an empty buffer.
+    Buffer() = default;
+
+    /// Non copy-constructible.
+    Buffer(const Buffer&) = delete;
+
+    /// Non copy-assignable.
+    Buffer& operator=(const Buffer&) = delete;
+
+    /// Move-constructible.
+    Buffer(Buffer&&) = default;
+
+    /// Move-assignable.
+    Buffer& operator=(Buffer&& rhs) noexcept
+    {
+      if (this != &rhs) {
+        Buffer tmp{std::move(rhs)};
+        std::swap(pool_, tmp.pool_);
+        std::swap(data_, tmp.data_);
+        std::swap(size_, tmp.size_);
+      }
+      return *this;
+    }
+
+    /// @returns The data of the buffer.
+    char* data() const noexcept
+    {
+      return data_.get();
+    }
+
+    /// @returns The size of the buffer.
+    std::size_t size() const noexcept
+    {
+      return size_;
+    }
+
+  private:
+    friend Buffer_pool;
+
+    std::shared_ptr<Buffer_pool> pool_;
+    std::unique_ptr<char[]> data_;
+    std::size_t size_{};
+
+    Buffer(std::shared_ptr<Buffer_pool> pool, std::unique_ptr<char[]> data,
+      const std::size_t size) noexcept
+      : pool_{std::move(pool)}
+      , data_{std::move(data)}
+      , size_{size}
+    {}
+  };
+
+  /**
+   * @brief The constructor.
+   *
+   * @param max_free_count The maximum number of the free buffers of each size
+   * kept in the pool.
+   */
+  explicit Buffer_pool(const std::size_t max_free_count)
+    : max_free_count_{max_free_count}
+  {}
+
+  /// @returns The buffer of the given `size` either from the pool or a new one.
+  Buffer acquire(const std::size_t size)
+  {
+    DMITIGR_ASSERT(size > 0);
+    {
+      const std::lock_guard lg{mutex_};
+      if (auto* const list = free_list(size); list && !list->empty()) {
+        auto data = std::move(list->back());
+        list->pop_back();
+        ++hit_count_;
+        return Buffer{shared_from_this(), std::move(data), size};
+      }
+    }
+    ++miss_count_;
+    return Buffer{shared_from_this(), std::make_unique<char[]>(size), size};
+  }
+
+  /// @returns The number of acquisitions satisfied by the pool.
+  std::uint64_t hit_count() const noexcept
+  {
+    return hit_count_.load();
+  }
+
+  /// @returns The number of acquisitions which required an allocation.
+  std::uint64_t miss_count() const noexcept
+  {
+    return miss_count_.load();
+  }
+
+  /// @returns The number of the free buffers kept in the pool.
+  std::size_t free_count() const
+  {
+    const std::lock_guard lg{mutex_};
+    std::size_t result{};
+    for (const auto& list : free_lists_)
+      result += list.second.size();
+    return result;
+  }
+
+private:
+  using Free_list = std::vector<std::unique_ptr<char[]>>;
+
+  std::size_t max_free_count_{};
+  // There are a few distinct sizes of the buffers, so a vector is enough.
+  std::vector<std::pair<std::size_t, Free_list>> free_lists_;
+  std::atomic<std::uint64_t> hit_count_{};
+  std::atomic<std::uint64_t> miss_count_{};
+  mutable std::mutex mutex_;
+
+  /// @returns The free list of buffers of the given `size`, or `nullptr`.
+  Free_list* free_list(const std::size_t size) noexcept
+  {
+    for (auto& list : free_lists_) {
+      if (list.first == size)
+        return &list.second;
+    }
+    return nullptr;
+  }
+
+  /// Puts the `data` of the given `size` back to the pool.
+  void release(const std::size_t size, std::unique_ptr<char[]> data) noexcept
+  {
+    if (!data)
+      return;
+
+    try {
+      const std::lock_guard lg{mutex_};
+      auto* list = free_list(size);
+      if (!list)
+        list = &free_lists_.emplace_back(size, Free_list{}).second;
+      if (list->size() < max_free_count_)
+        list->push_back(std::move(data));
+    } catch (...) {
+      // The buffer is freed.
+    }
+  }
+};
+
+} // namespace dmitigr::fcgi::detail
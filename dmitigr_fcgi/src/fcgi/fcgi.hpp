@@ -19,6 +19,7 @@
 
 #include "basics.hpp"
 #include "connection.hpp"
+#include "framed_output.hpp"
 #include "listener.hpp"
 #include "listener_options.hpp"
 #include "server_connection.hpp"
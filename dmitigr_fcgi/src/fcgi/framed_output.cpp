@@ -0,0 +1,50 @@
+// -*- C++ -*-
+//
+// Copyright 2022 Dmitry Igrishin
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "../math/alignment.hpp"
+#include "basics.hpp"
+#include "framed_output.hpp"
+
+#include <algorithm>
+
+namespace dmitigr::fcgi {
+
+DMITIGR_FCGI_INLINE Framed_output::Framed_output(const std::string_view data)
+  : size_{data.size()}
+{
+  // The content length is aligned, so the records never need padding but last.
+  constexpr std::size_t max_content_length{detail::Header::max_content_length / 8 * 8};
+  const auto record_count = (data.size() + max_content_length - 1) / max_content_length;
+  records_.reserve(data.size() + record_count * (sizeof(detail::Header) + 7));
+  for (std::size_t offset{}; offset < data.size();) {
+    const auto content_length = std::min(max_content_length, data.size() - offset);
+    const auto padding_length = math::padding<std::size_t>(content_length, 8);
+    const detail::Header header{detail::Record_type::out, 1, content_length,
+      padding_length};
+    records_.append(reinterpret_cast<const char*>(&header), sizeof(header));
+    records_.append(data.substr(offset, content_length));
+    records_.append(padding_length, '\0');
+    offset += content_length;
+    ++record_count_;
+  }
+}
+
+DMITIGR_FCGI_INLINE std::size_t Framed_output::size() const noexcept
+{
+  return size_;
+}
+
+} // namespace dmitigr::fcgi
@@ -0,0 +1,66 @@
+// -*- C++ -*-
+//
+// Copyright 2022 Dmitry Igrishin
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef DMITIGR_FCGI_FRAMED_OUTPUT_HPP
+#define DMITIGR_FCGI_FRAMED_OUTPUT_HPP
+
+#include "dll.hpp"
+#include "types_fwd.hpp"
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+namespace dmitigr::fcgi {
+
+/**
+ * @brief An immutable output framed into the records of the output stream
+ * in advance.
+ *
+ * @details Useful for the responses which are known before the requests,
+ * such as static resources. The records are sent as is, without copying
+ * them to the stream buffer.
+ *
+ * @see Server_connection::write_framed().
+ */
+class Framed_output final {
+public:
+  /// Frames the `data`.
+  DMITIGR_FCGI_API explicit Framed_output(std::string_view data);
+
+  /// @returns The size of the data (excluding the record headers and padding).
+  DMITIGR_FCGI_API std::size_t size() const noexcept;
+
+private:
+  friend detail::server_Streambuf;
+
+  /*
+   * The records of the request with the identifier of 1 (which is used by the
+   * FastCGI clients which don't multiplex connections). The headers of other
+   * requests are built upon the transmission.
+   */
+  std::string records_;
+  std::size_t record_count_{};
+  std::size_t size_{};
+};
+
+} // namespace dmitigr::fcgi
+
+#ifndef DMITIGR_FCGI_NOT_HEADER_ONLY
+#include "framed_output.cpp"
+#endif
+
+#endif  // DMITIGR_FCGI_FRAMED_OUTPUT_HPP
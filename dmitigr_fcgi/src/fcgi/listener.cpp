@@ -15,17 +15,28 @@
 // limitations under the License.
 
 #include "../base/assert.hpp"
+#include "../net/descriptor.hpp"
 #include "../net/listener.hpp"
+#include "../net/reactor.hpp"
+#include "../net/reaper.hpp"
 #include "basics.hpp"
 #include "exceptions.hpp"
 #include "listener.hpp"
-#include "server_connection_stacked.cpp"
+#include "mpx_channel.cpp"
+#include "server_connection_pooled.cpp"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <iostream>
 
 namespace dmitigr::fcgi {
 
 DMITIGR_FCGI_INLINE Listener::Listener(Listener_options options)
   : listener_{net::Listener::make(options.options_)}
   , listener_options_{std::move(options)}
+  , buffer_pool_{std::make_shared<detail::Buffer_pool>(
+      listener_options_.max_pooled_buffers())}
 {}
 
 DMITIGR_FCGI_INLINE const Listener_options& Listener::options() const noexcept
@@ -41,17 +52,93 @@ DMITIGR_FCGI_INLINE bool Listener::is_listening() const noexcept
 DMITIGR_FCGI_INLINE void Listener::listen()
 {
   listener_->listen();
+#ifdef _WIN32
+  if (listener_options_.endpoint().communication_mode() ==
+    net::Communication_mode::wnp)
+    return; // named pipes are waited by the listener itself
+#endif
+  std::atomic_store(&reaper_,
+    std::make_shared<net::Reaper>(listener_options_.linger_timeout()));
+  reactor_ = std::make_unique<net::Reactor>();
+  // The listener is registered with the null data.
+  reactor_->add(static_cast<net::Socket_native>(listener_->native_handle()),
+    net::Socket_readiness::read_ready, nullptr);
 }
 
 DMITIGR_FCGI_INLINE bool Listener::wait(const std::chrono::milliseconds timeout)
 {
-  return listener_->wait(timeout);
+  namespace chrono = std::chrono;
+  using chrono::milliseconds;
+  using Clock = chrono::steady_clock;
+
+  if (!is_listening())
+    throw Exception{"cannot wait for FastCGI connections if listener is "
+      "not listening"};
+  else if (!(timeout >= milliseconds{-1}))
+    throw Exception{"invalid timeout for wait operation on FastCGI listener"};
+
+  waiting_thread_ = std::this_thread::get_id();
+  const auto started = Clock::now();
+  while (ready_io_.empty()) {
+    if (timeout < milliseconds::zero())
+      dispatch_events(timeout);
+    else {
+      const auto elapsed = chrono::duration_cast<milliseconds>(
+        Clock::now() - started);
+      if (elapsed >= timeout)
+        break;
+      dispatch_events(timeout - elapsed);
+    }
+  }
+  return !ready_io_.empty();
 }
 
 DMITIGR_FCGI_INLINE std::unique_ptr<Server_connection> Listener::accept()
 {
-  auto io = listener_->accept();
-  detail::Header header{io.get()};
+  return open(take());
+}
+
+DMITIGR_FCGI_INLINE std::unique_ptr<net::Descriptor> Listener::take()
+{
+  if (ready_io_.empty())
+    wait();
+  auto io = std::move(ready_io_.front());
+  ready_io_.pop_front();
+  DMITIGR_ASSERT(io);
+  return io;
+}
+
+DMITIGR_FCGI_INLINE std::unique_ptr<Server_connection>
+Listener::open(std::unique_ptr<net::Descriptor> io)
+{
+  DMITIGR_ASSERT(io);
+
+  /*
+   * Reading ahead as much as available at once. The buffer is passed to the
+   * connection, so the parameters and the content of the request (which are
+   * usually sent along with the begin-request record) are not read again.
+   * The size is aligned down, as the stream buffer uses the aligned size.
+   */
+  auto in_buffer = buffer_pool_->acquire(listener_options_.in_buffer_size());
+  const auto in_capacity = in_buffer.size() - in_buffer.size() % 8;
+  std::size_t in_size{};
+  std::size_t read_count{};
+  const auto read_at_least = [&](const std::size_t size)
+  {
+    while (in_size < size) {
+      const auto count = io->read(in_buffer.data() + in_size,
+        static_cast<std::streamsize>(in_capacity - in_size));
+      ++read_count;
+      if (count <= 0)
+        throw Exception{"FastCGI protocol violation"};
+      in_size += static_cast<std::size_t>(count);
+    }
+  };
+
+  read_at_least(sizeof(detail::Header));
+  detail::Header header;
+  std::memcpy(&header, in_buffer.data(), sizeof(header));
+  header.check_validity();
 
   const auto end_request = [&](const detail::Protocol_status protocol_status)
   {
@@ -65,12 +152,20 @@ DMITIGR_FCGI_INLINE std::unique_ptr<Server_connection> Listener::accept()
   if (header.record_type() == detail::Record_type::begin_request &&
     !header.is_management_record() &&
     header.content_length() == sizeof(detail::Begin_request_body)) {
-    const detail::Begin_request_body body{io.get()};
+    constexpr auto in_offset = sizeof(header) + sizeof(detail::Begin_request_body);
+    read_at_least(in_offset);
+    detail::Begin_request_body body;
+    std::memcpy(&body, in_buffer.data() + sizeof(header), sizeof(body));
     const auto role = body.role();
     if (role == Role::responder ||
       role == Role::authorizer || role == Role::filter) {
-      return std::make_unique<detail::stack_buffers_Server_connection>(
-        std::move(io), role, header.request_id(), body.is_keep_conn());
+      return std::make_unique<detail::pooled_buffers_Server_connection>(
+        std::move(io), this, role, header.request_id(), body.is_keep_conn(),
+        *buffer_pool_, detail::pooled_buffers_Server_connection::Buffer_sizes{
+          listener_options_.out_buffer_size(),
+          listener_options_.err_buffer_size()},
+        listener_options_.flush_policy(),
+        std::move(in_buffer), in_offset, in_size, read_count);
     } else {
       // This is a protocol violation.
       end_request(detail::Protocol_status::unknown_role);
@@ -87,9 +182,305 @@ DMITIGR_FCGI_INLINE std::unique_ptr<Server_connection> Listener::accept()
   }
 }
 
+DMITIGR_FCGI_INLINE void detail::iServer_connection::release_io() noexcept
+{
+  listener_->count_io(read_count_, write_count_, record_count_);
+  if (io_ && is_keep_connection_ && is_io_reusable_)
+    listener_->keep_connection(std::move(io_));
+  else
+    listener_->close_connection(std::move(io_));
+}
+
+DMITIGR_FCGI_INLINE std::size_t Listener::idle_connection_count() const noexcept
+{
+  return listener_options_.is_multiplexing() ? channels_.size() :
+    kept_connection_count_;
+}
+
+DMITIGR_FCGI_INLINE net::Reaper::Stats Listener::reaper_stats() const noexcept
+{
+  const auto reaper = std::atomic_load(&reaper_);
+  return reaper ? reaper->stats() : net::Reaper::Stats{};
+}
+
+DMITIGR_FCGI_INLINE Listener::Buffer_pool_stats
+Listener::buffer_pool_stats() const
+{
+  return {buffer_pool_->hit_count(), buffer_pool_->miss_count(),
+    buffer_pool_->free_count()};
+}
+
+DMITIGR_FCGI_INLINE Listener::Io_stats Listener::io_stats() const noexcept
+{
+  return {request_count_.load(), read_count_.load(), write_count_.load(),
+    record_count_.load()};
+}
+
+DMITIGR_FCGI_INLINE void
+Listener::count_io(const std::size_t read_count,
+  const std::size_t write_count, const std::size_t record_count) noexcept
+{
+  ++request_count_;
+  read_count_ += read_count;
+  write_count_ += write_count;
+  record_count_ += record_count;
+}
+
 DMITIGR_FCGI_INLINE void Listener::close()
 {
+  ready_io_.clear();
+  idle_connections_.clear();
+  kept_connection_count_ = 0;
+  {
+    const std::lock_guard lg{released_io_mutex_};
+    released_io_.clear();
+  }
+  channels_.clear();
+  reactor_.reset();
+  std::atomic_store(&reaper_, std::shared_ptr<net::Reaper>{});
   listener_->close();
 }
 
+DMITIGR_FCGI_INLINE void
+Listener::keep_connection(std::unique_ptr<net::Descriptor> io) noexcept
+{
+  try {
+    if (listener_options_.is_multiplexing())
+      return; // the channel is notified by the destructor of `io`
+    else if (!io || !reactor_)
+      return; // named pipes are never reused
+
+    {
+      const std::lock_guard lg{released_io_mutex_};
+      released_io_.push_back(std::move(io));
+    }
+    // The waiting thread registers the connection before it waits.
+    if (std::this_thread::get_id() != waiting_thread_.load())
+      reactor_->notify();
+  } catch (...) {
+    // The connection (if any) is closed by the destructor of `io`.
+  }
+}
+
+DMITIGR_FCGI_INLINE void
+Listener::close_connection(std::unique_ptr<net::Descriptor> io) noexcept
+{
+  if (!io)
+    return;
+
+  // The listener is closed by the waiting thread, while this function can be
+  // called by the thread which serves a request.
+  if (const auto reaper = std::atomic_load(&reaper_)) {
+    if (auto* const sio = dynamic_cast<net::detail::socket_Descriptor*>(io.get()))
+      reaper->reap(sio->release());
+  }
+  // Otherwise the connection is closed by the destructor of `io`.
+}
+
+DMITIGR_FCGI_INLINE void Listener::keep_released_connections()
+{
+  std::vector<std::unique_ptr<net::Descriptor>> released;
+  {
+    const std::lock_guard lg{released_io_mutex_};
+    if (released_io_.empty())
+      return;
+    released.swap(released_io_);
+  }
+
+  const auto timeout = listener_options_.idle_timeout();
+  const auto expires_at = std::chrono::steady_clock::now() + timeout;
+  for (auto& io : released) {
+    try {
+      if (timeout > std::chrono::milliseconds::zero() &&
+        kept_connection_count_ < listener_options_.max_idle_connections())
+        add_idle_connection(std::move(io), expires_at, true);
+    } catch (const std::exception& e) {
+      std::clog << "error upon keeping FastCGI connection: " << e.what() << "\n";
+    }
+    close_connection(std::move(io)); // if not kept
+  }
+}
+
+DMITIGR_FCGI_INLINE void
+Listener::add_idle_connection(std::unique_ptr<net::Descriptor> io,
+  const std::chrono::steady_clock::time_point expires_at, const bool is_kept)
+{
+  DMITIGR_ASSERT(io && reactor_);
+  const auto* const key = io.get();
+  /*
+   * The readiness is reported upon registration if the data is already
+   * received (e.g. the request pipelined by the client).
+   */
+  reactor_->add(static_cast<net::Socket_native>(io->native_handle()),
+    net::Socket_readiness::read_ready, const_cast<net::Descriptor*>(key));
+  idle_connections_.emplace(key, Idle_connection{std::move(io), expires_at,
+      is_kept});
+  if (is_kept)
+    ++kept_connection_count_;
+}
+
+DMITIGR_FCGI_INLINE void
+Listener::close_idle_connection(const decltype(idle_connections_)::iterator i)
+{
+  if (i->second.is_kept)
+    --kept_connection_count_;
+  auto io = std::move(i->second.io);
+  idle_connections_.erase(i);
+  if (io) {
+    reactor_->remove(static_cast<net::Socket_native>(io->native_handle()));
+    close_connection(std::move(io));
+  }
+}
+
+DMITIGR_FCGI_INLINE void
+Listener::sweep(const std::chrono::steady_clock::time_point now)
+{
+  using std::chrono::milliseconds;
+
+  for (auto i = begin(idle_connections_); i != end(idle_connections_);) {
+    if (i->second.expires_at <= now)
+      close_idle_connection(i++);
+    else
+      ++i;
+  }
+
+  const auto idle_timeout = listener_options_.idle_timeout();
+  const bool is_expirable = idle_timeout > milliseconds::zero();
+  for (auto i = begin(channels_); i != end(channels_);) {
+    const auto& channel = i->second;
+    if (channel->is_done() || (is_expirable && !channel->request_count() &&
+        channel->last_activity() + idle_timeout <= now)) {
+      reactor_->remove(static_cast<net::Socket_native>(channel->native_handle()));
+      i = channels_.erase(i);
+    } else
+      ++i;
+  }
+
+  /*
+   * Sweeping is O(n), so it's performed periodically rather than upon each
+   * expiration. Thus, the connections are closed a bit later than expire.
+   */
+  next_sweep_ = now + (is_expirable ?
+    std::clamp(idle_timeout / 4, milliseconds{10}, milliseconds{1000}) :
+    milliseconds{1000});
+}
+
+DMITIGR_FCGI_INLINE void
+Listener::dispatch_events(const std::chrono::milliseconds timeout)
+{
+  namespace chrono = std::chrono;
+  using chrono::milliseconds;
+  using Clock = chrono::steady_clock;
+
+  if (!reactor_) {
+    if (listener_->wait(timeout))
+      ready_io_.push_back(listener_->accept());
+    return;
+  }
+
+  keep_released_connections();
+  const auto now = Clock::now();
+  if (now >= next_sweep_)
+    sweep(now);
+
+  // Wake up no later than the next sweep if there is something to sweep.
+  auto poll_timeout = timeout;
+  if (!idle_connections_.empty() || !channels_.empty()) {
+    const auto until_sweep = std::max(milliseconds::zero(),
+      chrono::ceil<milliseconds>(next_sweep_ - now));
+    if (poll_timeout < milliseconds::zero() || until_sweep < poll_timeout)
+      poll_timeout = until_sweep;
+  }
+
+  std::array<net::Reactor_event, 64> events;
+  const auto count = reactor_->wait(events.data(), events.size(), poll_timeout);
+  bool is_listener_ready{};
+  for (std::size_t i = 0; i < count; ++i) {
+    if (const auto* const data = events[i].data; !data)
+      is_listener_ready = true;
+    else if (listener_options_.is_multiplexing())
+      receive(static_cast<const detail::Mpx_channel*>(data));
+    else
+      resume_connection(static_cast<const net::Descriptor*>(data));
+  }
+
+  // Serving the clients which reuse their connections first.
+  if (is_listener_ready)
+    accept_connections();
+}
+
+DMITIGR_FCGI_INLINE void Listener::accept_connections()
+{
+  std::deque<std::unique_ptr<net::Descriptor>> accepted;
+  listener_->accept_all(accepted);
+
+  if (!listener_options_.is_multiplexing()) {
+    /*
+     * The requests are read synchronously, so the new connections are handed
+     * out only when the data arrives in order to not block on slow clients.
+     */
+    const auto timeout = listener_options_.idle_timeout();
+    const auto expires_at = timeout > std::chrono::milliseconds::zero() ?
+      std::chrono::steady_clock::now() + timeout :
+      std::chrono::steady_clock::time_point::max();
+    for (auto& io : accepted)
+      add_idle_connection(std::move(io), expires_at, false);
+    return;
+  }
+
+  for (auto& io : accepted) {
+    auto channel = std::make_shared<detail::Mpx_channel>(std::move(io),
+      reaper_, listener_options_.max_idle_connections(),
+      listener_options_.max_multiplexed_requests());
+    reactor_->add(static_cast<net::Socket_native>(channel->native_handle()),
+      net::Socket_readiness::read_ready, channel.get());
+    channels_.emplace(channel.get(), std::move(channel));
+  }
+}
+
+DMITIGR_FCGI_INLINE void Listener::resume_connection(const net::Descriptor* const io)
+{
+  const auto i = idle_connections_.find(io);
+  if (i == end(idle_connections_))
+    return;
+
+  auto conn = std::move(i->second.io);
+  close_idle_connection(i);
+  const auto socket = static_cast<net::Socket_native>(conn->native_handle());
+  reactor_->remove(socket);
+  if (!net::is_peer_closed(socket))
+    ready_io_.push_back(std::move(conn));
+  else
+    close_connection(std::move(conn)); // closed by the client
+}
+
+DMITIGR_FCGI_INLINE void Listener::receive(const detail::Mpx_channel* const channel)
+{
+  const auto i = channels_.find(channel);
+  if (i == end(channels_))
+    return;
+
+  try {
+    auto& mpx = *i->second;
+    mpx.flush();
+    mpx.receive(ready_io_);
+    if (!mpx.is_done()) {
+      // The queued records are written as the connection becomes writable.
+      if (const bool is_queued = mpx.is_output_queued();
+        is_queued != mpx.is_write_waited()) {
+        using Sr = net::Socket_readiness;
+        reactor_->modify(static_cast<net::Socket_native>(mpx.native_handle()),
+          is_queued ? Sr::read_ready | Sr::write_ready : Sr::read_ready, &mpx);
+        mpx.set_write_waited(is_queued);
+      }
+      return;
+    }
+  } catch (const std::exception& e) {
+    std::clog << "error upon receiving FastCGI records: " << e.what() << "\n";
+  }
+  // The channel may outlive the map entry until its requests are served.
+  reactor_->remove(static_cast<net::Socket_native>(i->second->native_handle()));
+  channels_.erase(i);
+}
+
 } // namespace dmitigr::fcgi
@@ -17,17 +17,61 @@
 #ifndef DMITIGR_FCGI_LISTENER_HPP
 #define DMITIGR_FCGI_LISTENER_HPP
 
+#include "../net/reaper.hpp"
 #include "dll.hpp"
 #include "listener_options.hpp"
 #include "types_fwd.hpp"
 
+#include <atomic>
 #include <chrono>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
 
 namespace dmitigr::fcgi {
 
 /// A FastCGI listener.
 class Listener final {
 public:
+  /**
+   * @brief The counters of the I/O calls on the connections.
+   *
+   * @details Each call is a system call for the connections which are not
+   * multiplexed.
+   */
+  struct Io_stats final {
+    /// The number of the served requests.
+    std::uint64_t request_count{};
+
+    /// The number of reads including the ones of accept() and open().
+    std::uint64_t read_count{};
+
+    /// The number of writes.
+    std::uint64_t write_count{};
+
+    /**
+     * The number of the records transmitted in the responses (including the
+     * end records).
+     */
+    std::uint64_t record_count{};
+  };
+
+  /// The counters of the pool of the stream buffers of the connections.
+  struct Buffer_pool_stats final {
+    /// The number of buffers taken from the pool.
+    std::uint64_t hit_count{};
+
+    /// The number of buffers allocated since the pool had none.
+    std::uint64_t miss_count{};
+
+    /// The number of free buffers in the pool.
+    std::size_t free_count{};
+  };
+
   /// Constructs the listener.
   DMITIGR_FCGI_API explicit Listener(Listener_options options);
 
@@ -48,6 +92,9 @@ public:
   /**
    * @brief Waits for a next connection to accept.
    *
+   * @details Both the new connections and the connections kept alive at the
+   * request of a FastCGI client (see `FCGI_KEEP_CONN`) are waited for.
+   *
    * @param timeout Maximum amount of time to wait before return. A special
    * value of `-1` denotes "eternity".
    *
@@ -77,12 +124,168 @@ public:
    */
   DMITIGR_FCGI_API std::unique_ptr<Server_connection> accept();
 
-  /// Stops listening.
+  /**
+   * @brief Takes a next connection which is ready to read, without reading
+   * from it.
+   *
+   * @details Unlike accept(), never blocks on a client which sends its
+   * request slowly, since the request is read by open(). Thus, a thread
+   * which waits for connections can hand them over to other threads to be
+   * opened, and is stalled by none of the clients.
+   *
+   * @returns The connection to pass to open().
+   *
+   * @par Requires
+   * `is_listening()`.
+   *
+   * @see open().
+   */
+  DMITIGR_FCGI_API std::unique_ptr<net::Descriptor> take();
+
+  /**
+   * @brief Reads the beginning of the request from the connection `io`
+   * taken by take(), and accepts it, or rejects it in case of a protocol
+   * violation.
+   *
+   * @details Can be called from any thread. Blocks until the begin-request
+   * record and the parameters are received.
+   *
+   * @returns An instance of the accepted FastCGI connection.
+   *
+   * @throws Exception in case of protocol violation.
+   *
+   * @see take().
+   */
+  DMITIGR_FCGI_API std::unique_ptr<Server_connection>
+  open(std::unique_ptr<net::Descriptor> io);
+
+  /**
+   * @returns The number of idle connections kept alive, or the number of
+   * open connections in the multiplexing mode.
+   *
+   * @remarks New connections which are waited for the first request are
+   * not counted.
+   */
+  DMITIGR_FCGI_API std::size_t idle_connection_count() const noexcept;
+
+  /**
+   * @returns The counters of the background closer of the connections.
+   *
+   * @remarks Can be called from any thread.
+   */
+  DMITIGR_FCGI_API net::Reaper::Stats reaper_stats() const noexcept;
+
+  /**
+   * @returns The counters of the I/O calls on the connections.
+   *
+   * @remarks Can be called from any thread.
+   */
+  DMITIGR_FCGI_API Io_stats io_stats() const noexcept;
+
+  /**
+   * @returns The counters of the pool of the stream buffers.
+   *
+   * @remarks Can be called from any thread.
+   */
+  DMITIGR_FCGI_API Buffer_pool_stats buffer_pool_stats() const;
+
+  /// Stops listening and closes all of the idle connections.
   DMITIGR_FCGI_API void close();
 
 private:
+  friend detail::iServer_connection;
+
+  /**
+   * @brief A connection which is waited for a next request: either a new
+   * one, or the one kept alive at the request of a FastCGI client.
+   */
+  struct Idle_connection final {
+    std::unique_ptr<net::Descriptor> io;
+    std::chrono::steady_clock::time_point expires_at;
+    bool is_kept{};
+  };
+
   std::unique_ptr<net::Listener> listener_;
   Listener_options listener_options_;
+  std::unique_ptr<net::Reactor> reactor_;
+  std::shared_ptr<net::Reaper> reaper_;
+  std::shared_ptr<detail::Buffer_pool> buffer_pool_;
+  std::unordered_map<const net::Descriptor*, Idle_connection> idle_connections_;
+  std::unordered_map<const detail::Mpx_channel*,
+    std::shared_ptr<detail::Mpx_channel>> channels_;
+  std::deque<std::unique_ptr<net::Descriptor>> ready_io_;
+  std::size_t kept_connection_count_{};
+  std::chrono::steady_clock::time_point next_sweep_;
+  std::atomic<std::thread::id> waiting_thread_;
+  std::mutex released_io_mutex_;
+  std::vector<std::unique_ptr<net::Descriptor>> released_io_;
+  std::atomic<std::uint64_t> request_count_{};
+  std::atomic<std::uint64_t> read_count_{};
+  std::atomic<std::uint64_t> write_count_{};
+  std::atomic<std::uint64_t> record_count_{};
+
+  /**
+   * @brief Takes the ownership of the connection `io` to read the next
+   * request from it later, or closes it if the connection cannot be reused.
+   *
+   * @details Can be called from any thread, since the connections can be
+   * served by the threads other than the one which waits for them. The
+   * connection is registered by the waiting thread upon the next wait.
+   */
+  void keep_connection(std::unique_ptr<net::Descriptor> io) noexcept;
+
+  /**
+   * @brief Closes the connection `io` gracefully in the background.
+   *
+   * @details Can be called from any thread.
+   */
+  void close_connection(std::unique_ptr<net::Descriptor> io) noexcept;
+
+  /**
+   * @brief Accounts the I/O calls of a served request.
+   *
+   * @details Can be called from any thread.
+   */
+  void count_io(std::size_t read_count, std::size_t write_count,
+    std::size_t record_count) noexcept;
+
+  /// Registers the connections released by keep_connection().
+  void keep_released_connections();
+
+  /// Registers the connection `io` to be waited for a next request.
+  void add_idle_connection(std::unique_ptr<net::Descriptor> io,
+    std::chrono::steady_clock::time_point expires_at, bool is_kept);
+
+  /// Closes the idle connection denoted by `i`.
+  void close_idle_connection(decltype(idle_connections_)::iterator i);
+
+  /**
+   * @brief Closes the idle connections which are idle too long, and the
+   * channels which are either done or idle too long.
+   */
+  void sweep(std::chrono::steady_clock::time_point now);
+
+  /**
+   * @brief Waits for the events of the reactor at most `timeout` and
+   * dispatches them.
+   *
+   * @par Effects
+   * Either the connections which are ready to read, or the descriptors of the multiplexed requests which input is
+   * complete are appended to `ready_io_`.
+   */
+  void dispatch_events(std::chrono::milliseconds timeout);
+
+  /// Accepts all of the pending connections.
+  void accept_connections();
+
+  /// Resumes the idle connection `io` which is ready to read.
+  void resume_connection(const net::Descriptor* io);
+
+  /**
+   * @brief Writes the queued records to the `channel` and receives the
+   * records from it, upon its readiness to either read or write.
+   */
+  void receive(const detail::Mpx_channel* channel);
 };
 
 } // namespace dmitigr::fcgi
@@ -14,6 +14,7 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include "exceptions.hpp"
 #include "listener_options.hpp"
 
 namespace dmitigr::fcgi {
@@ -44,4 +45,147 @@ DMITIGR_FCGI_INLINE std::optional<int> Listener_options::backlog() const noexcep
   return options_.backlog();
 }
 
+DMITIGR_FCGI_INLINE Listener_options&
+Listener_options::set_idle_timeout(const std::chrono::milliseconds timeout)
+{
+  if (!(timeout >= std::chrono::milliseconds::zero()))
+    throw Exception{"invalid FastCGI idle connection timeout"};
+
+  idle_timeout_ = timeout;
+  return *this;
+}
+
+DMITIGR_FCGI_INLINE std::chrono::milliseconds
+Listener_options::idle_timeout() const noexcept
+{
+  return idle_timeout_;
+}
+
+DMITIGR_FCGI_INLINE Listener_options&
+Listener_options::set_max_idle_connections(const std::size_t count) noexcept
+{
+  max_idle_connections_ = count;
+  return *this;
+}
+
+DMITIGR_FCGI_INLINE std::size_t
+Listener_options::max_idle_connections() const noexcept
+{
+  return max_idle_connections_;
+}
+
+DMITIGR_FCGI_INLINE Listener_options&
+Listener_options::set_multiplexing(const bool value) noexcept
+{
+  is_multiplexing_ = value;
+  return *this;
+}
+
+DMITIGR_FCGI_INLINE bool Listener_options::is_multiplexing() const noexcept
+{
+  return is_multiplexing_;
+}
+
+DMITIGR_FCGI_INLINE Listener_options&
+Listener_options::set_max_multiplexed_requests(const std::size_t count)
+{
+  if (!(count > 0))
+    throw Exception{"invalid maximum number of multiplexed FastCGI requests"};
+
+  max_multiplexed_requests_ = count;
+  return *this;
+}
+
+DMITIGR_FCGI_INLINE std::size_t
+Listener_options::max_multiplexed_requests() const noexcept
+{
+  return max_multiplexed_requests_;
+}
+
+DMITIGR_FCGI_INLINE Listener_options&
+Listener_options::set_linger_timeout(const std::chrono::milliseconds timeout)
+{
+  if (!(timeout >= std::chrono::milliseconds::zero()))
+    throw Exception{"invalid FastCGI linger timeout"};
+
+  linger_timeout_ = timeout;
+  return *this;
+}
+
+DMITIGR_FCGI_INLINE std::chrono::milliseconds
+Listener_options::linger_timeout() const noexcept
+{
+  return linger_timeout_;
+}
+
+DMITIGR_FCGI_INLINE Listener_options&
+Listener_options::set_in_buffer_size(const std::size_t size)
+{
+  if (!(2048 <= size && size <= 65528))
+    throw Exception{"invalid FastCGI stdin buffer size"};
+
+  in_buffer_size_ = size;
+  return *this;
+}
+
+DMITIGR_FCGI_INLINE std::size_t Listener_options::in_buffer_size() const noexcept
+{
+  return in_buffer_size_;
+}
+
+DMITIGR_FCGI_INLINE Listener_options&
+Listener_options::set_out_buffer_size(const std::size_t size)
+{
+  if (!(2048 <= size && size <= 65528))
+    throw Exception{"invalid FastCGI stdout buffer size"};
+
+  out_buffer_size_ = size;
+  return *this;
+}
+
+DMITIGR_FCGI_INLINE std::size_t Listener_options::out_buffer_size() const noexcept
+{
+  return out_buffer_size_;
+}
+
+DMITIGR_FCGI_INLINE Listener_options&
+Listener_options::set_err_buffer_size(const std::size_t size)
+{
+  if (!(2048 <= size && size <= 65528))
+    throw Exception{"invalid FastCGI stderr buffer size"};
+
+  err_buffer_size_ = size;
+  return *this;
+}
+
+DMITIGR_FCGI_INLINE std::size_t Listener_options::err_buffer_size() const noexcept
+{
+  return err_buffer_size_;
+}
+
+DMITIGR_FCGI_INLINE Listener_options&
+Listener_options::set_max_pooled_buffers(const std::size_t count) noexcept
+{
+  max_pooled_buffers_ = count;
+  return *this;
+}
+
+DMITIGR_FCGI_INLINE std::size_t
+Listener_options::max_pooled_buffers() const noexcept
+{
+  return max_pooled_buffers_;
+}
+
+DMITIGR_FCGI_INLINE Listener_options&
+Listener_options::set_flush_policy(const Flush_policy value) noexcept
+{
+  flush_policy_ = value;
+  return *this;
+}
+
+DMITIGR_FCGI_INLINE Flush_policy Listener_options::flush_policy() const noexcept
+{
+  return flush_policy_;
+}
+
 } // namespace dmitigr::fcgi
@@ -19,9 +19,12 @@
 
 #include "../fs/filesystem.hpp"
 #include "../net/listener.hpp"
+#include "basics.hpp"
 #include "dll.hpp"
 #include "types_fwd.hpp"
 
+#include <chrono>
+#include <cstddef>
 #include <optional>
 #include <string>
 
@@ -83,10 +86,207 @@ public:
    */
   DMITIGR_FCGI_API std::optional<int> backlog() const noexcept;
 
+  /**
+   * @brief Sets the maximum amount of time a connection kept alive at the
+   * request of a FastCGI client (see `FCGI_KEEP_CONN`) may stay idle.
+   *
+   * @details A new connection may stay without a request for the same amount
+   * of time, or indefinitely if the timeout is zero.
+   *
+   * @par Requires
+   * `(timeout >= std::chrono::milliseconds::zero())`.
+   *
+   * @returns The reference to this instance.
+   */
+  DMITIGR_FCGI_API Listener_options&
+  set_idle_timeout(std::chrono::milliseconds timeout);
+
+  /**
+   * @returns The maximum amount of time an idle connection is kept alive.
+   * By default it's 60 seconds.
+   */
+  DMITIGR_FCGI_API std::chrono::milliseconds idle_timeout() const noexcept;
+
+  /**
+   * @brief Sets the maximum number of idle connections kept alive at the
+   * request of a FastCGI client. A value of `0` disables the reuse of
+   * connections, so each connection is closed after the request is served.
+   *
+   * @returns The reference to this instance.
+   */
+  DMITIGR_FCGI_API Listener_options&
+  set_max_idle_connections(std::size_t count) noexcept;
+
+  /**
+   * @returns The maximum number of idle connections kept alive.
+   * By default it's 64.
+   */
+  DMITIGR_FCGI_API std::size_t max_idle_connections() const noexcept;
+
+  /**
+   * @brief Enables or disables the multiplexing of requests.
+   *
+   * @details In the multiplexing mode each connection can carry several
+   * concurrent requests (`FCGI_MPXS_CONNS=1` is reported to a FastCGI
+   * client). Records of the requests are dispatched to the per-request
+   * buffers, and a request is accepted only when all of its input (i.e.
+   * parameters and content) is received. Connections are never closed
+   * while the client keeps them open, apart of idling longer than non-zero
+   * `idle_timeout()`. `FCGI_MAX_CONNS` is reported as
+   * `max_idle_connections()`.
+   *
+   * @returns The reference to this instance.
+   */
+  DMITIGR_FCGI_API Listener_options& set_multiplexing(bool value) noexcept;
+
+  /**
+   * @returns `true` if the multiplexing of requests is enabled.
+   * By default it's disabled.
+   */
+  DMITIGR_FCGI_API bool is_multiplexing() const noexcept;
+
+  /**
+   * @brief Sets the maximum number of concurrent requests per connection in
+   * the multiplexing mode (reported to a FastCGI client as `FCGI_MAX_REQS`).
+   * Requests above this limit are rejected as overloaded.
+   *
+   * @par Requires
+   * `(count > 0)`.
+   *
+   * @returns The reference to this instance.
+   */
+  DMITIGR_FCGI_API Listener_options&
+  set_max_multiplexed_requests(std::size_t count);
+
+  /**
+   * @returns The maximum number of concurrent requests per connection in
+   * the multiplexing mode. By default it's 64.
+   */
+  DMITIGR_FCGI_API std::size_t max_multiplexed_requests() const noexcept;
+
+  /**
+   * @brief Sets the maximum amount of time to receive the remaining data
+   * from a client upon the close of a connection.
+   *
+   * @details The connections are closed gracefully in the background (see
+   * `net::Reaper`), so the serving of requests is never delayed by the close.
+   * A value of zero means closing without draining.
+   *
+   * @par Requires
+   * `(timeout >= std::chrono::milliseconds::zero())`.
+   *
+   * @returns The reference to this instance.
+   */
+  DMITIGR_FCGI_API Listener_options&
+  set_linger_timeout(std::chrono::milliseconds timeout);
+
+  /**
+   * @returns The maximum amount of time to drain a connection being closed.
+   * By default it's 1 second.
+   */
+  DMITIGR_FCGI_API std::chrono::milliseconds linger_timeout() const noexcept;
+
+  /**
+   * @brief Sets the size of the buffer of the input stream of a connection.
+   *
+   * @par Requires
+   * `(2048 <= size && size <= 65528)`.
+   *
+   * @returns The reference to this instance.
+   */
+  DMITIGR_FCGI_API Listener_options& set_in_buffer_size(std::size_t size);
+
+  /**
+   * @returns The size of the buffer of the input stream of a connection.
+   * By default it's 16384.
+   */
+  DMITIGR_FCGI_API std::size_t in_buffer_size() const noexcept;
+
+  /**
+   * @brief Sets the size of the buffer of the output stream of a connection.
+   *
+   * @details The size limits the size of the records sent to a client.
+   *
+   * @par Requires
+   * `(2048 <= size && size <= 65528)`.
+   *
+   * @returns The reference to this instance.
+   */
+  DMITIGR_FCGI_API Listener_options& set_out_buffer_size(std::size_t size);
+
+  /**
+   * @returns The size of the buffer of the output stream of a connection.
+   * By default it's 65528.
+   */
+  DMITIGR_FCGI_API std::size_t out_buffer_size() const noexcept;
+
+  /**
+   * @brief Sets the size of the buffer of the error stream of a connection.
+   *
+   * @details The buffer is allocated upon the first output to the stream.
+   *
+   * @par Requires
+   * `(2048 <= size && size <= 65528)`.
+   *
+   * @returns The reference to this instance.
+   */
+  DMITIGR_FCGI_API Listener_options& set_err_buffer_size(std::size_t size);
+
+  /**
+   * @returns The size of the buffer of the error stream of a connection.
+   * By default it's 8192.
+   */
+  DMITIGR_FCGI_API std::size_t err_buffer_size() const noexcept;
+
+  /**
+   * @brief Sets the maximum number of the free buffers of each size kept by
+   * the listener to be reused by the subsequent connections.
+   *
+   * @returns The reference to this instance.
+   */
+  DMITIGR_FCGI_API Listener_options&
+  set_max_pooled_buffers(std::size_t count) noexcept;
+
+  /**
+   * @returns The maximum number of the free buffers of each size kept for
+   * reuse. By default it's 64.
+   */
+  DMITIGR_FCGI_API std::size_t max_pooled_buffers() const noexcept;
+
+  /**
+   * @brief Sets the flush policy of the output streams of a connection.
+   *
+   * @details Flush_policy::coalesce makes the output of a response to be
+   * transmitted in as few records as the size of the buffer allows, even if
+   * the stream is flushed (e.g. by `std::endl`) many times.
+   *
+   * @returns The reference to this instance.
+   *
+   * @see Ostream::set_flush_policy().
+   */
+  DMITIGR_FCGI_API Listener_options&
+  set_flush_policy(Flush_policy value) noexcept;
+
+  /**
+   * @returns The flush policy of the output streams of a connection.
+   * By default it's Flush_policy::sync.
+   */
+  DMITIGR_FCGI_API Flush_policy flush_policy() const noexcept;
+
 private:
   friend Listener;
 
   net::Listener_options options_;
+  std::chrono::milliseconds idle_timeout_{std::chrono::seconds{60}};
+  std::size_t max_idle_connections_{64};
+  bool is_multiplexing_{};
+  std::size_t max_multiplexed_requests_{64};
+  std::chrono::milliseconds linger_timeout_{std::chrono::seconds{1}};
+  std::size_t in_buffer_size_{16384};
+  std::size_t out_buffer_size_{65528};
+  std::size_t err_buffer_size_{8192};
+  std::size_t max_pooled_buffers_{64};
+  Flush_policy flush_policy_{Flush_policy::sync};
 };
 
 } // namespace dmitigr::fcgi
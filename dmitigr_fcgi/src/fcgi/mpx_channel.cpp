@@ -0,0 +1,637 @@
+// -*- C++ -*-
+//
+// Copyright 2022 Dmitry Igrishin
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "../base/assert.hpp"
+#include "../net/descriptor.hpp"
+#include "../net/reaper.hpp"
+#include "../net/socket.hpp"
+#include "basics.hpp"
+#include "exceptions.hpp"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace dmitigr::fcgi::detail {
+
+/**
+ * @brief A connection which carries several concurrent requests.
+ *
+ * @details The records received from a FastCGI client are dispatched to the
+ * per-request buffers by the request identifiers, and the management records
+ * are responded immediately. A request is ready to be served when all of its
+ * input is received, i.e. upon receiving the empty record of the last input
+ * stream of the request role.
+ *
+ * The underlying connection is switched to the non-blocking mode, so the
+ * channel can be waited by edge-triggered net::Reactor.
+ *
+ * The records are received by the thread of the Listener, while the requests
+ * can be served by other threads. Thus, the transmission and the state which
+ * is changed upon the finish of a request are guarded by the mutex.
+ *
+ * The thread of the Listener never blocks on the connection: the records it
+ * responds with are queued if they cannot be written at once, and written as
+ * the connection becomes writable (or by the next transmission of a request).
+ * A serving thread waits for the client to read at most `write_timeout` at a
+ * time, after which the channel is broken.
+ *
+ * The buffered input is limited by `max_request_input` per request and by
+ * `max_channel_input` per channel. The request which exceeds either limit is
+ * ended as overloaded.
+ */
+class Mpx_channel final : public std::enable_shared_from_this<Mpx_channel> {
+public:
+  /// A clock of the channel.
+  using Clock = std::chrono::steady_clock;
+
+  /// The longest wait for the client to read before the channel is broken.
+  static constexpr std::chrono::seconds write_timeout{10};
+
+  /// The maximum size of the buffered input of a request.
+  static constexpr std::size_t max_request_input{1024 * 1024};
+
+  /// The maximum size of the buffered input of all requests of a channel.
+  static constexpr std::size_t max_channel_input{8 * 1024 * 1024};
+
+  /// The maximum size of the queued records of the thread of the Listener.
+  static constexpr std::size_t max_queued_output{64 * 1024};
+
+  /// The destructor. Closes the connection by using the reaper.
+  ~Mpx_channel()
+  {
+    if (reaper_) {
+      if (auto* const sio = dynamic_cast<net::detail::socket_Descriptor*>(io_.get()))
+        reaper_->reap(sio->release());
+    }
+  }
+
+  /**
+   * @brief The constructor.
+   *
+   * @param reaper The closer of the connection. If null, the connection is
+   * closed by the destructor of `io`.
+   */
+  Mpx_channel(std::unique_ptr<net::Descriptor> io,
+    std::shared_ptr<net::Reaper> reaper,
+    const std::size_t max_connections, const std::size_t max_requests)
+    : io_{std::move(io)}
+    , reaper_{std::move(reaper)}
+    , max_connections_{max_connections}
+    , max_requests_{max_requests}
+    , last_activity_{Clock::now()}
+  {
+    DMITIGR_ASSERT(io_ && max_requests_ > 0);
+    io_->set_non_blocking(true);
+  }
+
+  /// @returns The native handle of the underlying connection.
+  std::intptr_t native_handle() const
+  {
+    return io_->native_handle();
+  }
+
+  /// @returns The number of requests which are being either received or served.
+  std::size_t request_count() const
+  {
+    const std::lock_guard lg{mutex_};
+    return requests_.size() + served_request_count_;
+  }
+
+  /**
+   * @returns `true` if the channel is of no use anymore, i.e. either the
+   * client closed the connection, or the channel is broken, or the client
+   * does not read the queued records for `write_timeout`, or the client asked
+   * to close the connection after responding and there are no more requests.
+   */
+  bool is_done() const
+  {
+    const std::lock_guard lg{mutex_};
+    return is_eof_ || is_broken_ ||
+      (!queued_.empty() && !is_writing_ &&
+        queued_progress_ + write_timeout <= Clock::now()) ||
+      (is_closing_ && !requests_.size() && !served_request_count_ &&
+        queued_.empty());
+  }
+
+  /// @returns `true` if there are queued records which are not written yet.
+  bool is_output_queued() const
+  {
+    const std::lock_guard lg{mutex_};
+    return !queued_.empty();
+  }
+
+  /**
+   * @returns `true` if the Listener waits for the connection to be writable.
+   *
+   * @remarks For the thread of the Listener only.
+   */
+  bool is_write_waited() const noexcept
+  {
+    return is_write_waited_;
+  }
+
+  /// @see is_write_waited().
+  void set_write_waited(const bool value) noexcept
+  {
+    is_write_waited_ = value;
+  }
+
+  /// @returns The time point of the last activity on the channel.
+  Clock::time_point last_activity() const
+  {
+    const std::lock_guard lg{mutex_};
+    return last_activity_;
+  }
+
+  /**
+   * @brief Receives all of the available data and dispatches the complete
+   * records.
+   *
+   * @param ready The queue to put the descriptors of the requests which are
+   * ready to be served.
+   *
+   * @throws Exception on protocol violation.
+   */
+  void receive(std::deque<std::unique_ptr<net::Descriptor>>& ready);
+
+  /**
+   * @brief Writes as much of the queued records as possible without blocking.
+   *
+   * @details Called by the thread of the Listener when the connection is
+   * writable.
+   */
+  void flush()
+  {
+    const std::lock_guard lg{mutex_};
+    if (!is_writing_)
+      write_queued();
+  }
+
+  /**
+   * @brief Transmits `size` bytes of `data` to the client.
+   *
+   * @details Blocks while the send buffer of the connection is full, but no
+   * longer than `write_timeout` without progress.
+   *
+   * @throws Exception if the channel is broken, or becomes broken.
+   */
+  void transmit(const char* const data, const std::streamsize size)
+  {
+    DMITIGR_ASSERT(data && size >= 0);
+    net::Io_slice slice{data, static_cast<std::size_t>(size)};
+    transmit(&slice, 1);
+  }
+
+  /**
+   * @overload
+   *
+   * @details The slices are transmitted as a whole, i.e. the records of the
+   * other requests are never interleaved with them.
+   *
+   * @par Effects
+   * The `slices` are consumed.
+   */
+  void transmit(net::Io_slice* slices, std::size_t count)
+  {
+    DMITIGR_ASSERT(slices || !count);
+    std::unique_lock lock{mutex_};
+    writer_released_.wait(lock, [this]{ return !is_writing_; });
+    if (is_broken_)
+      throw Exception{"cannot transmit FastCGI record to broken channel"};
+
+    // The mutex is released while writing, so the Listener only queues.
+    is_writing_ = true;
+    try {
+      // The queued records may be written partially, so they go first.
+      transmit_queued(lock);
+      lock.unlock();
+      write_all(slices, count);
+      lock.lock();
+      transmit_queued(lock);
+    } catch (...) {
+      if (!lock.owns_lock())
+        lock.lock();
+      is_broken_ = true;
+      is_writing_ = false;
+      writer_released_.notify_one();
+      throw;
+    }
+    is_writing_ = false;
+    writer_released_.notify_one();
+  }
+
+  /**
+   * @brief Notifies the channel that the request is served.
+   *
+   * @param is_keep_conn The value of `keep_conn` flag of the request.
+   */
+  void finish(const bool is_keep_conn) noexcept
+  {
+    const std::lock_guard lg{mutex_};
+    DMITIGR_ASSERT(served_request_count_ > 0);
+    --served_request_count_;
+    if (!is_keep_conn)
+      is_closing_ = true;
+    last_activity_ = Clock::now();
+  }
+
+private:
+  /// A request which input is being received.
+  struct Request final {
+    std::string input; // begin-request record followed by the stream records
+    Role role{};
+    bool is_keep_conn{};
+  };
+
+  std::unique_ptr<net::Descriptor> io_;
+  std::shared_ptr<net::Reaper> reaper_;
+  std::size_t max_connections_{};
+  std::size_t max_requests_{};
+  std::string buffer_;
+  std::unordered_map<int, Request> requests_;
+  std::size_t input_size_{}; // of requests_
+  std::size_t served_request_count_{};
+  bool is_eof_{};
+  bool is_closing_{};
+  bool is_broken_{};
+  bool is_writing_{};
+  bool is_write_waited_{};
+  std::string queued_;
+  Clock::time_point queued_progress_;
+  Clock::time_point last_activity_;
+  mutable std::mutex mutex_;
+  std::condition_variable writer_released_;
+
+  /// Dispatches the complete records of `buffer_` and removes them.
+  void dispatch_records(std::deque<std::unique_ptr<net::Descriptor>>& ready);
+
+  /// Dispatches the `record` with the given `header`.
+  void dispatch(const Header& header, std::string_view record,
+    std::deque<std::unique_ptr<net::Descriptor>>& ready);
+
+  /// Forgets the request denoted by `i`.
+  void erase_request(const decltype(requests_)::iterator i)
+  {
+    input_size_ -= i->second.input.size();
+    const std::lock_guard lg{mutex_};
+    requests_.erase(i);
+  }
+
+  /**
+   * @brief Writes the `count` slices entirely.
+   *
+   * @throws Exception if the client does not read for `write_timeout`.
+   */
+  void write_all(net::Io_slice* slices, std::size_t count)
+  {
+    using Sr = net::Socket_readiness;
+    const auto socket = static_cast<net::Socket_native>(io_->native_handle());
+    while (count) {
+      const auto written = io_->write_gathered(slices, count);
+      if (written < 0) {
+        if (net::poll(socket, Sr::write_ready, write_timeout) == Sr::unready)
+          throw Exception{"cannot transmit FastCGI record: client does not read"};
+        continue;
+      } else if (!written && slices->size)
+        throw Exception{"cannot transmit FastCGI record"};
+      net::consume(slices, count, static_cast<std::size_t>(written));
+    }
+  }
+
+  /**
+   * @brief Writes the queued records entirely.
+   *
+   * @par Requires
+   * `lock` owns the mutex, which is released meanwhile, and `is_writing_`.
+   */
+  void transmit_queued(std::unique_lock<std::mutex>& lock)
+  {
+    while (!queued_.empty()) {
+      std::string records;
+      records.swap(queued_);
+      lock.unlock();
+      net::Io_slice slice{records.data(), records.size()};
+      write_all(&slice, 1);
+      lock.lock();
+    }
+  }
+
+  /**
+   * @brief Writes as much of the queued records as possible without blocking.
+   *
+   * @par Requires
+   * The mutex is locked and `!is_writing_`.
+   */
+  void write_queued()
+  {
+    std::size_t offset{};
+    while (offset < queued_.size()) {
+      const auto written = io_->write(queued_.data() + offset,
+        static_cast<std::streamsize>(queued_.size() - offset));
+      if (written < 0)
+        break;
+      else if (!written)
+        throw Exception{"cannot transmit FastCGI record"};
+      offset += static_cast<std::size_t>(written);
+    }
+    if (offset) {
+      queued_.erase(0, offset);
+      queued_progress_ = Clock::now();
+    }
+  }
+
+  /**
+   * @brief Queues `size` bytes of `data` to the client, and writes as much of
+   * the queue as possible without blocking.
+   *
+   * @details Used by the thread of the Listener instead of transmit().
+   */
+  void post(const char* const data, const std::size_t size)
+  {
+    const std::lock_guard lg{mutex_};
+    if (is_broken_)
+      return;
+    else if (queued_.size() + size > max_queued_output) {
+      is_broken_ = true; // the client does not read its responses
+      return;
+    }
+
+    if (queued_.empty())
+      queued_progress_ = Clock::now();
+    queued_.append(data, size);
+    if (!is_writing_)
+      write_queued();
+  }
+
+  /// Posts the end-request record.
+  void end_request(const int request_id, const Protocol_status protocol_status)
+  {
+    const End_request_record record{request_id, 0, protocol_status};
+    post(reinterpret_cast<const char*>(&record), sizeof(record));
+  }
+};
+
+/// The descriptor of a request carried by Mpx_channel.
+class mpx_Descriptor final : public net::detail::iDescriptor {
+public:
+  /// The destructor.
+  ~mpx_Descriptor() override
+  {
+    close();
+  }
+
+  /**
+   * @brief The constructor.
+   *
+   * @param channel The channel which carries the request.
+   * @param input The records of the request starting from the begin-request
+   * record.
+   * @param is_keep_conn The value of `keep_conn` flag of the request.
+   */
+  mpx_Descriptor(std::shared_ptr<Mpx_channel> channel, std::string input,
+    const bool is_keep_conn)
+    : channel_{std::move(channel)}
+    , input_{std::move(input)}
+    , is_keep_conn_{is_keep_conn}
+  {
+    DMITIGR_ASSERT(channel_);
+  }
+
+  std::streamsize read(char* const buf, std::streamsize len) override
+  {
+    if (!buf)
+      throw Exception{"cannot read FastCGI request to null buffer"};
+
+    len = std::min(len, static_cast<std::streamsize>(input_.size() - offset_));
+    std::memcpy(buf, input_.data() + offset_, static_cast<std::size_t>(len));
+    offset_ += static_cast<std::size_t>(len);
+    return len;
+  }
+
+  std::streamsize write(const char* const buf, const std::streamsize len) override
+  {
+    if (!buf)
+      throw Exception{"cannot write FastCGI response from null buffer"};
+    else if (!channel_)
+      throw Exception{"cannot write FastCGI response to closed channel"};
+
+    channel_->transmit(buf, len);
+    return len;
+  }
+
+  std::streamsize write_gathered(const net::Io_slice* const slices,
+    const std::size_t count) override
+  {
+    if (!slices && count)
+      throw Exception{"cannot write FastCGI response from null slices"};
+    else if (!channel_)
+      throw Exception{"cannot write FastCGI response to closed channel"};
+
+    // The slices are consumed by the channel, so they are copied.
+    std::vector<net::Io_slice> copy{slices, slices + count};
+    std::streamsize result{};
+    for (const auto& slice : copy)
+      result += static_cast<std::streamsize>(slice.size);
+    channel_->transmit(copy.data(), copy.size());
+    return result;
+  }
+
+  void close() noexcept override
+  {
+    if (channel_) {
+      channel_->finish(is_keep_conn_);
+      channel_.reset();
+    }
+  }
+
+  std::intptr_t native_handle() override
+  {
+    return channel_ ? channel_->native_handle() : -1;
+  }
+
+private:
+  std::shared_ptr<Mpx_channel> channel_;
+  std::string input_;
+  std::size_t offset_{};
+  bool is_keep_conn_{};
+};
+
+inline void
+Mpx_channel::receive(std::deque<std::unique_ptr<net::Descriptor>>& ready)
+{
+  std::array<char, 16384> chunk;
+  bool is_read{};
+  bool is_eof{};
+  while (!is_eof) {
+    const auto count = io_->read(chunk.data(), chunk.size());
+    if (count < 0)
+      break; // drained
+    else if (!count)
+      is_eof = true;
+    else {
+      /*
+       * The records are dispatched as they arrive, so the buffer never holds
+       * more than a chunk and an incomplete record.
+       */
+      buffer_.append(chunk.data(), static_cast<std::size_t>(count));
+      dispatch_records(ready);
+    }
+    is_read = true;
+  }
+
+  const std::lock_guard lg{mutex_};
+  if (is_read)
+    last_activity_ = Clock::now();
+  if (is_eof) {
+    // The requests which input is incomplete are never served.
+    requests_.clear();
+    input_size_ = 0;
+    is_eof_ = true;
+  }
+}
+
+inline void
+Mpx_channel::dispatch_records(std::deque<std::unique_ptr<net::Descriptor>>& ready)
+{
+  std::size_t offset{};
+  while (buffer_.size() - offset >= sizeof(Header)) {
+    Header header;
+    std::memcpy(&header, buffer_.data() + offset, sizeof(header));
+    header.check_validity();
+    const auto record_size = sizeof(Header) + header.content_length() +
+      header.padding_length();
+    if (buffer_.size() - offset < record_size)
+      break;
+
+    dispatch(header, std::string_view{buffer_.data() + offset, record_size},
+      ready);
+    offset += record_size;
+  }
+  buffer_.erase(0, offset);
+}
+
+inline void Mpx_channel::dispatch(const Header& header,
+  const std::string_view record,
+  std::deque<std::unique_ptr<net::Descriptor>>& ready)
+{
+  const auto content = record.substr(sizeof(Header), header.content_length());
+  const auto request_id = header.request_id();
+
+  if (header.is_management_record()) {
+    if (header.record_type() == Record_type::get_values) {
+      std::istringstream stream{std::string{content}};
+      const Names_values variables{stream, 3};
+      const auto result = make_get_values_result_record(variables,
+        max_connections_, max_requests_, true);
+      post(result.data(), result.size());
+    } else {
+      const Unknown_type_record result{header.record_type()};
+      post(reinterpret_cast<const char*>(&result), sizeof(result));
+    }
+    return;
+  }
+
+  const auto make_ready = [&](const auto i)
+  {
+    input_size_ -= i->second.input.size();
+    ready.push_back(std::make_unique<mpx_Descriptor>(shared_from_this(),
+      std::move(i->second.input), i->second.is_keep_conn));
+    const std::lock_guard lg{mutex_};
+    requests_.erase(i);
+    ++served_request_count_;
+  };
+
+  switch (header.record_type()) {
+  case Record_type::begin_request: {
+    if (content.size() != sizeof(Begin_request_body) || requests_.count(request_id))
+      throw Exception{"FastCGI protocol violation"};
+
+    if (!(request_count() < max_requests_)) {
+      end_request(request_id, Protocol_status::overloaded);
+      return;
+    }
+
+    Begin_request_body body;
+    std::memcpy(&body, content.data(), sizeof(body));
+    input_size_ += record.size();
+    const auto i = [&]
+    {
+      const std::lock_guard lg{mutex_};
+      return requests_.emplace(request_id,
+        Request{std::string{record}, body.role(), body.is_keep_conn()}).first;
+    }();
+
+    // The request of unknown role is rejected by the Listener.
+    const auto role = body.role();
+    if (role != Role::responder && role != Role::authorizer &&
+      role != Role::filter)
+      make_ready(i);
+    break;
+  }
+  case Record_type::abort_request:
+    if (const auto i = requests_.find(request_id); i != cend(requests_)) {
+      if (!i->second.is_keep_conn) {
+        const std::lock_guard lg{mutex_};
+        is_closing_ = true;
+      }
+      erase_request(i);
+      end_request(request_id, Protocol_status::request_complete);
+    } // Otherwise the request is either unknown or served already.
+    break;
+  case Record_type::params:
+  case Record_type::in:
+  case Record_type::data:
+    if (const auto i = requests_.find(request_id); i != cend(requests_)) {
+      if (i->second.input.size() + record.size() > max_request_input ||
+        input_size_ + record.size() > max_channel_input) {
+        // The rest of its records are discarded, since it is unknown then.
+        erase_request(i);
+        end_request(request_id, Protocol_status::overloaded);
+        break;
+      }
+      i->second.input.append(record);
+      input_size_ += record.size();
+
+      // The request is ready upon the end of the last stream of its role.
+      const auto last_stream = [role = i->second.role]
+      {
+        switch (role) {
+        case Role::authorizer: return Record_type::params;
+        case Role::filter: return Record_type::data;
+        default: return Record_type::in;
+        }
+      }();
+      if (header.record_type() == last_stream && !header.content_length())
+        make_ready(i);
+    } // Otherwise the record is discarded.
+    break;
+  default:
+    throw Exception{"FastCGI protocol violation"};
+  }
+}
+
+} // namespace dmitigr::fcgi::detail
@@ -15,24 +15,43 @@
 // limitations under the License.
 
 #include "../base/assert.hpp"
+#include "../net/descriptor.hpp"
 #include "basics.hpp"
 #include "exceptions.hpp"
 #include "server_connection.hpp"
 
+#include <ios>
+#include <utility>
+
 namespace dmitigr::fcgi::detail {
 
 /// The base implementation of the Server_connection.
 class iServer_connection : public Server_connection {
 public:
+  /**
+   * @brief The destructor. Passes the underlying connection back to the
+   * listener on every path (see release_io()).
+   *
+   * @details Runs after the streams of the derived class are destroyed, so
+   * they never write to a connection which is released already.
+   */
+  ~iServer_connection() override
+  {
+    release_io();
+  }
+
   /// The constructor.
   explicit iServer_connection(std::unique_ptr<net::Descriptor> io,
-    const Role role, const int request_id, const bool is_keep_connection)
+    Listener* const listener, const Role role, const int request_id,
+    const bool is_keep_connection, const std::size_t read_count = 0)
     : is_keep_connection_{is_keep_connection}
     , role_{role}
     , request_id_{request_id}
+    , read_count_{read_count}
+    , listener_{listener}
   {
     io_ = std::move(io);
-    DMITIGR_ASSERT(io_);
+    DMITIGR_ASSERT(io_ && listener_);
   }
 
   // ---------------------------------------------------------------------------
@@ -101,14 +120,86 @@ public:
     return is_keep_connection_;
   }
 
+protected:
+  /**
+   * @brief Denotes that the connection can be reused for a next request
+   * (provided that the client asked for it).
+   *
+   * @remarks Should be called upon closing of the connection.
+   */
+  void set_io_reusable(const bool value) noexcept
+  {
+    is_io_reusable_ = value;
+  }
+
+  /**
+   * @brief Passes the underlying connection back to the listener if it can
+   * be reused for a next request, or closes it otherwise.
+   *
+   * @remarks The connection is passed back only if the client asked to keep
+   * it by setting `FCGI_KEEP_CONN` flag, and only if it's reusable.
+   */
+  void release_io() noexcept; // defined in listener.cpp
+
+  /// Reads from the underlying connection and counts the call.
+  std::streamsize read_io(char* const buf, const std::streamsize len)
+  {
+    ++read_count_;
+    return io_->read(buf, len);
+  }
+
+  /// Writes to the underlying connection and counts the call.
+  std::streamsize write_io(const char* const buf, const std::streamsize len)
+  {
+    ++write_count_;
+    return io_->write(buf, len);
+  }
+
+  /**
+   * @brief Writes the `slices` which constitute `record_count` records to the
+   * underlying connection entirely and counts the calls and the records.
+   *
+   * @par Effects
+   * The `slices` are consumed.
+   */
+  void write_io(net::Io_slice* slices, std::size_t count,
+    const std::size_t record_count)
+  {
+    record_count_ += record_count;
+    while (count) {
+      ++write_count_;
+      const auto written = io_->write_gathered(slices, count);
+      if (written <= 0)
+        throw Exception{"cannot write FastCGI records"};
+      net::consume(slices, count, static_cast<std::size_t>(written));
+    }
+  }
+
 private:
+  /**
+   * @returns The buffer for the output stream of the given `type` which is
+   * constructed without the buffer.
+   *
+   * @see server_Streambuf::server_Streambuf().
+   */
+  virtual std::pair<char*, std::streamsize> deferred_buffer(Stream_type type)
+  {
+    (void)type;
+    throw Exception{"FastCGI stream has no buffer"};
+  }
+
   friend server_Istream;
   friend server_Streambuf;
 
   bool is_keep_connection_{};
+  bool is_io_reusable_{};
   Role role_{};
   int request_id_{};
   int application_status_{};
+  std::size_t read_count_{}; // including the reads of Listener::accept()
+  std::size_t write_count_{};
+  std::size_t record_count_{};
+  Listener* listener_{};
   std::unique_ptr<net::Descriptor> io_;
   detail::Names_values parameters_;
 };
@@ -18,6 +18,9 @@
 #define DMITIGR_FCGI_SERVER_CONNECTION_HPP
 
 #include "connection.hpp"
+#include "framed_output.hpp"
+
+#include <memory>
 
 namespace dmitigr::fcgi {
 
@@ -33,6 +36,18 @@ public:
   /// @returns The output stream, associated with the error data stream.
   virtual Ostream& err() noexcept = 0;
 
+  /**
+   * @brief Writes the `output` to the output data stream after the data
+   * written to out() before.
+   *
+   * @details The records of `output` are transmitted without copying them
+   * to the buffer of the stream, along with the buffered data (if any).
+   *
+   * @par Requires
+   * `!out().is_closed()`.
+   */
+  virtual void write_framed(std::shared_ptr<const Framed_output> output) = 0;
+
   /**
    * @returns The application status code for transmitting to the client
    * upon closing the connection. By default the returned value is `0`.
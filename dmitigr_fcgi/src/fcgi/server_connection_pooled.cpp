@@ -0,0 +1,198 @@
+// -*- C++ -*-
+//
+// Copyright 2022 Dmitry Igrishin
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "../base/assert.hpp"
+#include "basics.hpp"
+#include "buffer_pool.cpp"
+#include "exceptions.hpp"
+#include "server_connection.hpp"
+#include "streams.hpp"
+
+#include <cstdio>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <utility>
+
+namespace dmitigr::fcgi::detail {
+
+/**
+ * @brief The Server_connection implementation based on the buffers of
+ * Buffer_pool.
+ *
+ * @details The buffer of Stream_type::err is acquired upon the first output
+ * to the stream, since it's rarely used.
+ */
+class pooled_buffers_Server_connection final : public iServer_connection {
+public:
+  /// The sizes of the buffers of the output streams.
+  struct Buffer_sizes final {
+    std::size_t out{};
+    std::size_t err{};
+  };
+
+  ~pooled_buffers_Server_connection() override
+  {
+    try {
+      close();
+    } catch (const std::exception& e) {
+      set_io_reusable(false);
+      std::clog << "error upon closing FastCGI connection: " << e.what() << "\n";
+    } catch (...) {
+      set_io_reusable(false);
+      std::clog << "unknown error upon closing FastCGI connection\n";
+    }
+
+    /*
+     * The connection is passed back to the Listener by the destructor of
+     * iServer_connection, after the streams are destroyed.
+     */
+  }
+
+  /**
+   * @brief The constructor.
+   *
+   * @param flush_policy The flush policy of the output streams.
+   * @param in_buffer The buffer of Stream_type::in which contains the input
+   * read ahead by the Listener.
+   * @param in_offset The offset of the first byte in `in_buffer` following
+   * the begin-request record.
+   * @param in_size The size of the input in `in_buffer`.
+   * @param read_count The number of reads performed to get the input.
+   */
+  explicit pooled_buffers_Server_connection(std::unique_ptr<net::Descriptor> io,
+    Listener* const listener,
+    const Role role,
+    const int request_id,
+    const bool is_keep_connection,
+    Buffer_pool& buffer_pool,
+    const Buffer_sizes& buffer_sizes,
+    const Flush_policy flush_policy,
+    Buffer_pool::Buffer in_buffer,
+    const std::size_t in_offset,
+    const std::size_t in_size,
+    const std::size_t read_count)
+    : iServer_connection{std::move(io), listener, role, request_id,
+      is_keep_connection, read_count}
+    , in_buffer_{std::move(in_buffer)}
+    , out_buffer_{buffer_pool.acquire(buffer_sizes.out)}
+    , err_buffer_size_{buffer_sizes.err}
+    , buffer_pool_{buffer_pool.shared_from_this()}
+    , in_{this, in_buffer_.data(),
+      static_cast<std::streamsize>(in_buffer_.size()),
+      static_cast<std::streamsize>(in_offset),
+      static_cast<std::streamsize>(in_size)}
+    , out_{this, out_buffer_.data(),
+      static_cast<std::streamsize>(out_buffer_.size()), Stream_type::out}
+    , err_{this, nullptr, 0, Stream_type::err}
+  {
+    DMITIGR_ASSERT(err_buffer_size_ <= static_cast<std::size_t>(
+        std::numeric_limits<std::streamsize>::max()));
+    out_.set_flush_policy(flush_policy);
+    err_.set_flush_policy(flush_policy);
+  }
+
+  // ---------------------------------------------------------------------------
+  // Connection overridings
+  // ---------------------------------------------------------------------------
+
+  void close() override
+  {
+    /*
+     * Begin_request_body::Flags::keep_conn flag has no effect if any stream
+     * is bad, or if the unread input cannot be discarded up to the start of
+     * a next record. Note, that the input must be discarded before the
+     * end-request record is transmitted, since the client is allowed to
+     * send a next request right after receiving it.
+     */
+    if (is_keep_connection() && !in().is_closed()) {
+      const bool is_streams_ok = !err().bad() && !out().bad() && !in().bad();
+      set_io_reusable(is_streams_ok &&
+        in().streambuf().discard_unread_input());
+    }
+
+    // Attention: the order is important!
+    err().streambuf().close();
+    out().streambuf().close();
+    in().streambuf().close();
+  }
+
+  bool is_closed() const noexcept override
+  {
+    return (err().is_closed() && out().is_closed() && in().is_closed());
+  }
+
+  // ---------------------------------------------------------------------------
+  // Server_connection overridings
+  // ---------------------------------------------------------------------------
+
+  const server_Istream& in() const noexcept
+  {
+    return in_;
+  }
+
+  server_Istream& in() noexcept override
+  {
+    return in_;
+  }
+
+  const server_Ostream& out() const noexcept
+  {
+    return out_;
+  }
+
+  server_Ostream& out() noexcept override
+  {
+    return out_;
+  }
+
+  const server_Ostream& err() const noexcept
+  {
+    return err_;
+  }
+
+  server_Ostream& err() noexcept override
+  {
+    return err_;
+  }
+
+  void write_framed(std::shared_ptr<const Framed_output> output) override
+  {
+    out_.streambuf().write_framed(std::move(output));
+  }
+
+private:
+  // The buffers must outlive the streams.
+  Buffer_pool::Buffer in_buffer_;
+  Buffer_pool::Buffer out_buffer_;
+  Buffer_pool::Buffer err_buffer_;
+  std::size_t err_buffer_size_{};
+  std::shared_ptr<Buffer_pool> buffer_pool_;
+
+  server_Istream in_;
+  server_Ostream out_;
+  server_Ostream err_;
+
+  std::pair<char*, std::streamsize>
+  deferred_buffer(const Stream_type type) override
+  {
+    DMITIGR_ASSERT(type == Stream_type::err && !err_buffer_.data());
+    err_buffer_ = buffer_pool_->acquire(err_buffer_size_);
+    return {err_buffer_.data(), static_cast<std::streamsize>(err_buffer_.size())};
+  }
+};
+
+} // namespace dmitigr::fcgi::detail
@@ -16,15 +16,20 @@
 
 #include "basics.hpp"
 #include "exceptions.hpp"
+#include "framed_output.hpp"
 #include "server_connection.hpp"
 #include "streambuf.hpp"
 #include "../base/assert.hpp"
 #include "../math/alignment.hpp"
+#include "../net/descriptor.hpp"
 
 #include <algorithm>
 #include <array>
 #include <iostream>
 #include <limits>
+#include <memory>
+#include <tuple>
+#include <utility>
 
 /*
  * By defining DMITIGR_FCGI_DEBUG some convenient stuff for debugging
@@ -59,7 +64,7 @@ public:
     try {
       close();
     } catch (const std::exception& e) {
-      std::clog << "error upon closing FastCGI stream buffer: %s\n" << e.what();
+      std::clog << "error upon closing FastCGI stream buffer: " << e.what() << "\n";
     } catch (...) {
       std::clog << "uknown error upon closing FastCGI stream buffer\n";
     }
@@ -72,6 +77,12 @@ public:
 
   /**
    * @brief The constructor.
+   *
+   * @details If `buffer` is null the stream buffer of the output stream
+   * obtains the buffer from the connection upon the first output (see
+   * iServer_connection::deferred_buffer()), so the buffer of the stream
+   * which is never written (usually, the stream of type Stream_type::err)
+   * is never allocated.
    */
   server_Streambuf(iServer_connection* const connection,
     char_type* const buffer, const std::streamsize buffer_size, const Type type)
@@ -81,7 +92,34 @@ public:
     DMITIGR_ASSERT(connection);
     setg(nullptr, nullptr, nullptr);
     setp(nullptr, nullptr);
-    setbuf(buffer, buffer_size);
+    if (!buffer && !is_reader())
+      is_buffer_deferred_ = true;
+    else
+      setbuf(buffer, buffer_size);
+    DMITIGR_ASSERT(is_invariant_ok());
+  }
+
+  /**
+   * @overload
+   *
+   * @details Constructs the stream buffer of the input stream which `buffer`
+   * already contains the data in range of [buffer, buffer + data_size), from
+   * which the first `data_offset` bytes are consumed. So the input which is
+   * read ahead by the Listener is not read from the connection again.
+   *
+   * @par Requires
+   * `is_reader() && (0 <= data_offset && data_offset <= data_size) &&
+   * (data_size <= buffer_size - buffer_size % 8)`.
+   */
+  server_Streambuf(iServer_connection* const connection,
+    char_type* const buffer, const std::streamsize buffer_size, const Type type,
+    const std::streamsize data_offset, const std::streamsize data_size)
+    : server_Streambuf{connection, buffer, buffer_size, type}
+  {
+    DMITIGR_ASSERT(is_reader() && (0 <= data_offset && data_offset <= data_size)
+      && (data_size <= buffer_size_));
+    buffer_end_ = buffer_ + data_size;
+    setg(buffer_ + data_offset, buffer_ + data_offset, buffer_ + data_offset);
     DMITIGR_ASSERT(is_invariant_ok());
   }
 
@@ -108,12 +146,19 @@ public:
       DMITIGR_ASSERT(inbuf.is_reader() && !inbuf.is_closed());
       const auto role = connection_->role();
       DMITIGR_ASSERT(role == Role::authorizer || inbuf.type_ != Type::params);
-      if (role != Role::filter ||
-        inbuf.type_ == Type::data || inbuf.unread_content_length_ == 0) {
-        is_end_records_must_be_transmitted_ = true;
-        sync();
-      } else
-        throw Exception{"not all FastCGI stdin has been read by Filter"};
+      /*
+       * The end of stream is set before the end records are written, so if
+       * the write failed (e.g. the client has gone) they are not retried by
+       * the next call, such as the one of the destructor.
+       */
+      if (!is_end_of_stream_) {
+        if (role != Role::filter ||
+          inbuf.type_ == Type::data || inbuf.unread_content_length_ == 0) {
+          is_end_records_must_be_transmitted_ = true;
+          transmit();
+        } else
+          throw Exception{"not all FastCGI stdin has been read by Filter"};
+      }
 
       DMITIGR_ASSERT(is_end_of_stream_ && !is_end_records_must_be_transmitted_);
     }
@@ -139,7 +184,79 @@ public:
    */
   bool is_closed() const
   {
-    return is_reader() ? !eback() : !pbase();
+    return is_reader() ? !eback() : (!pbase() && !is_buffer_deferred_);
+  }
+
+  /**
+   * @brief Discards the rest of the input data of the request.
+   *
+   * @returns `true` if the end of stream is reached and nothing beyond it
+   * has been read ahead from the FastCGI client, i.e. the underlying
+   * connection is positioned at the start of a next record.
+   *
+   * @par Requires
+   * `is_reader() && !is_closed()`.
+   */
+  bool discard_unread_input()
+  {
+    DMITIGR_ASSERT(is_reader() && !is_closed());
+    while (!is_end_of_stream_) {
+      setg(eback(), egptr(), egptr()); // Discarding the get area.
+      underflow();
+    }
+    return gptr() == buffer_end_;
+  }
+
+  /**
+   * @brief Queues the `output` to be transmitted after the data which is put
+   * before, and before the data which is put after.
+   *
+   * @details The output is transmitted along with the put area upon the next
+   * sync or overflow.
+   *
+   * @par Requires
+   * `!is_reader() && !is_closed()`.
+   */
+  void write_framed(std::shared_ptr<const Framed_output> output)
+  {
+    DMITIGR_ASSERT(!is_reader() && !is_closed());
+    if (is_end_of_stream_)
+      throw Exception{"cannot write to FastCGI stream after its end"};
+    else if (!output || !output->size())
+      return;
+
+    // Preserving the order of output.
+    if (framed_ || pptr() != pbase())
+      transmit();
+    framed_ = std::move(output);
+    DMITIGR_ASSERT(is_invariant_ok());
+  }
+
+  /**
+   * @brief Transmits the put area (and the queued framed output) to the
+   * FastCGI client regardless of the flush policy.
+   *
+   * @returns `0` on success, or `-1` otherwise.
+   *
+   * @par Requires
+   * `!is_reader() && !is_closed()`.
+   */
+  int transmit()
+  {
+    const auto ch = overflow(traits_type::eof());
+    return traits_type::eq_int_type(ch, traits_type::eof()) ? -1 : 0;
+  }
+
+  /// @returns The flush policy.
+  Flush_policy flush_policy() const noexcept
+  {
+    return flush_policy_;
+  }
+
+  /// Sets the flush policy.
+  void set_flush_policy(const Flush_policy value) noexcept
+  {
+    flush_policy_ = value;
   }
 
   /**
@@ -197,8 +314,9 @@ protected:
 
   int sync() override
   {
-    const auto ch = overflow(traits_type::eof());
-    return traits_type::eq_int_type(ch, traits_type::eof()) ? -1 : 0;
+    if (flush_policy_ == Flush_policy::coalesce && !is_reader())
+      return 0; // the put area is transmitted when it's full or upon close()
+    return transmit();
   }
 
   int_type underflow() override
@@ -213,7 +331,7 @@ protected:
     while (true) {
       // Reading the stream records.
       if (gptr() == buffer_end_) {
-        const std::streamsize count = connection_->io_->read(buffer_, buffer_size_);
+        const std::streamsize count = connection_->read_io(buffer_, buffer_size_);
         if (count > 0) {
           buffer_end_ = buffer_ + count;
           setg(buffer_, buffer_, buffer_end_);
@@ -320,15 +438,57 @@ protected:
 
     const bool is_eof = traits_type::eq_int_type(ch, traits_type::eof());
 
+    if (is_buffer_deferred_) {
+      if (is_eof && !is_end_records_must_be_transmitted_ && !framed_)
+        return traits_type::not_eof(ch); // nothing to sync
+      else if (is_eof && type_ == Type::err && !framed_) {
+        // The stream is empty, so no stderr records are transmitted.
+        is_buffer_deferred_ = false;
+        is_end_records_must_be_transmitted_ = false;
+        is_end_of_stream_ = true;
+        return traits_type::not_eof(ch);
+      }
+
+      const auto [buffer, buffer_size] = connection_->deferred_buffer(type_);
+      is_buffer_deferred_ = false;
+      setbuf(buffer, buffer_size);
+      if (!is_eof) {
+        *pptr() = static_cast<char>(ch);
+        pbump(1);
+        DMITIGR_ASSERT(is_invariant_ok());
+        return ch;
+      }
+    }
+
+    /*
+     * The content record, its padding and the end records are gathered to
+     * be written by the single operation.
+     */
+    static constexpr char padding[8]{};
+    std::array<net::Io_slice, 3 + 2 * max_framed_record_count> slices;
+    std::size_t slice_count{};
+    std::size_t record_count{};
+    std::array<char, sizeof(detail::Header) +
+      sizeof(detail::End_request_record)> end_records;
+
+    // The framed output is queued when the put area is empty.
+    const auto framed = std::move(framed_);
+    std::array<detail::Header, max_framed_record_count> framed_headers;
+    if (framed) {
+      std::tie(slice_count, record_count) = gather(*framed, slices.data(),
+        framed_headers.data());
+      is_put_area_at_least_once_consumed_ = true;
+    }
+
     DMITIGR_ASSERT(pbase() == (buffer_ + sizeof(detail::Header)));
     if (std::streamsize content_length = pptr() - pbase()) {
       /*
        * If `ch` is not EOF we need to place `ch` at the location pointed to by
        * pptr(). (It's ok if pptr() == epptr() since that location is a valid
        * writable location reserved for extra `ch`.)
-       * The content should be aligned by padding if necessary, and the record
-       * header must be injected at the reserved space [buffer_, pbase()).
-       * After that the result record will be ready to send to a client.
+       * The record header must be injected at the reserved space
+       * [buffer_, pbase()), and the content should be aligned by padding if
+       * necessary. After that the result record is ready to send to a client.
        */
 
       // Store `ch` if it's not EOF.
@@ -339,36 +499,27 @@ protected:
         content_length++;
       }
 
-      // Aligning the content by padding if necessary.
+      // Injecting the header.
       const auto padding_length =
         dmitigr::math::padding<std::streamsize>(content_length, 8);
-      DMITIGR_ASSERT(padding_length <= epptr() - pptr() + 1);
-      std::memset(pptr(), 0, static_cast<std::size_t>(padding_length));
-      pbump(static_cast<int>(padding_length));
-
-      // Injecting the header.
       auto* const header = reinterpret_cast<detail::Header*>(buffer_);
       *header = detail::Header{static_cast<detail::Record_type>(type_),
         connection_->request_id(),
         static_cast<std::size_t>(content_length),
         static_cast<std::size_t>(padding_length)};
 
-      // Sending the record.
-      if (const auto record_size = pptr() - buffer_;
-        static_cast<std::size_t>(record_size) > sizeof(detail::Header)) {
-        const std::streamsize count = connection_->io_->write(static_cast<const char*>(buffer_), record_size);
-        DMITIGR_ASSERT(count == record_size);
-        is_put_area_at_least_once_consumed_ = true;
-      }
+      slices[slice_count++] = {buffer_,
+        sizeof(detail::Header) + static_cast<std::size_t>(content_length)};
+      if (padding_length)
+        slices[slice_count++] = {padding, static_cast<std::size_t>(padding_length)};
+      ++record_count;
+      is_put_area_at_least_once_consumed_ = true;
     }
     setp(buffer_ + sizeof(detail::Header), buffer_ + buffer_size_ - 1);
 
     if (is_end_records_must_be_transmitted_) {
-      /*
-       * We'll use buffer_ directly here. (Space before pbase() will be used.)
-       * data_size is a size of data in the buffer_ to send.
-       */
-      std::streamsize data_size{};
+      // data_size is a size of data in the end_records to send.
+      std::size_t data_size{};
 
       const auto is_empty = [this]()
       {
@@ -384,10 +535,11 @@ protected:
          * must be transmitted. (As optimization, no stderr records are
          * transmitted if the stream is empty.)
          */
-        auto* const header = reinterpret_cast<detail::Header*>(buffer_ + data_size);
-        *header = detail::Header{static_cast<detail::Record_type>(type_),
+        const detail::Header header{static_cast<detail::Record_type>(type_),
           connection_->request_id(), 0, 0};
-        data_size += sizeof(detail::Header);
+        std::memcpy(end_records.data() + data_size, &header, sizeof(header));
+        data_size += sizeof(header);
+        ++record_count;
       }
 
       /*
@@ -395,25 +547,25 @@ protected:
        * guaranteed by the implementation of Listener.)
        */
       if (type_ == Type::out) {
-        auto* const record = reinterpret_cast<detail::End_request_record*>(
-          buffer_ + data_size);
-        *record = detail::End_request_record{
+        const detail::End_request_record record{
           connection_->request_id(),
           connection_->application_status(),
           detail::Protocol_status::request_complete};
-        data_size += sizeof(detail::End_request_record);
+        std::memcpy(end_records.data() + data_size, &record, sizeof(record));
+        data_size += sizeof(record);
+        ++record_count;
       }
 
-      if (data_size > 0) {
-        const std::streamsize count = connection_->io_->write(
-          static_cast<const char*>(buffer_), data_size);
-        DMITIGR_ASSERT(count == data_size);
-      }
+      if (data_size > 0)
+        slices[slice_count++] = {end_records.data(), data_size};
 
       is_end_records_must_be_transmitted_ = false;
       is_end_of_stream_ = true;
     }
 
+    if (slice_count)
+      connection_->write_io(slices.data(), slice_count, record_count);
+
     DMITIGR_ASSERT(is_invariant_ok());
 
     return is_eof ? traits_type::not_eof(ch) : ch;
@@ -436,11 +588,17 @@ private:
     content_must_be_discarded
   };
 
+  /// The maximum number of records of Framed_output to gather at once.
+  static constexpr std::size_t max_framed_record_count{8};
+
   Type type_{};
+  Flush_policy flush_policy_{Flush_policy::sync};
+  std::shared_ptr<const Framed_output> framed_;
   bool is_content_must_be_discarded_{};
   bool is_end_of_stream_{};
   bool is_end_records_must_be_transmitted_{};
   bool is_put_area_at_least_once_consumed_{};
+  bool is_buffer_deferred_{};
   char_type* buffer_{};
   char_type* buffer_end_{}; // Used by underflow() to mark the actual end of get area. (buffer_end_ <= buffer_ + buffer_size_).
   std::streamsize buffer_size_{}; // The available size of the area pointed by buffer_.
@@ -453,16 +611,17 @@ private:
   bool is_invariant_ok() const
   {
     const bool connection_ok = connection_;
-    const bool buffer_ok = buffer_ &&
-      (!is_reader() || (buffer_end_ && (buffer_end_ <= buffer_ + buffer_size_)));
-    const bool buffer_size_ok = (buffer_size_ >= 2048) &&
-      (buffer_size_ <= 65528) && (buffer_size_ % 8 == 0);
-    const bool unread_content_length_ok = (unread_content_length_ <= buffer_size_ &&
-      unread_content_length_ <= static_cast<std::streamsize>(
-        detail::Header::max_content_length));
-    const bool unread_padding_length_ok = (unread_padding_length_ <= buffer_size_ &&
-      unread_padding_length_ <= static_cast<std::streamsize>(
-        detail::Header::max_padding_length));
+    const bool is_buffer_unset = !buffer_ && !is_reader() &&
+      (is_buffer_deferred_ || is_closed());
+    const bool buffer_ok = is_buffer_unset || (buffer_ &&
+      (!is_reader() || (buffer_end_ && (buffer_end_ <= buffer_ + buffer_size_))));
+    const bool buffer_size_ok = is_buffer_unset || ((buffer_size_ >= 2048) &&
+      (buffer_size_ <= 65528) && (buffer_size_ % 8 == 0));
+    // Note: the content of a record can be larger than the buffer.
+    const bool unread_content_length_ok = (unread_content_length_ <=
+      static_cast<std::streamsize>(detail::Header::max_content_length));
+    const bool unread_padding_length_ok = (unread_padding_length_ <=
+      static_cast<std::streamsize>(detail::Header::max_padding_length));
     const bool reader_ok = (!is_reader() ||
       (type_ == Type::params) ||
       (connection_->role() == Role{0}) || // unread yet
@@ -477,8 +636,11 @@ private:
         !(!eback() && !gptr() && !egptr()) && (!pbase() && !pptr() && !epptr()))
       ||
       (!is_reader() &&
-        (!eback() && !gptr() && !egptr()) && !(!pbase() && !pptr() && !epptr()));
-    const bool put_area_ok = is_reader() ||
+        (!eback() && !gptr() && !egptr()) && !(!pbase() && !pptr() && !epptr()))
+      ||
+      (is_buffer_deferred_ &&
+        (!eback() && !gptr() && !egptr()) && (!pbase() && !pptr() && !epptr()));
+    const bool put_area_ok = is_reader() || is_buffer_deferred_ ||
       (is_closed() ||
         ((pbase() <= pptr() && pptr() <= epptr()) &&
           (is_end_of_stream_ || (pbase() == buffer_ + sizeof(detail::Header)))));
@@ -495,6 +657,50 @@ private:
 
   // ===========================================================================
 
+  /**
+   * @brief Stores the slices of the records of `output` to `slices`.
+   *
+   * @details The records are referenced as is if possible. Otherwise, the
+   * headers are rebuilt in `headers` (with the request identifier and the
+   * type of this stream), and only the content and padding are referenced.
+   * If there are more than `max_framed_record_count` such records, the
+   * output is transmitted immediately.
+   *
+   * @returns The number of stored slices and the number of records they
+   * constitute.
+   */
+  std::pair<std::size_t, std::size_t> gather(const Framed_output& output, net::Io_slice* const slices,
+    detail::Header* const headers)
+  {
+    const auto& records = output.records_;
+    if (type_ == Type::out && connection_->request_id() == 1) {
+      slices[0] = {records.data(), records.size()};
+      return {1, output.record_count_};
+    }
+
+    std::size_t slice_count{};
+    std::size_t header_count{};
+    for (std::size_t offset{}; offset < records.size();) {
+      detail::Header header;
+      std::memcpy(&header, records.data() + offset, sizeof(header));
+      const auto content_length = header.content_length();
+      const auto padding_length = header.padding_length();
+      headers[header_count] = detail::Header{static_cast<detail::Record_type>(type_),
+        connection_->request_id(), content_length, padding_length};
+      slices[slice_count++] = {reinterpret_cast<const char*>(&headers[header_count++]),
+        sizeof(header)};
+      slices[slice_count++] = {records.data() + offset + sizeof(header),
+        content_length + padding_length};
+      offset += sizeof(header) + content_length + padding_length;
+
+      if (header_count == max_framed_record_count && offset < records.size()) {
+        connection_->write_io(slices, slice_count, header_count);
+        slice_count = header_count = 0;
+      }
+    }
+    return {slice_count, header_count};
+  }
+
   /**
    * @brief Processes a record by the header info.
    *
@@ -531,7 +737,7 @@ private:
     const auto end_request = [&](const detail::Protocol_status protocol_status)
     {
       const detail::End_request_record record{header.request_id(), 0, protocol_status};
-      const auto count = connection_->io_->write(
+      const auto count = connection_->write_io(
         reinterpret_cast<const char*>(&record), sizeof(record));
       DMITIGR_ASSERT(count == sizeof(record));
     };
@@ -545,18 +751,7 @@ private:
 
     const auto process_management_record = [&]()
     {
-      namespace math = dmitigr::math;
       if (header.record_type() == detail::Record_type::get_values) {
-        // The length of "FCGI_MPXS_CONNS" == 15.
-        constexpr std::size_t max_variable_name_length{15};
-        constexpr std::size_t max_body_length{3 * (sizeof(char) + sizeof(char)
-          + max_variable_name_length + sizeof(char))};
-        constexpr std::streamsize max_record_length{sizeof(detail::Header)
-          + max_body_length};
-        std::array<unsigned char,
-          math::aligned<std::size_t>(max_record_length, 8)> record;
-        static_assert((record.size() % 8 == 0));
-
         // Reading the requested variables.
         const auto variables = [&]()
         {
@@ -566,51 +761,16 @@ private:
         if (unread_content_length_ > 0)
           end_request_protocol_violation();
 
-        // Filling up the content of get-values-result.
-        const auto content_offset = std::begin(record) + sizeof(detail::Header);
-        auto p = content_offset;
-        const auto variables_count = variables.pair_count();
-        for (std::size_t i = 0; i < variables_count; ++i) {
-          const auto name = variables.pair(i).name();
-          char value{};
-          if (name == "FCGI_MAX_CONNS")
-            value = '1';
-          else if (name == "FCGI_MAX_REQS")
-            value = '1';
-          else if (name == "FCGI_MPXS_CONNS")
-            value = '0';
-          else
-            continue; // Ignoring other variables specified in the get-values record.
-
-          const auto name_size = name.size();
-          if (name_size > std::numeric_limits<unsigned char>::max())
-            end_request_protocol_violation();
-
-          // Note: name_size + 3 - is a space required to store: {char(name_size), char(1), name.data(), char(value)} string.
-          DMITIGR_ASSERT(name_size + 3 <= static_cast<std::size_t>(
-              std::cend(record) - p));
-          *p++ = static_cast<unsigned char>(name_size); // name_size
-          *p++ = static_cast<unsigned char>(1);         // 1
-          p = std::copy(cbegin(name), cend(name), p);   // name.data()
-          *p++ = static_cast<unsigned char>(value);     // value
-        }
-
-        using detail::Header;
-        const auto content_length = p - content_offset;
-        const auto padding_length = math::padding<std::streamsize>(content_length, 8);
-        const auto record_length = static_cast<int>(sizeof(Header)) +
-          content_length + padding_length;
-        auto* const h = reinterpret_cast<Header*>(record.data());
-        *h = detail::Header{detail::Record_type::get_values_result,
-          Header::null_request_id, static_cast<std::size_t>(content_length),
-          static_cast<std::size_t>(padding_length)};
-        const auto count = connection_->io_->write(
-          reinterpret_cast<const char*>(record.data()), record_length);
+        // This connection is never multiplexed. (See Listener.)
+        const auto record = detail::make_get_values_result_record(variables,
+          1, 1, false);
+        const auto record_length = static_cast<std::streamsize>(record.size());
+        const auto count = connection_->write_io(record.data(), record_length);
         DMITIGR_ASSERT(count == record_length);
       } else {
         const detail::Unknown_type_record r{header.record_type()};
         const std::streamsize record_length = sizeof(r);
-        const auto count = connection_->io_->write(
+        const auto count = connection_->write_io(
           reinterpret_cast<const char*>(&r), record_length);
         DMITIGR_ASSERT(count == record_length);
       }
@@ -33,10 +33,18 @@ private:
 /// The Istream implementation for a FastCGI server.
 class server_Istream final : public iIstream {
 public:
+  /**
+   * @brief The constructor.
+   *
+   * @param data_offset The offset of the first unconsumed byte in `buffer`.
+   * @param data_size The size of the data in `buffer` read ahead.
+   */
   server_Istream(iServer_connection* const connection,
-    char_type* const buffer, const std::streamsize buffer_size)
+    char_type* const buffer, const std::streamsize buffer_size,
+    const std::streamsize data_offset = 0, const std::streamsize data_size = 0)
     : iIstream{&streambuf_}
-    , streambuf_{connection, buffer, buffer_size, Stream_type::params}
+    , streambuf_{connection, buffer, buffer_size, Stream_type::params,
+        data_offset, data_size}
   {
     // Reading the parameters.
     DMITIGR_ASSERT(stream_type() == Stream_type::params);
@@ -119,6 +127,32 @@ public:
     return streambuf_.stream_type();
   }
 
+  Flush_policy flush_policy() const noexcept override
+  {
+    return streambuf_.flush_policy();
+  }
+
+  void set_flush_policy(const Flush_policy value) noexcept override
+  {
+    streambuf_.set_flush_policy(value);
+  }
+
+  server_Ostream& transmit() override
+  {
+    if (!is_closed() && good()) {
+      const sentry s{*this};
+      if (s) {
+        try {
+          if (streambuf_.transmit() == -1)
+            setstate(badbit);
+        } catch (...) {
+          setstate(badbit);
+        }
+      }
+    }
+    return *this;
+  }
+
 private:
   server_Streambuf streambuf_;
 };
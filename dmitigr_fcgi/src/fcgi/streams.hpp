@@ -70,6 +70,26 @@ private:
 
 /// An output data stream.
 class Ostream : public Stream, public std::ostream {
+public:
+  /// @returns The flush policy of the stream.
+  virtual Flush_policy flush_policy() const noexcept = 0;
+
+  /**
+   * @brief Sets the flush policy of the stream.
+   *
+   * @details The output which is already buffered is not transmitted.
+   */
+  virtual void set_flush_policy(Flush_policy value) noexcept = 0;
+
+  /**
+   * @brief Transmits the buffered output regardless of flush_policy().
+   *
+   * @details Sets `badbit` on failure, just like `flush()`.
+   *
+   * @returns `*this`.
+   */
+  virtual Ostream& transmit() = 0;
+
 private:
   friend detail::iOstream;
 
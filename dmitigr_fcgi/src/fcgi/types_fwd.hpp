@@ -22,11 +22,13 @@ namespace dmitigr::fcgi {
 
 enum class Role;
 enum class Stream_type;
+enum class Flush_policy;
 
 class Exception;
 
 class Listener;
 class Listener_options;
+class Framed_output;
 
 class Connection_parameter;
 class Connection;
@@ -54,6 +56,9 @@ class Names_values;
 class iListener;
 class iListener_options;
 class iServer_connection;
+class Buffer_pool;
+class Mpx_channel;
+class mpx_Descriptor;
 class iStreambuf;
 class server_Streambuf;
 class iIstream;
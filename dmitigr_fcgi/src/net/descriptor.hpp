@@ -23,16 +23,52 @@
 
 #include <algorithm>
 #include <array>
+#include <cstddef>
 #include <cstdio>
 #include <ios> // std::streamsize
 #include <utility> // std::move()
 
 #ifdef _WIN32
 #include "../os/windows.hpp"
+#else
+#include <climits> // IOV_MAX
+#include <sys/uio.h>
 #endif
 
 namespace dmitigr::net {
 
+/// A part of the data to write by Descriptor::write_gathered().
+struct Io_slice final {
+  /// The data.
+  const char* data{};
+
+  /// The size of the data.
+  std::size_t size{};
+};
+
+/**
+ * @brief Consumes `count` bytes from the sequence of slices.
+ *
+ * @details Useful to continue the gathered write after the partial one.
+ *
+ * @param[in,out] slices The sequence of slices. The fully consumed slices
+ * are skipped, and the partially consumed one is adjusted.
+ * @param[in,out] slice_count The number of slices in the sequence.
+ */
+inline void consume(Io_slice*& slices, std::size_t& slice_count,
+  std::size_t count) noexcept
+{
+  while (slice_count && count >= slices->size) {
+    count -= slices->size;
+    ++slices;
+    --slice_count;
+  }
+  if (slice_count) {
+    slices->data += count;
+    slices->size -= count;
+  }
+}
+
 /// A descriptor to perform low-level I/O operations.
 class Descriptor {
 public:
@@ -48,17 +84,42 @@ public:
   /**
    * @brief Reads from this descriptor synchronously.
    *
-   * @returns Number of bytes read.
+   * @returns Number of bytes read, or `-1` if the descriptor is in the
+   * non-blocking mode and the operation would block.
    */
   virtual std::streamsize read(char* buf, std::streamsize len) = 0;
 
   /**
    * @brief Writes to this descriptor synchronously.
    *
-   * @returns Number of bytes written.
+   * @returns Number of bytes written, or `-1` if the descriptor is in the
+   * non-blocking mode and the operation would block.
    */
   virtual std::streamsize write(const char* buf, std::streamsize len) = 0;
 
+  /**
+   * @brief Writes the data of `count` slices to this descriptor synchronously
+   * by the single operation, if supported (see writev(2)).
+   *
+   * @returns Number of bytes written, which can be less than the total size
+   * of the slices, or `-1` if the descriptor is in the non-blocking mode and
+   * the operation would block.
+   *
+   * @see consume().
+   */
+  virtual std::streamsize write_gathered(const Io_slice* slices,
+    std::size_t count) = 0;
+
+  /**
+   * @brief Enables or disables the non-blocking mode.
+   *
+   * @throws Exception if the mode is not supported by the descriptor.
+   */
+  virtual void set_non_blocking(bool value) = 0;
+
+  /// @returns `true` if the descriptor is in the non-blocking mode.
+  virtual bool is_non_blocking() const noexcept = 0;
+
   /// Closes the descriptor.
   virtual void close() = 0;
 
@@ -80,6 +141,37 @@ public:
   {
     return 2147479552; // as on Linux
   }
+
+  /// Writes the slices one by one till the first partial write.
+  std::streamsize write_gathered(const Io_slice* const slices,
+    const std::size_t count) override
+  {
+    if (!slices && count)
+      throw Exception{"cannot write null slices to descriptor"};
+
+    std::streamsize result{};
+    for (std::size_t i = 0; i < count; ++i) {
+      const auto size = static_cast<std::streamsize>(slices[i].size);
+      const auto written = write(slices[i].data, size);
+      if (written < 0)
+        return result ? result : written;
+      result += written;
+      if (written < size)
+        break;
+    }
+    return result;
+  }
+
+  void set_non_blocking(const bool value) override
+  {
+    if (value)
+      throw Exception{"non-blocking mode is not supported by descriptor"};
+  }
+
+  bool is_non_blocking() const noexcept override
+  {
+    return false;
+  }
 };
 
 /// The implementation of Descriptor based on sockets.
@@ -117,8 +209,11 @@ public:
     const auto buf_len = static_cast<std::size_t>(len);
 #endif
     const auto result = ::recv(socket_, buf, buf_len, flags);
-    if (net::is_socket_error(result))
+    if (net::is_socket_error(result)) {
+      if (is_non_blocking_ && net::is_would_block_error())
+        return -1;
       throw DMITIGR_NET_EXCEPTION{"cannot read from socket"};
+    }
 
     return static_cast<std::streamsize>(result);
   }
@@ -140,12 +235,77 @@ public:
     const auto buf_len = static_cast<std::size_t>(len);
 #endif
     const auto result = ::send(socket_, buf, buf_len, flags);
-    if (net::is_socket_error(result))
+    if (net::is_socket_error(result)) {
+      if (is_non_blocking_ && net::is_would_block_error())
+        return -1;
       throw DMITIGR_NET_EXCEPTION{"cannot write to socket"};
+    }
 
     return static_cast<std::streamsize>(result);
   }
 
+  std::streamsize write_gathered(const Io_slice* const slices,
+    std::size_t count) override
+  {
+    if (!slices && count)
+      throw Exception{"cannot write null slices to socket"};
+
+    // The slices above the limit are written by the subsequent call.
+#ifdef _WIN32
+    constexpr std::size_t max_count{64};
+    std::array<WSABUF, max_count> buffers;
+    count = std::min(count, max_count);
+    for (std::size_t i = 0; i < count; ++i) {
+      buffers[i].buf = const_cast<char*>(slices[i].data);
+      buffers[i].len = static_cast<ULONG>(slices[i].size);
+    }
+    DWORD result{};
+    if (::WSASend(socket_, buffers.data(), static_cast<DWORD>(count), &result,
+        0, nullptr, nullptr) != 0) {
+      if (is_non_blocking_ && net::is_would_block_error())
+        return -1;
+      throw DMITIGR_NET_EXCEPTION{"cannot write to socket"};
+    }
+#else
+    constexpr std::size_t max_count{std::min(64, IOV_MAX)};
+    std::array<iovec, max_count> buffers;
+    count = std::min(count, max_count);
+    for (std::size_t i = 0; i < count; ++i) {
+      buffers[i].iov_base = const_cast<char*>(slices[i].data);
+      buffers[i].iov_len = slices[i].size;
+    }
+    msghdr message{};
+    message.msg_iov = buffers.data();
+    message.msg_iovlen = static_cast<decltype(message.msg_iovlen)>(count);
+#ifdef __APPLE__
+    constexpr int flags{};
+#else
+    constexpr int flags{MSG_NOSIGNAL};
+#endif
+    const auto result = ::sendmsg(socket_, &message, flags);
+    if (net::is_socket_error(result)) {
+      if (is_non_blocking_ && net::is_would_block_error())
+        return -1;
+      throw DMITIGR_NET_EXCEPTION{"cannot write to socket"};
+    }
+#endif
+
+    return static_cast<std::streamsize>(result);
+  }
+
+  void set_non_blocking(const bool value) override
+  {
+    if (value != is_non_blocking_) {
+      net::set_non_blocking(socket_, value);
+      is_non_blocking_ = value;
+    }
+  }
+
+  bool is_non_blocking() const noexcept override
+  {
+    return is_non_blocking_;
+  }
+
   void close() override
   {
     if (!is_shutted_down_) {
@@ -162,8 +322,21 @@ public:
     return socket_;
   }
 
+  /**
+   * @brief Releases the ownership of the socket without closing it.
+   *
+   * @details Useful to close the socket gracefully by other means, such as
+   * Reaper, without blocking the caller.
+   */
+  net::Socket_guard release() noexcept
+  {
+    is_shutted_down_ = true;
+    return std::move(socket_);
+  }
+
 private:
   bool is_shutted_down_{};
+  bool is_non_blocking_{};
   net::Socket_guard socket_;
 
   /**
@@ -195,8 +368,11 @@ private:
       const auto trashcan_size = static_cast<std::size_t>(trashcan.size());
 #endif
       const auto result = ::recv(socket_, trashcan.data(), trashcan_size, flags);
-      if (net::is_socket_error(result))
+      if (net::is_socket_error(result)) {
+        if (is_non_blocking_ && net::is_would_block_error())
+          continue; // spurious readiness
         throw DMITIGR_NET_EXCEPTION{errmsg};
+      }
       else if (result == 0)
         break; // the end (ok)
     }
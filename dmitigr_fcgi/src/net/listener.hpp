@@ -27,6 +27,7 @@
 #include "types_fwd.hpp"
 
 #include <chrono>
+#include <deque>
 #include <memory>
 #include <optional>
 #include <string>
@@ -186,9 +187,27 @@ public:
    */
   virtual std::unique_ptr<Descriptor> accept() = 0;
 
+  /**
+   * @brief Accepts all of the pending client connections without blocking.
+   *
+   * @param[out] result The queue to append the accepted connections to.
+   *
+   * @returns The number of the accepted connections.
+   *
+   * @par Requires
+   * `is_listening()`.
+   *
+   * @remarks Draining the backlog is required when the listener is waited
+   * by edge-triggered Reactor.
+   */
+  virtual std::size_t accept_all(std::deque<std::unique_ptr<Descriptor>>& result) = 0;
+
   /// Stops the listening.
   virtual void close() = 0;
 
+  /// @returns Native handle (i.e. socket or named pipe).
+  virtual std::intptr_t native_handle() const noexcept = 0;
+
 private:
   friend detail::iListener;
 
@@ -270,6 +289,9 @@ public:
 
     if (::listen(socket_, *options_.backlog()) != 0)
       throw DMITIGR_NET_EXCEPTION{"cannot start listening on socket"};
+
+    // The backlog is drained by accept_all() until accept would block.
+    set_non_blocking(socket_, true);
   }
 
   bool wait(const std::chrono::milliseconds timeout =
@@ -294,17 +316,25 @@ public:
       throw Exception{"cannot accept connections on listener which is "
         "not listening"};
 
-    constexpr sockaddr* addr{};
-#ifdef _WIN32
-    constexpr int* addrlen{};
-#else
-    constexpr ::socklen_t* addrlen{};
-#endif
-    if (net::Socket_guard sock{::accept(socket_, addr, addrlen)};
-      !net::is_socket_valid(sock))
-      throw DMITIGR_NET_EXCEPTION{"cannot accept on socket"};
-    else
-      return std::make_unique<socket_Descriptor>(std::move(sock));
+    while (true) {
+      if (auto result = accept_pending())
+        return result;
+      wait();
+    }
+  }
+
+  std::size_t accept_all(std::deque<std::unique_ptr<Descriptor>>& result) override
+  {
+    if (!is_listening())
+      throw Exception{"cannot accept connections on listener which is "
+        "not listening"};
+
+    std::size_t count{};
+    while (auto descriptor = accept_pending()) {
+      result.push_back(std::move(descriptor));
+      ++count;
+    }
+    return count;
   }
 
   void close() override
@@ -313,10 +343,53 @@ public:
       throw DMITIGR_NET_EXCEPTION{"cannot close socket"};
   }
 
+  std::intptr_t native_handle() const noexcept override
+  {
+    return socket_;
+  }
+
 private:
   net::Socket_guard socket_;
   Listener_options options_;
 
+  /**
+   * @returns A pending connection (in blocking mode), or `nullptr` if there
+   * are no pending connections.
+   */
+  std::unique_ptr<Descriptor> accept_pending()
+  {
+    constexpr sockaddr* addr{};
+#ifdef _WIN32
+    constexpr int* addrlen{};
+#else
+    constexpr ::socklen_t* addrlen{};
+#endif
+    while (true) {
+#ifdef __linux__
+      net::Socket_guard sock{::accept4(socket_, addr, addrlen, SOCK_CLOEXEC)};
+#else
+      net::Socket_guard sock{::accept(socket_, addr, addrlen)};
+#endif
+      if (!net::is_socket_valid(sock)) {
+        if (net::is_would_block_error())
+          return nullptr;
+#ifndef _WIN32
+        else if (errno == EINTR || errno == ECONNABORTED)
+          continue;
+#endif
+        throw DMITIGR_NET_EXCEPTION{"cannot accept on socket"};
+      }
+
+#ifndef __linux__
+      // The accepted socket may inherit the non-blocking mode of listener.
+      set_non_blocking(sock, false);
+#endif
+      if (options_.endpoint().communication_mode() == Communication_mode::net)
+        set_nodelay(sock, true);
+      return std::make_unique<socket_Descriptor>(std::move(sock));
+    }
+  }
+
 #ifdef _WIN32
   void net_initialize()
   {
@@ -452,6 +525,15 @@ public:
     return std::make_unique<pipe_Descriptor>(std::move(pipe_));
   }
 
+  std::size_t accept_all(std::deque<std::unique_ptr<Descriptor>>& result) override
+  {
+    // Only one instance of the pipe is waited at a time.
+    if (!wait(std::chrono::milliseconds::zero()))
+      return 0;
+    result.push_back(accept());
+    return 1;
+  }
+
   void close() override
   {
     if (is_listening()) {
@@ -461,6 +543,11 @@ public:
     }
   }
 
+  std::intptr_t native_handle() const noexcept override
+  {
+    return reinterpret_cast<std::intptr_t>(pipe_.handle());
+  }
+
 private:
   bool is_listening_{};
   os::windows::Handle_guard pipe_{INVALID_HANDLE_VALUE};
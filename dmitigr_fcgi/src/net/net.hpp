@@ -24,6 +24,8 @@
 #include "descriptor.hpp"
 #include "endpoint.hpp"
 #include "listener.hpp"
+#include "reactor.hpp"
+#include "reaper.hpp"
 #include "socket.hpp"
 #include "util.hpp"
 
@@ -0,0 +1,307 @@
+// -*- C++ -*-
+//
+// Copyright 2022 Dmitry Igrishin
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef DMITIGR_NET_REACTOR_HPP
+#define DMITIGR_NET_REACTOR_HPP
+
+#include "exceptions.hpp"
+#include "socket.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#endif
+#ifndef _WIN32
+#include <cerrno>
+
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace dmitigr::net {
+
+/// An event reported by Reactor.
+struct Reactor_event final {
+  /// The user data the socket is registered with.
+  void* data{};
+
+  /// The readiness of the socket.
+  Socket_readiness readiness{Socket_readiness::unready};
+};
+
+/**
+ * @brief A demultiplexer of readiness events of many sockets.
+ *
+ * @details On Linux the implementation is based on edge-triggered epoll(7),
+ * so the cost of a wait does not depend on the number of registered sockets.
+ * The readiness of a socket is reported only once per change. Thus, upon the
+ * event, the socket must be either drained (i.e. read or written until the
+ * operation would block), or re-armed by modify().
+ *
+ * On other platforms the implementation is based on poll(). It reports the
+ * readiness as long as the socket is ready, which is compatible with the
+ * callers written for the edge-triggered mode.
+ *
+ * @remarks The socket which is closed is unregistered implicitly.
+ *
+ * @remarks The only member function which can be called concurrently with
+ * other member functions is notify().
+ */
+class Reactor final {
+public:
+  /// The destructor.
+  ~Reactor()
+  {
+#ifdef __linux__
+    if (epoll_ >= 0)
+      ::close(epoll_);
+    if (wakeup_ >= 0)
+      ::close(wakeup_);
+#elif !defined(_WIN32)
+    for (const int fd : wakeup_) {
+      if (fd >= 0)
+        ::close(fd);
+    }
+#endif
+  }
+
+  /// Non copy-constructible.
+  Reactor(const Reactor&) = delete;
+
+  /// Non copy-assignable.
+  Reactor& operator=(const Reactor&) = delete;
+
+  /// The constructor.
+  Reactor()
+  {
+#ifdef __linux__
+    epoll_ = ::epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_ < 0)
+      throw DMITIGR_NET_EXCEPTION{"cannot create epoll instance"};
+    wakeup_ = ::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (wakeup_ < 0)
+      throw DMITIGR_NET_EXCEPTION{"cannot create eventfd"};
+    control(EPOLL_CTL_ADD, wakeup_, Socket_readiness::read_ready, &wakeup_);
+#elif !defined(_WIN32)
+    if (::pipe(wakeup_) != 0)
+      throw DMITIGR_NET_EXCEPTION{"cannot create pipe"};
+    for (const int fd : wakeup_)
+      ::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) | O_NONBLOCK);
+    items_.push_back({wakeup_[0], Socket_readiness::read_ready});
+    data_.push_back(&wakeup_);
+#endif
+  }
+
+  /**
+   * @brief Interrupts the wait() which is either in progress or the next one.
+   *
+   * @details Can be called from any thread.
+   *
+   * @remarks Does nothing on Windows.
+   */
+  void notify() noexcept
+  {
+#ifdef __linux__
+    const std::uint64_t value{1};
+    [[maybe_unused]] const auto r = ::write(wakeup_, &value, sizeof(value));
+#elif !defined(_WIN32)
+    const char value{};
+    [[maybe_unused]] const auto r = ::write(wakeup_[1], &value, sizeof(value));
+#endif
+  }
+
+  /**
+   * @brief Registers the `socket` to be waited for the readiness specified
+   * by `mask`.
+   *
+   * @param data The user data to report with the events of the `socket`.
+   *
+   * @par Requires
+   * `is_socket_valid(socket)` and the socket is not registered.
+   */
+  void add(const Socket_native socket, const Socket_readiness mask,
+    void* const data)
+  {
+    if (!is_socket_valid(socket))
+      throw Exception{"cannot add an invalid socket to reactor"};
+#ifdef __linux__
+    control(EPOLL_CTL_ADD, socket, mask, data);
+#else
+    items_.push_back({socket, mask});
+    data_.push_back(data);
+#endif
+  }
+
+  /**
+   * @brief Changes the registration of the `socket`.
+   *
+   * @details Re-arms the readiness events of the `socket`, i.e. the readiness
+   * which is already present is reported by the next wait().
+   *
+   * @par Requires
+   * The socket is registered.
+   */
+  void modify(const Socket_native socket, const Socket_readiness mask,
+    void* const data)
+  {
+#ifdef __linux__
+    control(EPOLL_CTL_MOD, socket, mask, data);
+#else
+    const auto i = find(socket);
+    items_[i].mask = mask;
+    data_[i] = data;
+#endif
+  }
+
+  /**
+   * @brief Unregisters the `socket`.
+   *
+   * @par Requires
+   * The socket is registered.
+   */
+  void remove(const Socket_native socket)
+  {
+#ifdef __linux__
+    control(EPOLL_CTL_DEL, socket, Socket_readiness::unready, nullptr);
+#else
+    const auto i = find(socket);
+    items_.erase(items_.begin() + i);
+    data_.erase(data_.begin() + i);
+#endif
+  }
+
+  /**
+   * @brief Waits for the readiness of the registered sockets.
+   *
+   * @param events The array to store the events.
+   * @param max_count The size of the array `events`.
+   * @param timeout The maximum amount of time to wait before return. A special
+   * value of `-1` denotes "eternity".
+   *
+   * @returns The number of events stored to `events`. Zero is returned upon
+   * either the timeout or notify().
+   *
+   * @par Requires
+   * `(events && max_count > 0)`.
+   */
+  std::size_t wait(Reactor_event* const events, const std::size_t max_count,
+    const std::chrono::milliseconds timeout)
+  {
+    if (!events || !max_count)
+      throw Exception{"cannot wait for reactor events without storage"};
+
+    const int tout = timeout < std::chrono::milliseconds::zero() ? -1 :
+      static_cast<int>(std::min<std::chrono::milliseconds::rep>(timeout.count(),
+          std::numeric_limits<int>::max()));
+#ifdef __linux__
+    constexpr std::size_t batch_size{64};
+    epoll_event batch[batch_size];
+    const auto count = static_cast<int>(std::min(max_count, batch_size));
+    int r;
+    do {
+      r = ::epoll_wait(epoll_, batch, count, tout);
+    } while (r < 0 && errno == EINTR);
+    if (r < 0)
+      throw DMITIGR_NET_EXCEPTION{"cannot wait for epoll events"};
+
+    std::size_t result{};
+    for (int i = 0; i < r; ++i) {
+      if (batch[i].data.ptr == &wakeup_) {
+        std::uint64_t value;
+        [[maybe_unused]] const auto n = ::read(wakeup_, &value, sizeof(value));
+        continue;
+      }
+
+      const auto ev = batch[i].events;
+      auto readiness = Socket_readiness::unready;
+      // Hang ups and errors are detected by the subsequent read operation.
+      if (ev & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+        readiness |= Socket_readiness::read_ready;
+      if (ev & EPOLLOUT)
+        readiness |= Socket_readiness::write_ready;
+      if (ev & (EPOLLPRI | EPOLLERR))
+        readiness |= Socket_readiness::exceptions;
+      events[result++] = {batch[i].data.ptr, readiness};
+    }
+    return result;
+#else
+    poll(items_.data(), items_.size(),
+      std::chrono::milliseconds{tout});
+    std::size_t result{};
+    for (std::size_t i = 0; i < items_.size() && result < max_count; ++i) {
+      if (items_[i].readiness == Socket_readiness::unready)
+        continue;
+#ifndef _WIN32
+      else if (data_[i] == &wakeup_) {
+        char trashcan[64];
+        while (::read(wakeup_[0], trashcan, sizeof(trashcan)) > 0);
+        continue;
+      }
+#endif
+      events[result++] = {data_[i], items_[i].readiness};
+    }
+    return result;
+#endif
+  }
+
+private:
+#ifdef __linux__
+  int epoll_{-1};
+  int wakeup_{-1};
+
+  void control(const int operation, const Socket_native socket,
+    const Socket_readiness mask, void* const data)
+  {
+    using Ut = std::underlying_type_t<Socket_readiness>;
+    epoll_event ev{};
+    ev.events = EPOLLET | EPOLLRDHUP;
+    if (static_cast<Ut>(mask & Socket_readiness::read_ready))
+      ev.events |= EPOLLIN;
+    if (static_cast<Ut>(mask & Socket_readiness::write_ready))
+      ev.events |= EPOLLOUT;
+    if (static_cast<Ut>(mask & Socket_readiness::exceptions))
+      ev.events |= EPOLLPRI;
+    ev.data.ptr = data;
+    if (::epoll_ctl(epoll_, operation, socket, &ev) != 0)
+      throw DMITIGR_NET_EXCEPTION{"cannot control epoll instance"};
+  }
+#else
+#ifndef _WIN32
+  int wakeup_[2]{-1, -1};
+#endif
+  std::vector<Poll_item> items_;
+  std::vector<void*> data_;
+
+  std::size_t find(const Socket_native socket) const
+  {
+    const auto i = std::find_if(items_.cbegin(), items_.cend(),
+      [socket](const auto& item){return item.socket == socket;});
+    if (i == items_.cend())
+      throw Exception{"socket is not registered in reactor"};
+    return static_cast<std::size_t>(i - items_.cbegin());
+  }
+#endif
+};
+
+} // namespace dmitigr::net
+
+#endif  // DMITIGR_NET_REACTOR_HPP
@@ -0,0 +1,297 @@
+// -*- C++ -*-
+//
+// Copyright 2022 Dmitry Igrishin
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef DMITIGR_NET_REAPER_HPP
+#define DMITIGR_NET_REAPER_HPP
+
+#include "../base/assert.hpp"
+#include "exceptions.hpp"
+#include "reactor.hpp"
+#include "socket.hpp"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace dmitigr::net {
+
+/**
+ * @brief A closer of the sockets in the background.
+ *
+ * @details The graceful close of a socket consists of shutting down the send
+ * side and receiving the data from the peer till the end or the timeout to
+ * prevent sending a TCP RST to the peer. Since the peer may never close its
+ * side, the reaper performs the draining on its own thread by using Reactor,
+ * so the caller can proceed immediately.
+ */
+class Reaper final {
+public:
+  /// The clock of the reaper.
+  using Clock = std::chrono::steady_clock;
+
+  /// The counters of the reaper.
+  struct Stats final {
+    /// The number of sockets being drained.
+    std::size_t pending_count{};
+
+    /// The total number of closed sockets.
+    std::uint64_t closed_count{};
+
+    /// The number of sockets closed upon the timeout.
+    std::uint64_t timed_out_count{};
+
+    /// The number of sockets closed without draining because of overflow.
+    std::uint64_t overflow_count{};
+
+    /// The total time spent on draining.
+    std::chrono::microseconds total_drain_time{};
+
+    /// The maximum time spent on draining a socket.
+    std::chrono::microseconds max_drain_time{};
+  };
+
+  /// The destructor. Closes the sockets which are still being drained.
+  ~Reaper()
+  {
+    is_stopping_ = true;
+    reactor_.notify();
+    thread_.join();
+  }
+
+  /// Non copy-constructible.
+  Reaper(const Reaper&) = delete;
+
+  /// Non copy-assignable.
+  Reaper& operator=(const Reaper&) = delete;
+
+  /**
+   * @brief The constructor.
+   *
+   * @param linger_timeout The maximum amount of time to drain a socket.
+   * @param max_pending_count The maximum number of sockets being drained.
+   * The sockets above the limit are closed without draining.
+   */
+  explicit Reaper(const std::chrono::milliseconds linger_timeout =
+    std::chrono::seconds{1}, const std::size_t max_pending_count = 4096)
+    : linger_timeout_{linger_timeout}
+    , max_pending_count_{max_pending_count}
+  {
+    DMITIGR_ASSERT(linger_timeout_ >= std::chrono::milliseconds::zero());
+    thread_ = std::thread{&Reaper::run, this};
+  }
+
+  /**
+   * @brief Closes the `socket` gracefully in the background.
+   *
+   * @details Can be called from any thread. The send side of the socket is
+   * shut down immediately.
+   */
+  void reap(Socket_guard socket) noexcept
+  {
+    if (!is_socket_valid(socket))
+      return;
+
+    try {
+      if (::shutdown(socket, sd_send) != 0 ||
+        linger_timeout_ == std::chrono::milliseconds::zero())
+        return; // e.g. ENOTCONN, the socket is closed by the guard
+
+      if (pending_count_.load() >= max_pending_count_) {
+        ++overflow_count_;
+        return;
+      }
+
+      set_non_blocking(socket, true);
+      {
+        const std::lock_guard lg{incoming_mutex_};
+        incoming_.push_back({std::move(socket), Clock::now()});
+      }
+      ++pending_count_;
+      reactor_.notify();
+    } catch (const std::exception& e) {
+      std::fprintf(stderr, "%s\n", e.what());
+    }
+  }
+
+  /// @returns The counters.
+  Stats stats() const noexcept
+  {
+    Stats result;
+    result.pending_count = pending_count_.load();
+    result.closed_count = closed_count_.load();
+    result.timed_out_count = timed_out_count_.load();
+    result.overflow_count = overflow_count_.load();
+    result.total_drain_time = std::chrono::microseconds{total_drain_time_.load()};
+    result.max_drain_time = std::chrono::microseconds{max_drain_time_.load()};
+    return result;
+  }
+
+private:
+  /// A socket being drained.
+  struct Entry final {
+    Socket_guard socket;
+    Clock::time_point started_at;
+    std::uint64_t serial{};
+  };
+
+  /// An expiration of an entry.
+  struct Deadline final {
+    Clock::time_point expires_at;
+    Socket_native socket{invalid_socket};
+    std::uint64_t serial{};
+  };
+
+  std::chrono::milliseconds linger_timeout_;
+  std::size_t max_pending_count_{};
+  Reactor reactor_;
+  std::atomic<bool> is_stopping_{};
+
+  std::mutex incoming_mutex_;
+  std::vector<Entry> incoming_;
+
+  std::atomic<std::size_t> pending_count_{};
+  std::atomic<std::uint64_t> closed_count_{};
+  std::atomic<std::uint64_t> timed_out_count_{};
+  std::atomic<std::uint64_t> overflow_count_{};
+  std::atomic<std::int64_t> total_drain_time_{};
+  std::atomic<std::int64_t> max_drain_time_{};
+
+  std::thread thread_;
+
+  /// The event loop of the reaper thread.
+  void run() noexcept
+  {
+    // Owned by the reaper thread only. The deadlines are ordered, since the
+    // timeout is the same for each socket.
+    std::unordered_map<Socket_native, Entry> entries;
+    std::deque<Deadline> deadlines;
+    std::uint64_t serial{};
+
+    const auto close = [&](const auto i, const bool is_timed_out)
+    {
+      const auto drain_time = std::chrono::duration_cast<std::chrono::microseconds>(
+        Clock::now() - i->second.started_at).count();
+      try {
+        reactor_.remove(i->first);
+      } catch (...) {} // not registered
+      entries.erase(i); // the socket is closed by the guard
+      --pending_count_;
+      ++closed_count_;
+      if (is_timed_out)
+        ++timed_out_count_;
+      total_drain_time_ += drain_time;
+      auto max = max_drain_time_.load();
+      while (drain_time > max && !max_drain_time_.compare_exchange_weak(max,
+          drain_time));
+    };
+
+    // @returns `true` if the peer has closed its side or an error occurred.
+    const auto drain = [](const Socket_native socket)
+    {
+      std::array<char, 4096> trashcan;
+      while (true) {
+#ifdef _WIN32
+        const auto r = ::recv(socket, trashcan.data(),
+          static_cast<int>(trashcan.size()), 0);
+#else
+        const auto r = ::recv(socket, trashcan.data(), trashcan.size(), 0);
+#endif
+        if (r > 0)
+          continue;
+        else if (r == 0)
+          return true;
+        else if (is_would_block_error())
+          return false;
+#ifndef _WIN32
+        else if (errno == EINTR)
+          continue;
+#endif
+        return true;
+      }
+    };
+
+    std::array<Reactor_event, 64> events;
+    std::vector<Entry> incoming;
+    while (true) {
+      try {
+        // Registering the incoming sockets.
+        {
+          const std::lock_guard lg{incoming_mutex_};
+          incoming.swap(incoming_);
+        }
+        for (auto& entry : incoming) {
+          const auto socket = entry.socket.socket();
+          entry.serial = ++serial;
+          deadlines.push_back({entry.started_at + linger_timeout_, socket,
+              entry.serial});
+          const auto [i, is_inserted] = entries.emplace(socket, std::move(entry));
+          DMITIGR_ASSERT(is_inserted);
+          try {
+            reactor_.add(socket, Socket_readiness::read_ready,
+              reinterpret_cast<void*>(static_cast<std::intptr_t>(socket)));
+          } catch (...) {
+            close(i, false);
+          }
+        }
+        incoming.clear();
+
+        if (is_stopping_)
+          break;
+
+        // Closing the expired sockets.
+        const auto now = Clock::now();
+        while (!deadlines.empty() && deadlines.front().expires_at <= now) {
+          const auto& deadline = deadlines.front();
+          if (const auto i = entries.find(deadline.socket);
+            i != entries.end() && i->second.serial == deadline.serial)
+            close(i, true);
+          deadlines.pop_front();
+        }
+
+        // Reactor::notify() does nothing on Windows, so the wait is bounded.
+        const auto timeout = deadlines.empty() ? std::chrono::milliseconds{1000} :
+          std::max(std::chrono::milliseconds::zero(),
+            std::chrono::ceil<std::chrono::milliseconds>(
+              deadlines.front().expires_at - now));
+        const auto count = reactor_.wait(events.data(), events.size(), timeout);
+        for (std::size_t j = 0; j < count; ++j) {
+          const auto socket = static_cast<Socket_native>(
+            reinterpret_cast<std::intptr_t>(events[j].data));
+          if (const auto i = entries.find(socket); i != entries.end() &&
+            drain(socket))
+            close(i, false);
+        }
+      } catch (const std::exception& e) {
+        std::fprintf(stderr, "%s\n", e.what());
+      }
+    }
+
+    pending_count_ -= entries.size();
+  }
+};
+
+} // namespace dmitigr::net
+
+#endif  // DMITIGR_NET_REAPER_HPP
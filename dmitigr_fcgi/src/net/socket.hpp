@@ -25,9 +25,11 @@
 #include <algorithm>
 #include <cassert>
 #include <chrono>
+#include <iterator>
 #include <limits>
 #include <system_error>
 #include <type_traits>
+#include <vector>
 
 #ifdef _WIN32
 #include "../os/windows.hpp"
@@ -37,10 +39,13 @@
 #else
 #include <cerrno>
 
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h> // TCP_NODELAY
+#include <poll.h>
 #include <sys/time.h> // timeval
 #include <sys/types.h>
 #include <sys/socket.h>
-#include <sys/select.h>
 #include <unistd.h>
 #endif
 
@@ -112,6 +117,34 @@ inline bool is_socket_error(const Integer function_result)
 #endif
 }
 
+/**
+ * @returns `true` if the last socket API function failed because the
+ * operation on a non-blocking socket would block.
+ */
+inline bool is_would_block_error() noexcept
+{
+#ifdef _WIN32
+  return ::WSAGetLastError() == WSAEWOULDBLOCK;
+#else
+  return errno == EAGAIN || errno == EWOULDBLOCK;
+#endif
+}
+
+/// Enables or disables the non-blocking mode of the `socket`.
+inline void set_non_blocking(const Socket_native socket, const bool value)
+{
+#ifdef _WIN32
+  u_long mode = value;
+  const auto r = ::ioctlsocket(socket, FIONBIO, &mode);
+#else
+  auto r = ::fcntl(socket, F_GETFL);
+  if (!is_socket_error(r))
+    r = ::fcntl(socket, F_SETFL, value ? (r | O_NONBLOCK) : (r & ~O_NONBLOCK));
+#endif
+  if (is_socket_error(r))
+    throw DMITIGR_NET_EXCEPTION{"cannot set non-blocking mode of a socket"};
+}
+
 /// Sets the receiving or sending timeouts until reporting an error.
 inline void set_timeout(const Socket_native socket,
   const std::chrono::milliseconds rcv_timeout,
@@ -152,6 +185,27 @@ inline void set_timeout(const Socket_native socket,
     throw DMITIGR_NET_EXCEPTION{"cannot set timeout on a socket"};
 }
 
+/**
+ * @brief Enables or disables the Nagle's algorithm on the TCP `socket`.
+ *
+ * @remarks Disabling the Nagle's algorithm is essential for the connections
+ * which are reused for several request-response exchanges, since otherwise
+ * the tail of each response can be delayed until the client acknowledges the
+ * previously sent data.
+ */
+inline void set_nodelay(const Socket_native socket, const bool value)
+{
+  const int optval = value;
+#ifdef _WIN32
+  const auto optlen = static_cast<int>(sizeof(optval));
+#else
+  const auto optlen = static_cast<::socklen_t>(sizeof(optval));
+#endif
+  if (::setsockopt(socket, IPPROTO_TCP, TCP_NODELAY,
+      reinterpret_cast<const char*>(&optval), optlen) != 0)
+    throw DMITIGR_NET_EXCEPTION{"cannot set TCP_NODELAY socket option"};
+}
+
 // =============================================================================
 
 #ifdef _WIN32
@@ -310,82 +364,161 @@ inline void shutdown_socket(const Socket_native socket, const int how)
     throw DMITIGR_NET_EXCEPTION{"cannot shutdown a socket"};
 }
 
+/// A socket to poll together with other sockets.
+struct Poll_item final {
+  /// The socket to poll.
+  Socket_native socket{invalid_socket};
+
+  /// The readiness of interest.
+  Socket_readiness mask{Socket_readiness::unready};
+
+  /// The readiness reported by the last call of poll().
+  Socket_readiness readiness{Socket_readiness::unready};
+};
+
 /**
- * @brief Performs the polling of the `socket`.
+ * @brief Performs the polling of the `count` sockets pointed by `items`.
  *
- * @returns The readiness of the socket according to the specified `mask`.
+ * @returns The number of items with `readiness != Socket_readiness::unready`.
  *
  * @par Requires
- * `is_socket_valid(socket)`.
+ * `(items || !count)` and `is_socket_valid(items[i].socket)` for each item.
+ *
+ * @par Effects
+ * `items[i].readiness` is updated according to `items[i].mask`.
  *
  * @remarks
  * `(timeout < 0)` means *no timeout* and the function can block indefinitely!
  *
- * @remarks The current implementation is based only on select().
+ * @remarks This function is not limited by `FD_SETSIZE`.
  */
-inline Socket_readiness poll(const Socket_native socket,
-  const Socket_readiness mask, const std::chrono::milliseconds timeout)
+inline std::size_t poll(Poll_item* const items, const std::size_t count,
+  const std::chrono::milliseconds timeout)
 {
-  if (!is_socket_valid(socket))
-    throw Exception{"cannot poll an invalid socket"};
-
-  using std::chrono::seconds;
-  using std::chrono::milliseconds;
-  using std::chrono::microseconds;
-  using std::chrono::duration_cast;
-
-  // When (tv_p == nullptr), select(2) treats it as "no timeout".
-  timeval tv;
-  timeval* const tv_p = (timeout >= milliseconds::zero() ? &tv : nullptr);
-  if (tv_p) {
-    using Tv_sec  = decltype(tv.tv_sec);
-    using Tv_usec = decltype(tv.tv_usec);
-
-    const auto s = std::min(duration_cast<seconds>(timeout),
-      seconds{std::numeric_limits<Tv_sec>::max()});
-    const auto us = std::min(duration_cast<microseconds>(timeout - s),
-      microseconds{std::numeric_limits<Tv_usec>::max()});
-
-    tv_p->tv_sec  = static_cast<Tv_sec>(s.count());
-    tv_p->tv_usec = static_cast<Tv_usec>(us.count());
-  }
-
-  fd_set read_mask;
-  FD_ZERO(&read_mask);
-  fd_set write_mask;
-  FD_ZERO(&write_mask);
-  fd_set except_mask;
-  FD_ZERO(&except_mask);
+  if (!items && count)
+    throw Exception{"cannot poll null sockets"};
 
+#ifdef _WIN32
+  using Pollfd = WSAPOLLFD;
+#else
+  using Pollfd = pollfd;
+#endif
   using Ut = std::underlying_type_t<Socket_readiness>;
 
-  if (static_cast<Ut>(mask & Socket_readiness::read_ready))
-    FD_SET(socket, &read_mask);
-
-  if (static_cast<Ut>(mask & Socket_readiness::write_ready))
-    FD_SET(socket, &write_mask);
-
-  if (static_cast<Ut>(mask & Socket_readiness::exceptions))
-    FD_SET(socket, &except_mask);
+  // Most of the callers poll just a few sockets.
+  Pollfd small_fds[8];
+  std::vector<Pollfd> large_fds;
+  Pollfd* const fds = count <= std::size(small_fds) ? small_fds :
+    (large_fds.resize(count), large_fds.data());
+  for (std::size_t i = 0; i < count; ++i) {
+    if (!is_socket_valid(items[i].socket))
+      throw Exception{"cannot poll an invalid socket"};
+
+    fds[i].fd = items[i].socket;
+    fds[i].events = 0;
+    if (static_cast<Ut>(items[i].mask & Socket_readiness::read_ready))
+      fds[i].events |= POLLIN;
+    if (static_cast<Ut>(items[i].mask & Socket_readiness::write_ready))
+      fds[i].events |= POLLOUT;
+    if (static_cast<Ut>(items[i].mask & Socket_readiness::exceptions))
+      fds[i].events |= POLLPRI;
+    fds[i].revents = 0;
+  }
 
-  const int r = ::select(static_cast<int>(socket + 1) /* ignored on Windows */,
-    &read_mask, &write_mask, &except_mask, tv_p);
+  const int tout = timeout < std::chrono::milliseconds::zero() ? -1 :
+    static_cast<int>(std::min<std::chrono::milliseconds::rep>(timeout.count(),
+        std::numeric_limits<int>::max()));
+#ifdef _WIN32
+  const int r = ::WSAPoll(fds, static_cast<ULONG>(count), tout);
+#else
+  int r;
+  do {
+    r = ::poll(fds, static_cast<nfds_t>(count), tout);
+  } while (r < 0 && errno == EINTR);
+#endif
   if (is_socket_error(r))
     throw DMITIGR_NET_EXCEPTION{"socket error upon polling"};
 
-  auto result = Socket_readiness::unready;
-  if (r > 0) {
-    if (FD_ISSET(socket, &read_mask))
-      result |= Socket_readiness::read_ready;
+  std::size_t result{};
+  for (std::size_t i = 0; i < count; ++i) {
+    auto readiness = Socket_readiness::unready;
+    const auto revents = fds[i].revents;
+    /*
+     * Hang ups and errors are reported as readiness for reading in order to
+     * let the caller to detect them by the subsequent read operation.
+     */
+    if (revents & (POLLIN | POLLHUP | POLLERR))
+      readiness |= Socket_readiness::read_ready & items[i].mask;
+    if (revents & POLLOUT)
+      readiness |= Socket_readiness::write_ready;
+    if (revents & (POLLPRI | POLLERR))
+      readiness |= Socket_readiness::exceptions & items[i].mask;
+    items[i].readiness = readiness;
+    if (readiness != Socket_readiness::unready)
+      ++result;
+  }
+  return result;
+}
 
-    if (FD_ISSET(socket, &write_mask))
-      result |= Socket_readiness::write_ready;
+/**
+ * @brief Performs the polling of the `socket`.
+ *
+ * @returns The readiness of the socket according to the specified `mask`.
+ *
+ * @par Requires
+ * `is_socket_valid(socket)`.
+ *
+ * @remarks
+ * `(timeout < 0)` means *no timeout* and the function can block indefinitely!
+ *
+ * @remarks The implementation is based on poll() (WSAPoll() on Windows) and
+ * thus is not limited by `FD_SETSIZE`.
+ */
+inline Socket_readiness poll(const Socket_native socket,
+  const Socket_readiness mask, const std::chrono::milliseconds timeout)
+{
+  if (!is_socket_valid(socket))
+    throw Exception{"cannot poll an invalid socket"};
 
-    if (FD_ISSET(socket, &except_mask))
-      result |= Socket_readiness::exceptions;
-  }
+  Poll_item item{socket, mask};
+  poll(&item, 1, timeout);
+  return item.readiness;
+}
 
-  return result;
+/**
+ * @returns `true` if the peer of the connected `socket` is either performed
+ * an orderly shutdown or reset the connection, so there is nothing to receive.
+ *
+ * @par Requires
+ * `is_socket_valid(socket)`.
+ *
+ * @remarks Never blocks, and never consumes the received data.
+ */
+inline bool is_peer_closed(const Socket_native socket)
+{
+  if (!is_socket_valid(socket))
+    throw Exception{"cannot peek an invalid socket"};
+
+  char ch{};
+#ifdef _WIN32
+  u_long avail{};
+  if (::ioctlsocket(socket, FIONREAD, &avail) != 0)
+    return true;
+  else if (avail > 0)
+    return false;
+  else if (!bool(poll(socket, Socket_readiness::read_ready,
+        std::chrono::milliseconds::zero()) & Socket_readiness::read_ready))
+    return false;
+  const auto r = ::recv(socket, &ch, 1, MSG_PEEK);
+#else
+  ssize_t r;
+  do {
+    r = ::recv(socket, &ch, 1, MSG_PEEK | MSG_DONTWAIT);
+  } while (r < 0 && errno == EINTR);
+  if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+    return false;
+#endif
+  return r <= 0;
 }
 
 } // namespace dmitigr::net
@@ -31,6 +31,9 @@ class Ip_address;
 class Endpoint;
 class Listener_options;
 class Listener;
+class Reactor;
+struct Reactor_event;
+class Reaper;
 
 class Wsa_exception;
 class Wsa_error_category;